@@ -0,0 +1,384 @@
+//=========================================================================================================
+// animator.cpp - Implements an engine that plays animations on the 7-segment display
+//=========================================================================================================
+#include "animator.h"
+#include "globals.h"
+
+// The number of brightness steps it takes to fade out (and to fade back in)
+const int FADE_STEPS = 4;
+
+
+//=========================================================================================================
+// move() - Returns the segment "to" if segment "from" is lit in "glyph", otherwise 0
+//=========================================================================================================
+static U8 move(U8 glyph, U8 from, U8 to)
+{
+    return (glyph & from) ? to : 0;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// roll_out() - Returns a digit that has rolled up by half of its height (step 1) or nearly all of its
+//              height (step 2)
+//=========================================================================================================
+static U8 roll_out(U8 glyph, int step)
+{
+    // After rolling all the way up, only the bottom segment is still in view, at the top
+    if (step == 2) return move(glyph, SEG_D, SEG_A);
+
+    // After rolling half-way up, the bottom half of the digit is in the top half of the display
+    return move(glyph, SEG_G, SEG_A) | move(glyph, SEG_C, SEG_B) |
+           move(glyph, SEG_E, SEG_F) | move(glyph, SEG_D, SEG_G);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// roll_in() - Returns a digit that has rolled into view from below by nearly none of its height
+//             (step 2) or half of its height (step 1)
+//=========================================================================================================
+static U8 roll_in(U8 glyph, int step)
+{
+    // When the digit first comes into view, only its top segment is showing, at the bottom
+    if (step == 2) return move(glyph, SEG_A, SEG_D);
+
+    // After rolling half-way in, the top half of the digit is in the bottom half of the display
+    return move(glyph, SEG_A, SEG_G) | move(glyph, SEG_B, SEG_C) |
+           move(glyph, SEG_F, SEG_E) | move(glyph, SEG_G, SEG_D);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// init() - Called once at startup to create the frame timer
+//=========================================================================================================
+void CAnimator::init(int fps)
+{
+    esp_timer_create_args_t args;
+
+    // Set the frame rate
+    m_fps = ANIM_DEFAULT_FPS;
+    set_frame_rate(fps);
+
+    // The frame timer calls on_timer() from the esp_timer task
+    memset(&args, 0, sizeof args);
+    args.callback        = on_timer;
+    args.arg             = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name            = "animator";
+
+    // Create the timer.  It doesn't run until an animation is playing
+    if (esp_timer_create(&args, &m_timer) != ESP_OK)
+    {
+        printf(">>> Failed to create the animation timer <<<\n");
+        m_timer = nullptr;
+    }
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// set_frame_rate() - Sets the frame rate of subsequent animations.  Returns false if "fps" is invalid
+//=========================================================================================================
+bool CAnimator::set_frame_rate(int fps)
+{
+    if (!is_valid_frame_rate(fps)) return false;
+    m_fps = fps;
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// on_timer() - Called by the esp_timer on every frame tick.  This asks the display manager to show the
+//              next frame.  If the display manager hasn't gotten to the previous tick yet, this tick
+//              is dropped rather than letting them pile up in its queue
+//=========================================================================================================
+void CAnimator::on_timer(void* context)
+{
+    // Fetch a pointer to the object that owns this timer
+    CAnimator* p_object = (CAnimator*) context;
+
+    // If the animation has been stopped, there's nothing to do
+    if (!p_object->m_is_running) return;
+
+    // Hand the tick to the display manager, unless it's still busy with the last one
+    if (!p_object->m_is_tick_pending)
+    {
+        p_object->m_is_tick_pending = true;
+        if (DisplayMgr.animation_tick()) return;
+        p_object->m_is_tick_pending = false;
+    }
+
+    // If we get here, this tick was dropped
+    ++p_object->m_report.dropped;
+    Metrics.anim_dropped.inc();
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// add_frame() - Appends a frame to the animation being compiled.  Returns false if there's no room
+//=========================================================================================================
+bool CAnimator::add_frame(const U8* ram, int brightness, int ticks)
+{
+    // If the animation is full, tell the caller
+    if (m_frame_count == ANIM_MAX_FRAMES) return false;
+
+    // Fill in the frame
+    anim_frame_t& frame = m_frame[m_frame_count++];
+    memcpy(frame.ram, ram, sizeof frame.ram);
+    frame.brightness = brightness;
+    frame.ticks      = (ticks < 1) ? 1 : (ticks > 255) ? 255 : ticks;
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// marquee() - Scrolls a string across the display from right to left.  The first 4 characters are
+//             held in place for a second so they can be read, then the string scrolls until the last
+//             character has left the display
+//=========================================================================================================
+bool CAnimator::marquee(const char* text)
+{
+    char padded[ANIM_MAX_TEXT + 5];
+    U8   ram[CHT16K33::FRAME_SIZE];
+
+    // Find out how long it takes to compile the animation
+    S64 compile_start = esp_timer_get_time();
+
+    // Stop any animation that's already playing
+    stop();
+
+    // Follow the text with enough blanks to scroll it all the way off the display
+    int length = strlen(text);
+    if (length > ANIM_MAX_TEXT) length = ANIM_MAX_TEXT;
+    memcpy(padded, text, length);
+    strcpy(padded + length, "    ");
+
+    // This is how many ticks each scroll position stays on the display
+    int ticks = m_fps / ANIM_SCROLL_CPS;
+
+    // Compile one frame for each scroll position
+    m_frame_count = 0;
+    for (int position = 0; position <= length; ++position)
+    {
+        Display.build_string(padded + position, ram);
+        add_frame(ram, ANIM_SAME_BRIGHTNESS, position ? ticks : m_fps);
+    }
+
+    // And start the animation
+    return start("marquee", compile_start);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// roll() - Rolls each digit that differs between the display and "target" out of view, as the new
+//          digit rolls into view from below
+//=========================================================================================================
+bool CAnimator::roll(const U8* target)
+{
+    U8 ram[CHT16K33::FRAME_SIZE], current[CHT16K33::FRAME_SIZE];
+
+    // Find out how long it takes to compile the animation
+    S64 compile_start = esp_timer_get_time();
+
+    // Stop any animation that's already playing
+    stop();
+
+    // This is what is on the display right now
+    Display.get_frame(current);
+
+    // Compile the frames between the current digits and the new ones
+    m_frame_count = 0;
+    for (int step = 1; step <= 3; ++step)
+    {
+        // Everything but the digits comes straight from the target frame
+        memcpy(ram, target, sizeof ram);
+
+        // Build each digit that is changing
+        for (int i=0; i<DISPLAY_DIGITS; ++i)
+        {
+            int address = digit_address[i];
+            U8  old_glyph = current[address] & ~SEG_DP;
+            U8  new_glyph = target[address]  & ~SEG_DP;
+
+            // Digits that aren't changing don't move
+            if (old_glyph == new_glyph) continue;
+
+            // Step 1: old digit half-way out.  Step 2: old digit nearly out, new digit just coming
+            // in.  Step 3: new digit half-way in.  The decimal point doesn't move
+            U8 segments = 0;
+            if (step == 1) segments = roll_out(old_glyph, 1);
+            if (step == 2) segments = roll_out(old_glyph, 2) | roll_in(new_glyph, 2);
+            if (step == 3) segments = roll_in(new_glyph, 1);
+            ram[address] = segments | (target[address] & SEG_DP);
+        }
+
+        // Add this frame to the animation
+        add_frame(ram, ANIM_SAME_BRIGHTNESS, 1);
+    }
+
+    // And the animation ends on the target frame
+    add_frame(target, ANIM_SAME_BRIGHTNESS, 1);
+
+    // Start the animation
+    return start("roll", compile_start);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// crossfade() - Fades the display out, switches to "target", and fades it back in.  The display is
+//               faded from, and back to, the user's configured brightness
+//=========================================================================================================
+bool CAnimator::crossfade(const U8* target)
+{
+    U8 current[CHT16K33::FRAME_SIZE];
+
+    // Find out how long it takes to compile the animation
+    S64 compile_start = esp_timer_get_time();
+
+    // Stop any animation that's already playing
+    stop();
+
+    // Make a copy of what's on the display right now
+    Display.get_frame(current);
+
+    // This is the brightness we fade down from and back up to
+    int level = NVS.data.brightness;
+    if (level < 0) level = 0;
+    if (level > 15) level = 15;
+
+    // Compile the frames that fade the current display out
+    m_frame_count = 0;
+    for (int step = FADE_STEPS - 1; step >= 0; --step)
+    {
+        add_frame(current, level * step / FADE_STEPS, 1);
+    }
+
+    // And the frames that fade the new display in
+    for (int step = 0; step <= FADE_STEPS; ++step)
+    {
+        add_frame(target, level * step / FADE_STEPS, 1);
+    }
+
+    // Start the animation
+    return start("crossfade", compile_start);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// start() - Starts the animation that has been compiled into m_frame.  The first frame is displayed
+//           right away, and each subsequent frame on a tick of the frame timer
+//=========================================================================================================
+bool CAnimator::start(const char* name, S64 compile_start)
+{
+    // If we don't have a frame timer, we can't animate
+    if (m_timer == nullptr) return false;
+
+    // We haven't shown anything yet
+    memset(&m_report, 0, sizeof m_report);
+    m_report.name   = name;
+    m_report.cpu_us = (U32)(esp_timer_get_time() - compile_start);
+
+    // The first frame goes up right away
+    m_next_frame = 0;
+    m_ticks_left = 1;
+    m_is_running = true;
+    m_started_at = esp_timer_get_time();
+    step();
+
+    // And the frame timer takes it from there
+    esp_timer_start_periodic(m_timer, 1000000 / m_fps);
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// step() - Shows the next frame, if it's time to.  Returns false once the animation has finished
+//=========================================================================================================
+bool CAnimator::step()
+{
+    // The display manager has acted on the most recent tick
+    m_is_tick_pending = false;
+
+    // If no animation is playing, there's nothing to do
+    if (!m_is_running) return false;
+
+    // If the current frame stays on the display a while longer, we're done for now
+    if (--m_ticks_left > 0) return true;
+
+    // If the last frame has been on the display long enough, the animation is over
+    if (m_next_frame == m_frame_count)
+    {
+        finish();
+        return false;
+    }
+
+    // Find out how long it takes, and how many bytes on the bus, to show this frame
+    S64 start_time = esp_timer_get_time();
+    U32 start_bytes = Metrics.display_bus_bytes.value();
+
+    // Fetch the frame we're going to show
+    const anim_frame_t& frame = m_frame[m_next_frame++];
+
+    // Set the brightness and show the frame
+    if (frame.brightness != ANIM_SAME_BRIGHTNESS) Display.set_brightness(frame.brightness);
+    Display.write_frame(frame.ram);
+
+    // Keep it on the display for the specified number of ticks
+    m_ticks_left = frame.ticks;
+
+    // Keep track of what it cost to show this frame
+    U32 elapsed = (U32)(esp_timer_get_time() - start_time);
+    ++m_report.frames;
+    m_report.cpu_us    += elapsed;
+    m_report.bus_bytes += Metrics.display_bus_bytes.value() - start_bytes;
+    Metrics.anim_frames.inc();
+    Metrics.anim_frame_us.observe(elapsed);
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// stop() - Stops the animation that's playing, leaving whatever frame is on the display
+//=========================================================================================================
+void CAnimator::stop()
+{
+    if (m_is_running) finish();
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// finish() - Stops the frame timer and reports what the animation cost
+//=========================================================================================================
+void CAnimator::finish()
+{
+    // Stop the frame timer
+    m_is_running = false;
+    esp_timer_stop(m_timer);
+
+    // If we were stopped part way through a cross-fade, put the brightness back where it belongs
+    Display.set_brightness(NVS.data.brightness);
+
+    // Find out how long the animation played
+    m_report.duration_ms = (U32)((esp_timer_get_time() - m_started_at) / 1000);
+    U32 duration_ms = m_report.duration_ms ? m_report.duration_ms : 1;
+
+    // Report the cost of the animation, and its cost per second of animation
+    printf(">>> Animation %s: %u ms, %u frames, %u dropped, %u us (%u us/s), %u bytes (%u bytes/s) <<<\n",
+           m_report.name, (unsigned)m_report.duration_ms, (unsigned)m_report.frames,
+           (unsigned)m_report.dropped, (unsigned)m_report.cpu_us,
+           (unsigned)((U64)m_report.cpu_us * 1000 / duration_ms),
+           (unsigned)m_report.bus_bytes,
+           (unsigned)((U64)m_report.bus_bytes * 1000 / duration_ms));
+}
+//=========================================================================================================
@@ -0,0 +1,150 @@
+//=========================================================================================================
+// animator.h - Defines an engine that plays animations on the 7-segment display
+//
+// An animation is compiled into a list of frames up front, then played back one frame per tick of a
+// periodic esp_timer.  The timer callback doesn't touch the display: it asks the display manager to
+// show the next frame, so that every write to the display happens in the display manager's task
+//=========================================================================================================
+#pragma once
+#include <esp_timer.h>
+#include "common.h"
+#include "ht16k33.h"
+
+// The frame rate we play animations at unless told otherwise
+#define ANIM_DEFAULT_FPS  20
+
+// The longest animation we can compile
+#define ANIM_MAX_FRAMES   48
+
+// The longest string that can be scrolled across the display
+#define ANIM_MAX_TEXT     32
+
+// Marquee text scrolls at this many characters per second
+#define ANIM_SCROLL_CPS   4
+
+// A brightness of this value in a frame means "leave the brightness alone"
+#define ANIM_SAME_BRIGHTNESS 0xFF
+
+//=========================================================================================================
+// anim_frame_t - A single frame of an animation
+//=========================================================================================================
+struct anim_frame_t
+{
+    // The image of display RAM
+    U8      ram[CHT16K33::FRAME_SIZE];
+
+    // The brightness to display this frame at, or ANIM_SAME_BRIGHTNESS
+    U8      brightness;
+
+    // The number of ticks this frame stays on the display
+    U8      ticks;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// anim_report_t - Describes what the most recent animation cost us
+//=========================================================================================================
+struct anim_report_t
+{
+    // The name of the animation
+    const char* name;
+
+    // How long it played for (in milliseconds), and how many frames were shown
+    U32         duration_ms;
+    U32         frames;
+
+    // The number of frame-ticks that were skipped because the display task was busy
+    U32         dropped;
+
+    // Microseconds spent compiling the animation and showing its frames
+    U32         cpu_us;
+
+    // Bytes that went out on the I2C bus to show the frames
+    U32         bus_bytes;
+};
+//=========================================================================================================
+
+
+class CAnimator
+{
+public:
+
+    // Called once at startup to create the frame timer
+    void    init(int fps = ANIM_DEFAULT_FPS);
+
+    // Returns true if animations can play at "fps" frames per second
+    static bool is_valid_frame_rate(int fps) {return fps >= 1 && fps <= 50;}
+
+    // Sets the frame rate of subsequent animations.  Once the display manager is running, this must only
+    // be called from its task.  Other tasks call CDisplayMgr::set_frame_rate()
+    bool    set_frame_rate(int fps);
+
+    // Returns the frame rate in frames per second
+    int     frame_rate() {return m_fps;}
+
+    // These compile an animation and start it playing.  Any animation that's already playing is stopped.
+    // They (and step() and stop()) must only be called from the display manager's task
+
+    // Scrolls a string across the display from right to left
+    bool    marquee(const char* text);
+
+    // Rolls each digit that differs between what's on the display and "frame" up and out of view as the
+    // new digit rolls up into place
+    bool    roll(const U8* frame);
+
+    // Fades the display out, switches to "frame", and fades it back in
+    bool    crossfade(const U8* frame);
+
+    // Shows the next frame.  Returns false once the animation has finished
+    bool    step();
+
+    // Stops the animation that's playing
+    void    stop();
+
+    // Returns true if an animation is playing
+    bool    is_running() {return m_is_running;}
+
+    // Returns the cost of the most recent animation
+    const anim_report_t& report() {return m_report;}
+
+protected:
+
+    // Called by the esp_timer on every frame tick
+    static void on_timer(void* context);
+
+    // Starts the animation that has been compiled into m_frame
+    bool    start(const char* name, S64 compile_start);
+
+    // Called when the animation is over
+    void    finish();
+
+    // Appends a frame to the animation.  Returns false if the animation is full
+    bool    add_frame(const U8* ram, int brightness, int ticks);
+
+    // The periodic timer that drives playback
+    esp_timer_handle_t  m_timer;
+
+    // Frames per second
+    int                 m_fps;
+
+    // The compiled animation
+    anim_frame_t        m_frame[ANIM_MAX_FRAMES];
+    int                 m_frame_count;
+
+    // The index of the next frame to show, and the ticks remaining on the current one
+    int                 m_next_frame;
+    int                 m_ticks_left;
+
+    // True while an animation is playing
+    volatile bool       m_is_running;
+
+    // True when a frame-tick has been handed to the display manager but not yet acted on
+    volatile bool       m_is_tick_pending;
+
+    // The time the animation started, in microseconds since boot
+    S64                 m_started_at;
+
+    // The cost of the current (or most recent) animation
+    anim_report_t       m_report;
+};
@@ -0,0 +1,114 @@
+//=========================================================================================================
+// assets.cpp - Implements an interface to the read-only asset partition
+//=========================================================================================================
+#include "globals.h"
+
+// This is the partition that holds the asset image.  See partitions.csv
+static const char* PARTITION_LABEL = "assets";
+const esp_partition_subtype_t PARTITION_SUBTYPE = (esp_partition_subtype_t)0x41;
+
+// Every asset image begins with this.  It must match tools/mkassets.py
+const U32 ASSET_MAGIC = 0x54455341;   // "ASET"
+
+
+//=========================================================================================================
+// begin() - Maps the asset partition into the address space and validates the index
+//
+// Every asset is checked against its CRC here, once, so that a partially flashed or corrupt image is
+// never served
+//=========================================================================================================
+bool CAssets::begin()
+{
+    const void* mapped;
+
+    // Find our partition
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, PARTITION_SUBTYPE, PARTITION_LABEL);
+    if (partition == nullptr)
+    {
+        printf("No asset partition\n");
+        return false;
+    }
+
+    // Map the entire partition into the data address space
+    esp_err_t status = esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &mapped, &m_handle);
+    if (status != ESP_OK)
+    {
+        printf("*** esp_partition_mmap() failed!! (%s)\n", esp_err_to_name(status));
+        return false;
+    }
+
+    m_image = (const U8*)mapped;
+    m_size  = partition->size;
+
+    // Validate the header.  The entry count is checked against the room the partition has for entries,
+    // rather than multiplied out, so that a garbage count can't overflow the size calculation
+    const asset_header_t* header = (const asset_header_t*)m_image;
+    if (m_size < sizeof(asset_header_t) || header->magic != ASSET_MAGIC ||
+        header->count > (m_size - sizeof(asset_header_t)) / sizeof(asset_entry_t))
+    {
+        printf("Asset partition is empty or invalid\n");
+        spi_flash_munmap(m_handle);
+        return false;
+    }
+
+    // Validate every entry in the index
+    m_entry = (const asset_entry_t*)(m_image + sizeof(asset_header_t));
+    for (U32 i=0; i<header->count; ++i)
+    {
+        if (!is_valid(m_entry[i]))
+        {
+            printf("*** Asset \"%.*s\" is corrupt!!\n", (int)sizeof(m_entry[i].name), m_entry[i].name);
+            spi_flash_munmap(m_handle);
+            return false;
+        }
+    }
+
+    // The assets are ready for use
+    m_count = header->count;
+    printf("Asset partition has %i assets\n", m_count);
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// is_valid() - Checks that an entry lies within the image, that its strings are nul-terminated, and
+//              that its data matches its CRC
+//=========================================================================================================
+bool CAssets::is_valid(const asset_entry_t& entry)
+{
+    // The name and content-type must be nul-terminated
+    if (entry.name[sizeof(entry.name) - 1] || entry.content_type[sizeof(entry.content_type) - 1]) return false;
+
+    // The data must lie within the partition
+    if (entry.offset > m_size || entry.length > m_size - entry.offset) return false;
+
+    // And it must match its CRC
+    return crc32((void*)(m_image + entry.offset), entry.length) == entry.crc;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// find() - Looks up an asset by resource name
+//
+// Returns: true if the asset was found, in which case *p_asset points into mapped flash
+//=========================================================================================================
+bool CAssets::find(const char* name, asset_t* p_asset)
+{
+    for (int i=0; i<m_count; ++i)
+    {
+        const asset_entry_t& entry = m_entry[i];
+        if (strcmp(entry.name, name) == 0)
+        {
+            p_asset->data         = (const char*)(m_image + entry.offset);
+            p_asset->length       = entry.length;
+            p_asset->content_type = entry.content_type;
+            return true;
+        }
+    }
+
+    // If we get here, there's no such asset
+    return false;
+}
+//=========================================================================================================
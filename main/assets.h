@@ -0,0 +1,89 @@
+//=========================================================================================================
+// assets.h - Defines an interface to the read-only asset partition
+//
+// The asset partition holds static web content (built from the "assets" directory by tools/mkassets.py)
+// and is memory-mapped, so assets can be sent straight from flash without being copied into RAM.
+//
+// Image format (all values little-endian):
+//
+//   asset_header_t                 magic, number of entries
+//   asset_entry_t[count]           name, content-type, offset, length and CRC32 of each asset
+//   data                           the contents of every asset
+//=========================================================================================================
+#pragma once
+#include <esp_partition.h>
+#include "common.h"
+
+
+//=========================================================================================================
+// The structures that make up the index at the start of the asset image
+//=========================================================================================================
+struct asset_header_t
+{
+    U32     magic;
+    U32     count;
+};
+
+struct asset_entry_t
+{
+    char    name[48];           // The resource name, e.g. "/robots.txt"
+    char    content_type[32];   // The MIME type, e.g. "text/plain"
+    U32     offset;             // Offset of the data from the start of the image
+    U32     length;             // Length of the data in bytes
+    U32     crc;                // CRC32 of the data
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// asset_t - Describes a single asset.  "data" points directly into memory-mapped flash
+//=========================================================================================================
+struct asset_t
+{
+    const char* data;
+    U32         length;
+    const char* content_type;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// CAssets - Singleton class, provides access to the asset partition
+//=========================================================================================================
+class CAssets
+{
+public:
+
+    // Constructor
+    CAssets() {m_count = 0;}
+
+    // Call this once at startup to map the partition.  Returns false if there are no usable assets
+    bool    begin();
+
+    // Call this to look up an asset by resource name
+    bool    find(const char* name, asset_t* p_asset);
+
+    // Returns the number of assets available
+    int     count() {return m_count;}
+
+protected:
+
+    // Checks that an entry lies within the image and that its data matches its CRC
+    bool    is_valid(const asset_entry_t& entry);
+
+    // The start of the memory-mapped image
+    const U8*       m_image;
+
+    // The size of the partition
+    U32             m_size;
+
+    // The index of assets, within the mapped image
+    const asset_entry_t* m_entry;
+
+    // The number of entries in the index
+    int             m_count;
+
+    // The handle that esp_partition_mmap() gives us
+    spi_flash_mmap_handle_t m_handle;
+};
+//=========================================================================================================
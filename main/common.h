@@ -10,6 +10,7 @@
 #define TASK_CPU          1
 #define DEFAULT_TASK_PRI  5
 #define TASK_PRIO_TCP     6
+#define TASK_PRIO_I2C     8  // The I2C bus task
 #define TASK_PRIO_FLASH   9  // This has to be higher priority than all other tasks
 
 #define USE_NTP 1
@@ -72,7 +73,8 @@ typedef  int64_t    S64;
 //=========================================================================================================
 // This is the structure that we're going to read and write to/from non-volatile storage
 //
-// If this changes, be sure to update CURRENT_STRUCT_VERSION and init_default_data() in nv_storage.cpp!!
+// If this changes, be sure to update CURRENT_STRUCT_VERSION, field_table[], and migration_chain[] in
+// nv_storage.cpp!!  The static_asserts there will catch a change that would lose stored data
 //
 // This structure should always be 1024 bytes long
 //=========================================================================================================
@@ -0,0 +1,125 @@
+//=========================================================================================================
+// crc32.cpp - Implements a fast, streaming CRC-32
+//
+// The slicing-by-8 method uses eight 256-entry tables so that it can consume 8 bytes per step instead
+// of 1.  Table 0 is the classic byte-at-a-time table, and table 'n' gives the CRC contribution of a byte
+// that is followed by 'n' more bytes.  The tables are computed by the compiler and live in flash.
+//=========================================================================================================
+#include <string.h>
+#include "crc32.h"
+
+#if CRC32_USE_ROM
+#include <esp_rom_crc.h>
+#endif
+
+// The reflected CRC-32 polynomial
+const uint32_t POLYNOMIAL = 0xEDB88320;
+
+
+//=========================================================================================================
+// crc_tables_t - The slicing-by-8 lookup tables
+//=========================================================================================================
+struct crc_tables_t {uint32_t t[8][256];};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// The toolchain compiles with C++11, where a constexpr function must be a single return statement.  So
+// the tables are computed with recursion rather than loops, and each row is filled in by expanding a
+// list of the indices 0 thru 255
+//=========================================================================================================
+template <int... I> struct index_list {};
+template <int N, int... I> struct make_index_list : make_index_list<N - 1, N - 1, I...> {};
+template <int... I> struct make_index_list<0, I...> {typedef index_list<I...> type;};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// shift_bits() - Shifts "bits" bits out of a CRC, one at a time
+//=========================================================================================================
+static constexpr uint32_t shift_bits(uint32_t crc, int bits)
+{
+    return (bits == 0) ? crc : shift_bits((crc >> 1) ^ ((crc & 1) ? POLYNOMIAL : 0), bits - 1);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// table_entry() - Computes entry "i" of table "n"
+//
+// Table 0 is the classic table: the CRC of each possible single byte.  Each subsequent table pushes the
+// prior table's entry through one more zero byte
+//=========================================================================================================
+static constexpr uint32_t push_zero_byte(uint32_t prior) {return (prior >> 8) ^ shift_bits(prior & 0xFF, 8);}
+
+static constexpr uint32_t table_entry(int n, uint32_t i)
+{
+    return (n == 0) ? shift_bits(i, 8) : push_zero_byte(table_entry(n - 1, i));
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// make_tables() - Computes the slicing-by-8 lookup tables at compile time
+//=========================================================================================================
+template <int... I> static constexpr crc_tables_t make_tables(index_list<I...>)
+{
+    return crc_tables_t
+    {{
+        {table_entry(0, I)...}, {table_entry(1, I)...}, {table_entry(2, I)...}, {table_entry(3, I)...},
+        {table_entry(4, I)...}, {table_entry(5, I)...}, {table_entry(6, I)...}, {table_entry(7, I)...}
+    }};
+}
+//=========================================================================================================
+
+static constexpr crc_tables_t crc_tables = make_tables(make_index_list<256>::type());
+
+// Spot-check the tables against well-known values from the classic CRC-32 table
+static_assert(crc_tables.t[0][1]   == 0x77073096, "CRC table 0 is wrong");
+static_assert(crc_tables.t[0][255] == 0x2D02EF8D, "CRC table 0 is wrong");
+
+
+//=========================================================================================================
+// crc32_update() - Folds more bytes into a running CRC
+//=========================================================================================================
+uint32_t crc32_update(uint32_t crc, const void* buffer, size_t length)
+{
+#if CRC32_USE_ROM
+    return esp_rom_crc32_le(crc, (const uint8_t*)buffer, length);
+#else
+    const uint8_t* p = (const uint8_t*)buffer;
+    const auto& t = crc_tables.t;
+
+    // The CRC is kept inverted while we work on it
+    crc = ~crc;
+
+    // Consume single bytes until we reach a 4-byte boundary
+    while (length && ((uintptr_t)p & 3))
+    {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+        --length;
+    }
+
+    // Consume 8 bytes at a time.  This relies on the CPU being little-endian, as the ESP32 is
+    while (length >= 8)
+    {
+        uint32_t lo, hi;
+        memcpy(&lo, p,     4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = t[7][ lo        & 0xFF] ^ t[6][(lo >>  8) & 0xFF] ^
+              t[5][(lo >> 16) & 0xFF] ^ t[4][ lo >> 24        ] ^
+              t[3][ hi        & 0xFF] ^ t[2][(hi >>  8) & 0xFF] ^
+              t[1][(hi >> 16) & 0xFF] ^ t[0][ hi >> 24        ];
+        p      += 8;
+        length -= 8;
+    }
+
+    // Consume whatever bytes are left over
+    while (length--) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+
+    // Invert the CRC to its normalized form
+    return ~crc;
+#endif
+}
+//=========================================================================================================
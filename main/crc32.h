@@ -0,0 +1,51 @@
+//=========================================================================================================
+// crc32.h - Defines a fast, streaming CRC-32 (the same CRC as zlib, Ethernet and PNG)
+//
+// Like series_codec.h, this depends on nothing but the C standard library, so the CRC can be tested on
+// a Linux host
+//=========================================================================================================
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+//=========================================================================================================
+// Change this 0 to a 1 to compute CRCs with the routine in the ESP32's ROM instead of the slicing-by-8
+// tables.  The results are identical.  The ROM routine saves the 8K of tables in flash
+//=========================================================================================================
+#define CRC32_USE_ROM 0
+//=========================================================================================================
+
+
+//=========================================================================================================
+// crc32_update() - Folds more bytes into a running CRC.  Start with crc = 0.  The result of each call
+//                  is a finished CRC of everything so far, and can be passed back in to continue
+//=========================================================================================================
+uint32_t crc32_update(uint32_t crc, const void* buffer, size_t length);
+//=========================================================================================================
+
+
+//=========================================================================================================
+// CCRC32 - Computes a CRC over data that arrives in pieces
+//=========================================================================================================
+class CCRC32
+{
+public:
+
+    // Constructor
+    CCRC32() {reset();}
+
+    // Call this to start a new CRC
+    void    reset() {m_crc = 0;}
+
+    // Call this to fold in the next piece of data
+    void    update(const void* buffer, size_t length) {m_crc = crc32_update(m_crc, buffer, length);}
+
+    // Call this to fetch the CRC of everything so far
+    uint32_t value() {return m_crc;}
+
+protected:
+
+    // The CRC of everything so far
+    uint32_t m_crc;
+};
+//=========================================================================================================
@@ -13,22 +13,39 @@ enum qentry_t : unsigned char
     DISPLAY_IP0,
     DISPLAY_IP1,
     DISPLAY_IP2,
-    DISPLAY_IP3
+    DISPLAY_IP3,
+    DISPLAY_TEXT,
+    ANIMATING,
+    ANIMATION_FRAME,
+    SET_FRAME_RATE
 };
 qentry_t current_mode = DISPLAY_NOW;
 
+// An event in the queue.  Whatever the event needs is carried in the event itself, so the task that
+// posts it never shares data with our task
+struct event_t
+{
+    qentry_t    cmd;
+    int         fps;                        // For SET_FRAME_RATE
+    char        text[ANIM_MAX_TEXT + 1];    // For DISPLAY_TEXT
+};
+
 
 //=========================================================================================================
 // display_current_time() - Displays the current wall-clock time on the display
+//
+// Passed: roll = true if the digits that change should roll into place
 //=========================================================================================================
-static void display_current_time()
+static void display_current_time(bool roll = false)
 {
     struct tm timeinfo;
+    U8        frame[CHT16K33::FRAME_SIZE];
 
     // If we're in Wi-Fi AP mode, don't display a time
     if (Network.wifi_status() == WIFI_AP_MODE)
     {
-        Display.show_string(" AP ");
+        Animator.stop();
+        Display.show_ap_mode();
         return;
     }
 
@@ -42,8 +59,13 @@ static void display_current_time()
     if (timeinfo.tm_hour > 12) timeinfo.tm_hour -= 12;
     if (timeinfo.tm_hour == 0) timeinfo.tm_hour = 12; 
 
-    // Display the time on the physical display
-    Display.show_time(timeinfo.tm_hour, timeinfo.tm_min);
+    // Roll the new time onto the display, or if we can't, display it right away
+    Display.build_time(timeinfo.tm_hour, timeinfo.tm_min, frame);
+    if (!roll || !Animator.roll(frame))
+    {
+        Animator.stop();
+        Display.show_time(timeinfo.tm_hour, timeinfo.tm_min);
+    }
 
     // Print the time to stdout to aid in debugging
     printf(">>> %2i:%02i <<<\n", timeinfo.tm_hour, timeinfo.tm_min);
@@ -56,8 +78,11 @@ static void display_current_time()
 //=========================================================================================================
 static void display_ip_octet(int n)
 {
-    // Display the characters on the phyiscal display
-    Display.show_number(n);
+    U8 frame[CHT16K33::FRAME_SIZE];
+
+    // Cross-fade to the characters on the phyiscal display, or if we can't, display them right away
+    Display.build_number(n, frame);
+    if (!Animator.crossfade(frame)) Display.show_number(n);
 
     // Print the number to stdout to aid in debugging
     printf(">>> %i <<<\n", n);
@@ -138,7 +163,7 @@ void CDisplayMgr::start()
     if (m_task_handle) return;
 
     // Create the queue that the ISR will post event messages to when an interrupt occurs
-    m_event_queue = xQueueCreate(10, sizeof(qentry_t));
+    m_event_queue = xQueueCreate(10, sizeof(event_t));
 
     // How long we should wait for an incoming event
     m_wait_time_ms = FOREVER;
@@ -156,8 +181,9 @@ void CDisplayMgr::start()
 //=========================================================================================================
 void CDisplayMgr::display_now()
 {
-    qentry_t cmd = DISPLAY_NOW;
-    xQueueSend(m_event_queue, &cmd, 0);
+    event_t event;
+    event.cmd = DISPLAY_NOW;
+    xQueueSend(m_event_queue, &event, 0);
 }
 //=========================================================================================================
 
@@ -169,8 +195,52 @@ void CDisplayMgr::display_now()
 //=========================================================================================================
 void CDisplayMgr::display_ip_address()
 {
-    qentry_t cmd = DISPLAY_IP0;
-    xQueueSend(m_event_queue, &cmd, 0);
+    event_t event;
+    event.cmd = DISPLAY_IP0;
+    xQueueSend(m_event_queue, &event, 0);
+}
+//=========================================================================================================
+
+
+
+//=========================================================================================================
+// display_text() - Displays a string.  Strings longer than 4 characters are scrolled
+//=========================================================================================================
+void CDisplayMgr::display_text(const char* text)
+{
+    event_t event;
+    event.cmd = DISPLAY_TEXT;
+
+    // The string travels in the event, so our task has its own copy
+    safe_copy(event.text, text);
+    xQueueSend(m_event_queue, &event, 0);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// set_frame_rate() - Has our task set the frame rate of subsequent animations, so that the rate can't
+//                    change while an animation is being compiled
+//=========================================================================================================
+bool CDisplayMgr::set_frame_rate(int fps)
+{
+    event_t event;
+    event.cmd = SET_FRAME_RATE;
+    event.fps = fps;
+    return xQueueSend(m_event_queue, &event, 0) == pdTRUE;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// animation_tick() - Called by the animator's timer when it's time for the next animation frame
+//=========================================================================================================
+bool CDisplayMgr::animation_tick()
+{
+    event_t event;
+    event.cmd = ANIMATION_FRAME;
+    if (m_event_queue == nullptr) return false;
+    return xQueueSend(m_event_queue, &event, 0) == pdTRUE;
 }
 //=========================================================================================================
 
@@ -181,12 +251,15 @@ void CDisplayMgr::display_ip_address()
 //=========================================================================================================
 void CDisplayMgr::task()
 {
+    event_t  event;
     qentry_t cmd;
+    bool     have_event;
 
     while (true)
     {
-        // If the current mode is "Wait for the minute to change", determine how long to wait
-        if (current_mode == WAITING_FOR_FLIP)
+        // If we're waiting for the minute to change, determine how long to wait.  An animation
+        // that's playing doesn't get to delay a minute flip
+        if (current_mode == WAITING_FOR_FLIP || current_mode == ANIMATING)
         {
             int seconds = seconds_until_flip() - 2;
             m_wait_time_ms = (seconds > 0) ? seconds * 1000 : 500;
@@ -195,8 +268,44 @@ void CDisplayMgr::task()
         // Determine how many timer ticks to wait for
         TickType_t ticks = (m_wait_time_ms == FOREVER) ? portMAX_DELAY : m_wait_time_ms / portTICK_PERIOD_MS;
 
+        // This is when we started waiting
+        TickType_t wait_start = xTaskGetTickCount();
+        TickType_t wait_ticks = ticks;
+
+        // Wait for an event.  Animation frames and frame rate changes are handled as they arrive, but
+        // they don't change the mode, and they don't stretch the time we wait
+        while (true)
+        {
+            have_event = xQueueReceive(m_event_queue, &event, ticks);
+            if (!have_event) break;
+            cmd = event.cmd;
+
+            // Anything but an animation frame or a frame rate change switches to a new mode
+            if (cmd != ANIMATION_FRAME && cmd != SET_FRAME_RATE) break;
+
+            // A new frame rate applies to the next animation we compile
+            if (cmd == SET_FRAME_RATE) Animator.set_frame_rate(event.fps);
+
+            // Show the next frame.  When a scrolling string finishes, go back to displaying the time
+            else if (!Animator.step() && current_mode == ANIMATING)
+            {
+                cmd = DISPLAY_NOW;
+                break;
+            }
+
+            // Wait for whatever is left of the original wait time
+            if (wait_ticks != portMAX_DELAY)
+            {
+                TickType_t elapsed = xTaskGetTickCount() - wait_start;
+                ticks = (elapsed < wait_ticks) ? wait_ticks - elapsed : 0;
+            }
+        }
+
         // If we received a new message from the event queue, switch to that mode
-        if (xQueueReceive(m_event_queue, &cmd, ticks)) current_mode = cmd;
+        if (have_event) current_mode = cmd;
+
+        // A string to display comes with its event
+        if (have_event && cmd == DISPLAY_TEXT) safe_copy(m_text, event.text);
         
         // Do whatever it correct for the current mode
         switch(current_mode)
@@ -207,7 +316,27 @@ void CDisplayMgr::task()
                 break;            
 
             case WAITING_FOR_FLIP:
-                if (seconds_until_flip() > 55) display_current_time();
+                if (seconds_until_flip() > 55) display_current_time(true);
+                break;
+
+            case DISPLAY_TEXT:
+                if (strlen(m_text) > 4 && Animator.marquee(m_text))
+                    current_mode = ANIMATING;
+                else
+                {
+                    Animator.stop();
+                    Display.show_string(m_text);
+                    m_wait_time_ms = 2000;
+                    current_mode = DISPLAY_NOW;
+                }
+                break;
+
+            case ANIMATING:
+                if (seconds_until_flip() > 55)
+                {
+                    display_current_time(true);
+                    current_mode = WAITING_FOR_FLIP;
+                }
                 break;
             
             case DISPLAY_IP0:
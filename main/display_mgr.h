@@ -3,6 +3,7 @@
 //=========================================================================================================
 #pragma once
 #include "common.h"
+#include "animator.h"
 
 class CDisplayMgr
 {
@@ -17,6 +18,15 @@ public:
     // Call this to display the system IP address
     void    display_ip_address();
 
+    // Call this to display a string.  A string longer than 4 characters is scrolled across the display
+    void    display_text(const char* text);
+
+    // Call this to set the frame rate of subsequent animations.  Returns false if it couldn't be queued
+    bool    set_frame_rate(int fps);
+
+    // Called by the animator on each frame tick.  Returns false if the tick couldn't be queued
+    bool    animation_tick();
+
 public:      
 
     // When the thread spawns, this is the routine that starts 
@@ -32,6 +42,9 @@ protected:
 
     // How long we wait for an event to arrive in the queue
     uint32_t        m_wait_time_ms;
+
+    // The string that display_text() was asked to display.  Only our task touches this
+    char            m_text[ANIM_MAX_TEXT + 1];
 };
 
 
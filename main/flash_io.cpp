@@ -2,14 +2,18 @@
 // flash_io.cpp - Implements a task that manages reads/write to and from flash memory 
 //=========================================================================================================
 #include <nvs_flash.h>
+#include <esp_timer.h>
 #include "globals.h"
 
-#define FLASH_READ  0
-#define FLASH_WRITE 1
+// This is the maximum number of requests that can be waiting for the flash task
+const int REQUEST_QUEUE_DEPTH = 8;
 
 // This is the namespace that NVS stores our data structure under
 static const char* NAMESPACE = "storage";
 
+// This is how many times an operation is attempted (re-opening the NVS handle in between)
+const int MAX_ATTEMPTS = 3;
+
 //=========================================================================================================
 // launch_task() - Just calles the task() method of our FlashIO object
 //=========================================================================================================
@@ -18,89 +22,144 @@ static void launch_task(void *pvParameters) {FlashIO.task();}
 
 
 //=========================================================================================================
-// write_flash() - Writes a blob of data to a named region of flash memory
+// open_handle() - Opens the handle to our NVS namespace that the flash task keeps open
 //=========================================================================================================
-static void write_flash(const char* nvs_key, char* buffer, size_t length)
+esp_err_t CFlashIO::open_handle()
 {
-    nvs_handle  handle;
+    esp_err_t status = nvs_open(NAMESPACE, NVS_READWRITE, &m_handle);
+    m_is_open = (status == ESP_OK);
+    return status;
+}
+//=========================================================================================================
 
-    // Open a handle to non-volatile storage
-    nvs_open(NAMESPACE, NVS_READWRITE, &handle);
 
+//=========================================================================================================
+// write_flash() - Writes a blob of data to a named region of flash memory
+//=========================================================================================================
+esp_err_t CFlashIO::write_flash(const char* nvs_key, char* buffer, size_t length)
+{
     // Write this chunk of memory to flash
-    nvs_set_blob(handle, nvs_key, buffer, length);
+    esp_err_t status = nvs_set_blob(m_handle, nvs_key, buffer, length);
+    if (status != ESP_OK) return status;
 
     // Commit those flash changes (i.e., make them permanent)
-    nvs_commit(handle);
-
-    // We're done with NVS storage for the moment
-    nvs_close(handle);
+    return nvs_commit(m_handle);
 }
 //=========================================================================================================
 
 
 
-
 //=========================================================================================================
 // read_flash() - Reads a blob of data from named region of flash memory
+//
+// Passed: length = the size of the caller's buffer.  A blob that won't fit isn't read
+//
+// Returns: ESP_ERR_NVS_NOT_FOUND if the blob doesn't exist, ESP_ERR_NVS_INVALID_LENGTH if it won't fit
 //=========================================================================================================
-static void read_flash(const char* nvs_key, char* buffer)
+esp_err_t CFlashIO::read_flash(const char* nvs_key, char* buffer, size_t length)
 {
-    nvs_handle handle;
-    size_t     blob_size = 0;
-    esp_err_t  status;
-
-    // As a convenience to callers that are expecting ASCII data to be read, fill in the start 
-    // of their buffer with nul-bytes, just in case the requested nvs_key doesn't exist yet
-    *(U32*)buffer = 0;
+    // As a convenience to callers that are expecting ASCII data to be read, nul-terminate their 
+    // buffer, just in case the requested nvs_key doesn't exist yet
+    if (length) *buffer = 0;
 
     // Tell the engineer what we're up to
     printf("Reading flash memory key \"%s\"\n", nvs_key);
 
-    // Open a handle to non-volatile storage
-    status = nvs_open(NAMESPACE, NVS_READWRITE, &handle);
-    if (status != ESP_OK) printf("*** nvs_open() failed!! 0x%X)\n", status);
+    // The caller knows how big the blob can be, so we can read it in a single call
+    return nvs_get_blob(m_handle, nvs_key, buffer, &length);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// erase_flash() - Removes a named blob of data from flash memory
+//=========================================================================================================
+esp_err_t CFlashIO::erase_flash(const char* nvs_key)
+{
+    // Erase the key.  It's not an error if the key doesn't exist
+    esp_err_t status = nvs_erase_key(m_handle, nvs_key);
+    if (status == ESP_ERR_NVS_NOT_FOUND) return ESP_OK;
+    if (status != ESP_OK) return status;
+
+    // Commit those flash changes (i.e., make them permanent)
+    return nvs_commit(m_handle);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// execute() - Performs a single request.  If the NVS handle has gone bad, it is re-opened and the
+//             request is retried
+//
+// Returns: The result of the operation
+//=========================================================================================================
+esp_err_t CFlashIO::execute(flash_request_t* request)
+{
+    esp_err_t status = ESP_FAIL;
+
+    // A job doesn't need our NVS handle, and is run exactly once
+    if (request->op == FLASH_CALL) status = request->job(request->job_argument);
+
+    else for (int attempt = 0; attempt < MAX_ATTEMPTS; ++attempt)
+    {
+        // If we don't have an open handle to NVS, open one
+        if (!m_is_open)
+        {
+            status = open_handle();
+            if (status != ESP_OK) continue;
+        }
+
+        // Perform the requested operation
+        if (request->op == FLASH_WRITE) status = write_flash(request->nvs_key, request->buffer, request->length);
+        if (request->op == FLASH_READ ) status = read_flash(request->nvs_key, request->buffer, request->length);
+        if (request->op == FLASH_ERASE) status = erase_flash(request->nvs_key);
+
+        // If the handle has gone bad, close it so that the next attempt re-opens it
+        if (status == ESP_ERR_NVS_INVALID_HANDLE || status == ESP_ERR_NVS_INVALID_STATE)
+        {
+            nvs_close(m_handle);
+            m_is_open = false;
+            continue;
+        }
+
+        // Otherwise, retrying won't help
+        break;
+    }
 
-    // Call this the first time to find out how big this data structure in flash is
-    nvs_get_blob(handle, nvs_key, buffer, &blob_size);
-    
-    // If there is data in flash available to read, go read it
-    if (blob_size > 0)
+    // A blob that doesn't exist yet isn't an error worth complaining about
+    if (status != ESP_OK && status != ESP_ERR_NVS_NOT_FOUND)
     {
-        status = nvs_get_blob(handle, nvs_key, buffer, &blob_size);
-        if (status != ESP_OK) printf("*** nvs_get_blob() failed!! (0x%X)\n", status);
+        printf("*** Flash operation on \"%s\" failed!! (%s)\n", request->nvs_key, esp_err_to_name(status));
+        Metrics.flash_errors.inc();
     }
 
-    // We're done with NVS storage for the moment
-    nvs_close(handle);
+    return status;
 }
 //=========================================================================================================
 
 
 
 //=========================================================================================================
-// begin() - Creates the message queues and starts up the task thread
+// begin() - Creates the request queue and starts up the task thread
 //=========================================================================================================
 void CFlashIO::begin()
 {
-    // Other threads will write to this queue to start a read/write operation
-    m_start_qh = xQueueCreate(4, 1);
-
-    // Other threads will do a blocking read from this queue to know when that operation is done
-    m_done_qh = xQueueCreate(4, 1);
+    // The flash task opens its handle to NVS the first time it needs it
+    m_is_open = false;
 
-    // This mutex will ensure one-thread-at-a-time access to reading/writing flash memory
-    m_mutex = xSemaphoreCreateMutex();
+    // Other threads will write pointers to their requests into this queue
+    m_request_qh = xQueueCreate(REQUEST_QUEUE_DEPTH, sizeof(flash_request_t*));
 
-    // And finally, launch the task that will perform flash memory read/writes for us
-    xTaskCreatePinnedToCore(::launch_task, "flashio", 2048, nullptr, TASK_PRIO_FLASH, NULL, TASK_CPU);
+    // And finally, launch the task that will perform flash memory read/writes for us.  The stack has
+    // room for the OTA jobs: esp_ota_end() verifies the image's hash on this stack
+    xTaskCreatePinnedToCore(::launch_task, "flashio", 4096, nullptr, TASK_PRIO_FLASH, NULL, TASK_CPU);
 }
 //=========================================================================================================
 
 
 
 //=========================================================================================================
-// task() - Runs in an infinite loop waiting for flash read/write operations to be requested
+// task() - Runs in an infinite loop waiting for flash read/write requests to arrive
 //
 // This task runs at the highest task priority, ensuring that other tasks are completely suspended while
 // flash reads/writes happen.  This is to ensure that no thread tries to read from SPRAM while a flash
@@ -109,47 +168,96 @@ void CFlashIO::begin()
 //=========================================================================================================
 void CFlashIO::task()
 {
-    char    cmd;
+    flash_request_t* request;
 
-    // We're going to sit in a loop forever listening for commands
+    // We're going to sit in a loop forever listening for requests
     while (true)
     {
-        // Wait for a command to arrive
-        xQueueReceive(m_start_qh, &cmd, portMAX_DELAY);
+        // Wait for a request to arrive
+        xQueueReceive(m_request_qh, &request, portMAX_DELAY);
+
+        // Keep track of how long the request sat in the queue and how long the operation takes
+        S64 start_time = esp_timer_get_time();
+        Metrics.flash_queue_wait_us.observe((U32)(start_time - request->queued_at));
 
         // Perform the requested operation
-        if (cmd == FLASH_WRITE) write_flash(m_nvs_key, m_rw_buffer, m_rw_length);
-        if (cmd == FLASH_READ ) read_flash(m_nvs_key, m_rw_buffer);
+        request->status = execute(request);
+
+        // Record the operation in our metrics
+        if (request->op != FLASH_READ ) Metrics.flash_writes.inc();
+        if (request->op == FLASH_READ ) Metrics.flash_reads.inc();
+        Metrics.flash_op_us.observe((U32)(esp_timer_get_time() - start_time));
+
+        // Fetch the task to notify before marking the request complete.  Once it's complete, the
+        // requester is free to re-use or discard the request object
+        flash_callback_t callback    = request->callback;
+        TaskHandle_t     notify_task = request->notify_task;
 
-        // Tell the requesting task that the operation is complete
-        xQueueSend(m_done_qh, &cmd, portMAX_DELAY);
+        // If the requester wants a callback, call it
+        if (callback) callback(request);
+
+        // The request is complete
+        request->is_complete = true;
+
+        // If a task is waiting for this request to complete, wake it up
+        if (notify_task) xTaskNotifyGive(notify_task);
     }
 }
 //=========================================================================================================
 
 
 //=========================================================================================================
-// read() - Reads from flash memory with a very high priorty task that blocks other tasks
+// submit() - Queues a request for the flash task and returns immediately
 //=========================================================================================================
-void CFlashIO::read(const char* nvs_key, char* buffer)
+void CFlashIO::submit(flash_request_t* request)
 {
-    char cmd = FLASH_READ;
+    // The request isn't complete yet
+    request->is_complete = false;
 
-    // Only one thread a time is allowed to read/write flash memory
-    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    // Record when it was queued so that we can measure time-in-queue
+    request->queued_at = esp_timer_get_time();
 
-    // Fill in the paramaters required to read an object from flash
-    m_nvs_key   = nvs_key;
-    m_rw_buffer = buffer;
+    // And hand it to the flash task.  If the queue is full, this waits for room
+    xQueueSend(m_request_qh, &request, portMAX_DELAY);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// perform() - Queues a request and blocks until the flash task has completed it
+//=========================================================================================================
+void CFlashIO::perform(flash_request_t* request)
+{
+    // We want to be notified when the request is complete
+    request->callback    = nullptr;
+    request->context     = nullptr;
+    request->notify_task = xTaskGetCurrentTaskHandle();
+
+    // Hand the request to the flash task
+    submit(request);
+
+    // And wait for it to complete
+    while (!request->is_complete) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+//=========================================================================================================
 
-    // Tell the read/write task to commence the operation
-    xQueueSend(m_start_qh, &cmd, portMAX_DELAY);
 
-    // Wait for the operation to complete
-    xQueueReceive(m_done_qh, &cmd, portMAX_DELAY);
+//=========================================================================================================
+// read() - Reads from flash memory with a very high priorty task that blocks other tasks
+//=========================================================================================================
+esp_err_t CFlashIO::read(const char* nvs_key, char* buffer, size_t length)
+{
+    flash_request_t request;
 
-    // Allow other threads to read/write flash memory
-    xSemaphoreGive(m_mutex);
+    // Fill in the paramaters required to read an object from flash
+    request.op      = FLASH_READ;
+    request.nvs_key = nvs_key;
+    request.buffer  = buffer;
+    request.length  = length;
+
+    // Perform the read and wait for it to complete
+    perform(&request);
+    return request.status;
 }
 //=========================================================================================================
 
@@ -159,27 +267,72 @@ void CFlashIO::read(const char* nvs_key, char* buffer)
 //=========================================================================================================
 // write() - Writes to flash memory with a very high priorty task that blocks other tasks
 //=========================================================================================================
-void CFlashIO::write(const char* nvs_key, char* buffer, size_t length)
+esp_err_t CFlashIO::write(const char* nvs_key, char* buffer, size_t length)
 {
-    char cmd = FLASH_WRITE;
-
-    // Only one thread a time is allowed to read/write flash memory
-    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    flash_request_t request;
 
     // Fill in the paramaters required to write an object to flash
-    m_nvs_key   = nvs_key;
-    m_rw_buffer = buffer;
-    m_rw_length = length;
+    request.op      = FLASH_WRITE;
+    request.nvs_key = nvs_key;
+    request.buffer  = buffer;
+    request.length  = length;
+
+    // Perform the write and wait for it to complete
+    perform(&request);
+    return request.status;
+}
+//=========================================================================================================
 
-    // Tell the read/write task to commence the operation
-    xQueueSend(m_start_qh, &cmd, portMAX_DELAY);
 
-    // Wait for the operation to complete
-    xQueueReceive(m_done_qh, &cmd, portMAX_DELAY);
+//=========================================================================================================
+// erase() - Removes an object from flash memory
+//=========================================================================================================
+esp_err_t CFlashIO::erase(const char* nvs_key)
+{
+    flash_request_t request;
+
+    // Fill in the paramaters required to erase an object from flash
+    request.op      = FLASH_ERASE;
+    request.nvs_key = nvs_key;
+    request.buffer  = nullptr;
+    request.length  = 0;
 
-    // Allow other threads to read/write flash memory
-    xSemaphoreGive(m_mutex);
+    // Perform the erase and wait for it to complete
+    perform(&request);
+    return request.status;
 }
 //=========================================================================================================
 
 
+//=========================================================================================================
+// call() - Runs a job that writes or erases flash outside of NVS in the flash task, so that it gets the
+//          same protection as NVS writes.  The erase routines of the flash driver yield during long
+//          erases (CONFIG_SPI_FLASH_YIELD_DURING_ERASE), so lower priority tasks still get to run
+//=========================================================================================================
+esp_err_t CFlashIO::call(const char* name, flash_job_t job, void* argument)
+{
+    flash_request_t request;
+
+    // Fill in the paramaters required to run a job
+    request.op           = FLASH_CALL;
+    request.nvs_key      = name;
+    request.buffer       = nullptr;
+    request.length       = 0;
+    request.job          = job;
+    request.job_argument = argument;
+
+    // Run the job and wait for it to complete
+    perform(&request);
+    return request.status;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// queue_depth() - Returns the number of requests waiting for the flash task
+//=========================================================================================================
+int CFlashIO::queue_depth()
+{
+    return uxQueueMessagesWaiting(m_request_qh);
+}
+//=========================================================================================================
@@ -2,9 +2,62 @@
 // flash_io.h - Defines a task that manages reads/write to and from flash memory 
 //=========================================================================================================
 #pragma once
+#include <nvs.h>
 #include "common.h"
 
 
+// The operations the flash task can perform.  FLASH_CALL runs a caller-supplied job, for flash that
+// isn't in NVS (raw partitions, OTA slots)
+enum flash_op_t {FLASH_READ, FLASH_WRITE, FLASH_ERASE, FLASH_CALL};
+
+struct flash_request_t;
+
+// A FLASH_CALL job has this signature.  It runs in the context of the flash task
+typedef esp_err_t (*flash_job_t)(void* argument);
+
+// A completion callback has this signature.  It runs in the context of the flash task, so it must be brief
+typedef void (*flash_callback_t)(flash_request_t* request);
+
+//=========================================================================================================
+// flash_request_t - Describes a single read or write.  The caller owns this object, and it must remain
+//                   valid until "is_complete" becomes true (which happens after the callback returns)
+//=========================================================================================================
+struct flash_request_t
+{
+    // Read, write, erase, or call?
+    flash_op_t          op;
+
+    // The name of the blob (or for FLASH_CALL, a name for the job), the buffer to read/write, and the
+    // number of bytes to write (or for a read, the size of the buffer)
+    const char*         nvs_key;
+    char*               buffer;
+    size_t              length;
+
+    // For FLASH_CALL, the job to run and the argument to pass it
+    flash_job_t         job;
+    void*               job_argument;
+
+    // If not null, this is called when the request is complete
+    flash_callback_t    callback;
+
+    // For use by the callback
+    void*               context;
+
+    // If not null, this task is sent a task-notification when the request is complete
+    TaskHandle_t        notify_task;
+
+    // Becomes true when the request is complete
+    volatile bool       is_complete;
+
+    // The result of the operation.  Valid once the request is complete
+    esp_err_t           status;
+
+    // The time (in microseconds since boot) the request was queued.  Filled in by submit()
+    S64                 queued_at;
+};
+//=========================================================================================================
+
+
 class CFlashIO
 {
 public:
@@ -15,25 +68,47 @@ public:
     // This is the thread that waits for messages and performs IO
     void    task();
 
-    // Call this to read an object from flash memory
-    void    read(const char* nvs_key, char* buffer);
+    // Call this to queue a request for the flash task.  Returns immediately
+    void    submit(flash_request_t* request);
+
+    // Call this to read an object from flash memory.  Blocks until the read is complete.  Returns
+    // ESP_ERR_NVS_NOT_FOUND if the object doesn't exist
+    esp_err_t   read(const char* nvs_key, char* buffer, size_t length);
+
+    // Call this to write an object to flash memory.  Blocks until the write is complete
+    esp_err_t   write(const char* nvs_key, char* buffer, size_t length);
 
-    // Call this to write an object to flash memory
-    void    write(const char* nvs_key, char* buffer, size_t length);
+    // Call this to remove an object from flash memory.  Blocks until the erase is complete
+    esp_err_t   erase(const char* nvs_key);
+
+    // Call this to run a job that writes or erases flash outside of NVS (a partition or an OTA slot) in
+    // the flash task.  Blocks until the job is complete, and returns the job's result
+    esp_err_t   call(const char* name, flash_job_t job, void* argument);
+
+    // Returns the number of requests waiting for the flash task
+    int     queue_depth();
 
 protected:
 
-    // Other tasks write to this queue to signal the start of a flash read/write
-    QueueHandle_t   m_start_qh;
-    
-    // A blocking read on this queue will return when the requested flash read/write is complete
-    QueueHandle_t   m_done_qh;
+    // Queues a request and waits for it to complete
+    void    perform(flash_request_t* request);
+
+    // Performs a single request, re-opening the NVS handle and retrying if necessary
+    esp_err_t   execute(flash_request_t* request);
 
-    // This is the handle to the mutex that ensures thread-safe reads/writes to/from flash
-    SemaphoreHandle_t   m_mutex;
+    // These perform the individual operations using m_handle
+    esp_err_t   open_handle();
+    esp_err_t   read_flash(const char* nvs_key, char* buffer, size_t length);
+    esp_err_t   write_flash(const char* nvs_key, char* buffer, size_t length);
+    esp_err_t   erase_flash(const char* nvs_key);
 
-    // To perform a read/write we need a blob name, a buffer to read/write, and a buffer length
-    const char* m_nvs_key;
-    char*       m_rw_buffer;
-    int         m_rw_length;
+    // Other tasks write pointers to flash_request_t objects to this queue
+    QueueHandle_t   m_request_qh;
+
+    // The flash task keeps this handle to our NVS namespace open
+    nvs_handle      m_handle;
+
+    // True when m_handle is open
+    bool            m_is_open;
 };
+//=========================================================================================================
@@ -15,6 +15,13 @@
 #include "display_mgr.h"
 #include "sht31.h"
 #include "ht16k33.h"
+#include "metrics.h"
+#include "telemetry_log.h"
+#include "telemetry_store.h"
+#include "assets.h"
+#include "crc32.h"
+#include "sim_i2c.h"
+#include "animator.h"
 
 extern CSystem     System;
 extern CNVS        NVS;
@@ -29,6 +36,17 @@ extern CHTTPServer HTTPServer;
 extern CDisplayMgr DisplayMgr;
 extern CSHT31      SHT31;
 extern CHT16K33    Display;
+extern CMetrics    Metrics;
+extern CTelemetryLog TelemetryLog;
+extern CTelemetryStore TelemetryStore;
+extern CAssets     Assets;
+extern CAnimator   Animator;
+
+#if I2C_SIMULATED
+extern CSimI2CBus  SimI2C;
+extern CSimHT16K33 SimDisplay;
+extern CSimSHT31   SimSensor;
+#endif
 
 
 uint32_t crc32(void *buf, size_t len);
@@ -1,19 +1,12 @@
 //=========================================================================================================
 // ht16k33.cpp - Implements an interface to an HT16K33 LED matrix driver
 // 
-// 1st digit is at address 0
-// 2nd digit is at address 2
-// 3rd digit is at address 6
-// 4th digit is at address 8
-//
-// Address 4:
-//   Bit 1 = colon in the center
-//   Bit 2 = top leftmost dot
-//   Bit 3 = bottom leftmost dot
-//   Bit 4 = Upper rightmost dot
+// The font, and the display RAM address of each digit and of the colon/dots, are in segment_font.h
 //=========================================================================================================
+#include <stdio.h>
 #include "ht16k33.h"
-#include "globals.h"
+#include "i2c_bus.h"
+#include "metrics.h"
 
 
 
@@ -26,105 +19,15 @@
 #define BLINK_HALFHZ   6     
 
 
-static const unsigned char font[] =
-{
-    0b00000000, // (space)
-    0b10000110, // !
-    0b00100010, // "
-    0b01111110, // #
-    0b01101101, // $
-    0b11010010, // %
-    0b01000110, // &
-    0b00100000, // '
-    0b00101001, // (
-    0b00001011, // )
-    0b00100001, // *
-    0b01110000, // +
-    0b00010000, // ,
-    0b01000000, // -
-    0b10000000, // .
-    0b01010010, // /
-    0b00111111, // 0
-    0b00000110, // 1
-    0b01011011, // 2
-    0b01001111, // 3
-    0b01100110, // 4
-    0b01101101, // 5
-    0b01111101, // 6
-    0b00000111, // 7
-    0b01111111, // 8
-    0b01101111, // 9
-    0b00001001, // :
-    0b00001101, // ;
-    0b01100001, // <
-    0b01001000, // =
-    0b01000011, // >
-    0b11010011, // ?
-    0b01011111, // @
-    0b01110111, // A
-    0b01111100, // B
-    0b00111001, // C
-    0b01011110, // D
-    0b01111001, // E
-    0b01110001, // F
-    0b00111101, // G
-    0b01110110, // H
-    0b00110000, // I
-    0b00011110, // J
-    0b01110101, // K
-    0b00111000, // L
-    0b00010101, // M
-    0b00110111, // N
-    0b00111111, // O
-    0b01110011, // P
-    0b01101011, // Q
-    0b00110011, // R
-    0b01101101, // S
-    0b01111000, // T
-    0b00111110, // U
-    0b00111110, // V
-    0b00101010, // W
-    0b01110110, // X
-    0b01101110, // Y
-    0b01011011, // Z
-    0b00111001, // [
-    0b01100100, //
-    0b00001111, // ]
-    0b00100011, // ^
-    0b00001000, // _
-    0b00000010, // `
-    0b01011111, // a
-    0b01111100, // b
-    0b01011000, // c
-    0b01011110, // d
-    0b01111011, // e
-    0b01110001, // f
-    0b01101111, // g
-    0b01110100, // h
-    0b00010000, // i
-    0b00001100, // j
-    0b01110101, // k
-    0b00110000, // l
-    0b00010100, // m
-    0b01010100, // n
-    0b01011100, // o
-    0b01110011, // p
-    0b01100111, // q
-    0b01010000, // r
-    0b01101101, // s
-    0b01111000, // t
-    0b00011100, // u
-    0b00011100, // v
-    0b00010100, // w
-    0b01110110, // x
-    0b01101110, // y
-    0b01011011, // z
-    0b01000110, // {
-    0b00110000, // |
-    0b01110000, // }
-    0b00000001, // ~
-    0b00000000, // del
-};
+// The screens that never change are built by the compiler
+static constexpr seg_frame_t ap_mode_screen     = make_frame(" AP ");
+static constexpr seg_frame_t wait_router_screen = make_frame("    ", DOT_UPPER_LEFT);
+static constexpr seg_frame_t wait_ntp_screen    = make_frame("    ", COLON_CENTER);
+
+// Runs of changed bytes separated by no more than this many unchanged bytes are sent as one write.
+// Starting another transaction costs an address byte and a RAM-address byte, so a gap this small is
+// cheaper to re-send than to skip
+const int MERGE_GAP = 2;
 
 
 //=========================================================================================================
@@ -132,22 +35,174 @@ static const unsigned char font[] =
 //=========================================================================================================
 void CHT16K33::init(int i2c_address)
 {
+    U8 blank[FRAME_SIZE];
+
     // Save the I2C address for posterity
     m_i2c_address = i2c_address;
 
+    // This guards the shadow copy of the device's state
+    m_mutex = xSemaphoreCreateMutex();
+
+    // We don't know the state of the device yet
+    m_blink      = -1;
+    m_brightness = -1;
+
     // Turn on the oscillator
-    if (I2C.write(m_i2c_address, 0x21, 1))
+    if (send_command(0x21))
         printf(">>> HT16K33 IS ALIVE!!!! <<<\n");
     else
         printf(">>> HT16K33 NOT FOUND !!! <<<\n");
 
-    I2C.write(m_i2c_address, 0x21, 1);   // Oscillator on
-    I2C.write(m_i2c_address, 0xA0, 1);   // INT/ROW pin is a row driver
-    
-    for (int n=0; n<6; ++n) I2C.write(m_i2c_address, n*2, 1, 0x0000, 2);
+    send_command(0x21);   // Oscillator on
+    send_command(0xA0);   // INT/ROW pin is a row driver
+
+    // Clear all of display RAM in a single write, and remember that it's clear
+    memset(blank, 0, sizeof blank);
+    memset(m_frame, 0, sizeof m_frame);
+    send_ram(0, blank, sizeof blank);
+
+    set_blink(BLINK_OFF); // Display on, no blinking
+    set_brightness(15);   // Max brightness
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// send_command() - Sends a single command byte to the device
+//=========================================================================================================
+bool CHT16K33::send_command(int command)
+{
+    // The address byte and the command byte go out on the bus
+    Metrics.display_bus_bytes.inc(2);
+    return I2C.write(m_i2c_address, command, 1, 0, 0, I2C_PRIO_HIGH);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// send_ram() - Writes bytes into display RAM.  The device auto-increments the RAM address after each
+//              byte, so a run of bytes goes out in a single transaction
+//=========================================================================================================
+bool CHT16K33::send_ram(int address, const U8* data, int length)
+{
+    // The address byte, the RAM address, and the data go out on the bus
+    Metrics.display_bus_bytes.inc(2 + length);
+    return I2C.write_reg(m_i2c_address, address, 1, data, length, I2C_PRIO_HIGH);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// set_blink() - Sets the blink rate (and turns the display on), unless it's already set
+//=========================================================================================================
+void CHT16K33::set_blink(int blink)
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    if (blink != m_blink && send_command(CMD_CONFIG | blink)) m_blink = blink;
+    xSemaphoreGive(m_mutex);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// write_frame() - Displays a frame, sending only the bytes of display RAM that changed
+//
+// Our copy of display RAM is only updated for writes that succeed, so a failed write gets retried by
+// the next update
+//=========================================================================================================
+void CHT16K33::write_frame(const U8* frame)
+{
+    int first = 0;
+
+    // Keep track of how many updates we're asked to perform
+    Metrics.display_updates.inc();
+
+    // Nobody else may touch the device or our copy of display RAM until we're done
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+
+    while (true)
+    {
+        // Find the next byte that changed.  If there isn't one, we're done
+        while (first < FRAME_SIZE && frame[first] == m_frame[first]) ++first;
+        if (first == FRAME_SIZE) break;
+
+        // Find the last changed byte of this range, merging in runs that are separated by small gaps
+        int last = first;
+        for (int i = first + 1; i < FRAME_SIZE && i - last <= MERGE_GAP + 1; ++i)
+        {
+            if (frame[i] != m_frame[i]) last = i;
+        }
+
+        // Send the range, and if that worked, the device now holds those bytes
+        int length = last - first + 1;
+        if (send_ram(first, frame + first, length)) memcpy(m_frame + first, frame + first, length);
+
+        // Go look for the next range
+        first = last + 1;
+    }
+
+    // Let the other tasks have the display back
+    xSemaphoreGive(m_mutex);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// get_frame() - Copies what's currently in display RAM
+//=========================================================================================================
+void CHT16K33::get_frame(U8* frame)
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    memcpy(frame, m_frame, FRAME_SIZE);
+    xSemaphoreGive(m_mutex);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// build_time() - Builds the frame that displays the specified time
+//=========================================================================================================
+void CHT16K33::build_time(int hour, int minute, U8* frame)
+{
+    // The frame starts out cleared
+    memset(frame, 0, FRAME_SIZE);
+
+    // Place each digit into the frame.  A leading zero in the hour is left blank
+    frame[digit_address[0]] = (hour > 9) ? glyph('1') : 0;
+    frame[digit_address[1]] = glyph('0' + hour % 10);
+    frame[digit_address[2]] = glyph('0' + minute / 10);
+    frame[digit_address[3]] = glyph('0' + minute % 10);
+
+    // And turn on the colon
+    frame[COLON_ADDRESS] = COLON_CENTER;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// build_number() - Builds the frame that displays a 1 to 4 digit number
+//=========================================================================================================
+void CHT16K33::build_number(int n, U8* frame)
+{
+    char ascii[12];
     
-    I2C.write(m_i2c_address, 0x81, 1);   // Display on, no blinking
-    I2C.write(m_i2c_address, 0xEF, 1);   // Max brightness
+    // Fetch an ASCII representation of the number
+    sprintf(ascii, "%4i", n);
+
+    // And build the frame that displays it
+    build_string(ascii, frame);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// build_string() - Builds the frame that displays the first 4 characters of a string.  A string
+//                  shorter than that is padded with blanks
+//=========================================================================================================
+void CHT16K33::build_string(const char* ascii, U8* frame)
+{
+    seg_frame_t image = make_frame(ascii);
+    memcpy(frame, image.ram, FRAME_SIZE);
 }
 //=========================================================================================================
 
@@ -157,30 +212,14 @@ void CHT16K33::init(int i2c_address)
 //=========================================================================================================
 void CHT16K33::show_time(int hour, int minute)
 {
-    char buffer[17];
-    const int DIGIT_OFFSET = 16;
+    U8 frame[FRAME_SIZE];
 
     // Make sure blinking is turned off
-    I2C.write(m_i2c_address, CMD_CONFIG | BLINK_OFF, 1);
-
-    // The 16-byte buffer we send to address zero starts out cleared
-    memset(buffer, 0, sizeof buffer);
-
-    // Compute the offsets into the font table for each digit
-    int c1 = (hour > 9) ? DIGIT_OFFSET + 1 : 0;
-    int c2 = DIGIT_OFFSET + hour % 10;
-    int c3 = DIGIT_OFFSET + minute / 10;
-    int c4 = DIGIT_OFFSET + minute % 10;
-
-    // Place each digit into the data buffer
-    buffer[1] = font[c1];
-    buffer[3] = font[c2];
-    buffer[5] = 2;
-    buffer[7] = font[c3];
-    buffer[9] = font[c4];
-
-    // Write the 16 bytes of data to address 0 in the device
-    I2C.write(m_i2c_address, buffer, sizeof buffer);
+    set_blink(BLINK_OFF);
+
+    // Build the frame and send whatever changed to the device
+    build_time(hour, minute, frame);
+    write_frame(frame);
 }
 //=========================================================================================================
 
@@ -190,78 +229,52 @@ void CHT16K33::show_time(int hour, int minute)
 //=========================================================================================================
 void CHT16K33::show_number(int n)
 {
-    char buffer[17], ascii[10];
-    
-    // Fetch an ASCII representation of the number
-    sprintf(ascii, "%4i", n);
-    
-    // Clear the buffer we're going to send to the device
-    memset(buffer, 0, sizeof buffer);
-
-    // Compute the offsets into the font table for each digit
-    int c1 = ascii[0] - 32;
-    int c2 = ascii[1] - 32;
-    int c3 = ascii[2] - 32;
-    int c4 = ascii[3] - 32;
-
-    // Place each digit into the data buffer
-    buffer[1] = font[c1];
-    buffer[3] = font[c2];
-    buffer[7] = font[c3];
-    buffer[9] = font[c4];
-
-    // Write the 16 bytes of data to address 0 in the device
-    I2C.write(m_i2c_address, buffer, sizeof buffer);
+    U8 frame[FRAME_SIZE];
+
+    // Build the frame and send whatever changed to the device
+    build_number(n, frame);
+    write_frame(frame);
 }
 //=========================================================================================================
 
 
-
 //=========================================================================================================
 // show_string() - Displays a 4 character string on the display
 //=========================================================================================================
 void CHT16K33::show_string(const char* ascii)
 {
-    char buffer[17];
-   
-    // Clear the buffer we're going to send to the device
-    memset(buffer, 0, sizeof buffer);
-
-    // Compute the offsets into the font table for each digit
-    int c1 = ascii[0] - 32;
-    int c2 = ascii[1] - 32;
-    int c3 = ascii[2] - 32;
-    int c4 = ascii[3] - 32;
-
-    // Place each digit into the data buffer
-    buffer[1] = font[c1];
-    buffer[3] = font[c2];
-    buffer[7] = font[c3];
-    buffer[9] = font[c4];
-
-    // Write the 16 bytes of data to address 0 in the device
-    I2C.write(m_i2c_address, buffer, sizeof buffer);
+    U8 frame[FRAME_SIZE];
+
+    // Build the frame and send whatever changed to the device
+    build_string(ascii, frame);
+    write_frame(frame);
 }
 //=========================================================================================================
 
+//=========================================================================================================
+// show_ap_mode() - Display " AP " to show that we're in Wi-Fi access-point mode
+//=========================================================================================================
+void CHT16K33::show_ap_mode()
+{
+    // Make sure blinking is turned off
+    set_blink(BLINK_OFF);
+
+    // And display the screen
+    write_frame(ap_mode_screen.ram);
+}
+//=========================================================================================================
+
+
 //=========================================================================================================
 // show_wait_for_router() - Display a blinking dot
 //=========================================================================================================
 void CHT16K33::show_wait_for_router()
 {
-    char buffer[17];
-   
-    // Clear the buffer we're going to send to the device
-    memset(buffer, 0, sizeof buffer);
-
     // Turn on the upper-left dot
-    buffer[5] = 4;
-
-    // Write the 16 bytes of data to address 0 in the device
-    I2C.write(m_i2c_address, buffer, sizeof buffer);
+    write_frame(wait_router_screen.ram);
 
     // And set the display to blink every 1/2 second
-    I2C.write(m_i2c_address, CMD_CONFIG | BLINK_2HZ, 1);
+    set_blink(BLINK_2HZ);
 }
 //=========================================================================================================
 
@@ -273,19 +286,11 @@ void CHT16K33::show_wait_for_router()
 //=========================================================================================================
 void CHT16K33::show_wait_for_ntp()
 {
-    char buffer[17];
-   
-    // Clear the buffer we're going to send to the device
-    memset(buffer, 0, sizeof buffer);
-
-    // Turn on the upper-left dot
-    buffer[5] = 2;
-
-    // Write the 16 bytes of data to address 0 in the device
-    I2C.write(m_i2c_address, buffer, sizeof buffer);
+    // Turn on the colon
+    write_frame(wait_ntp_screen.ram);
 
     // And set the display to blink every 1/2 second
-    I2C.write(m_i2c_address, CMD_CONFIG | BLINK_2HZ, 1);
+    set_blink(BLINK_2HZ);
 }
 //=========================================================================================================
 
@@ -296,12 +301,14 @@ void CHT16K33::show_wait_for_ntp()
 
 
 //=========================================================================================================
-// set_brightness() - Sets the display brightness
+// set_brightness() - Sets the display brightness, unless it's already set
 //=========================================================================================================
 void CHT16K33::set_brightness(int level)
 {
     if (level < 0) level = 0;
     if (level > 15) level = 15;
-    I2C.write(m_i2c_address, CMD_BRIGHTNESS | level, 1);   
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    if (level != m_brightness && send_command(CMD_BRIGHTNESS | level)) m_brightness = level;
+    xSemaphoreGive(m_mutex);
 }
 //=========================================================================================================
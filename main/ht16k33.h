@@ -1,7 +1,13 @@
 //=========================================================================================================
 // ht16k33.h - Defines an interface to an HT16K33 LED matrix driver
+//
+// This keeps a shadow copy of the device's display RAM, blink rate, and brightness.  An update only
+// sends the bytes of display RAM that changed, and a command that wouldn't change anything isn't sent.
+// The display is updated from several tasks, so the shadow copy is guarded by a mutex
 //=========================================================================================================
 #pragma once
+#include "common.h"
+#include "segment_font.h"
 
 
 class CHT16K33
@@ -20,6 +26,9 @@ public:
     // Displays a 4 character string on the display
     void    show_string(const char* s);
 
+    // Display " AP " to show that we're in Wi-Fi access-point mode
+    void    show_ap_mode();
+
     // Display a blinking dot to show we're connecting to the router
     void    show_wait_for_router();
 
@@ -29,7 +38,44 @@ public:
     // Call this to change the display brightness.  "Level" should be 0 thru 15
     void    set_brightness(int level);
 
+    // The number of bytes of display RAM
+    enum {FRAME_SIZE = DISPLAY_RAM_SIZE};
+
+    // Call this to display a frame: an image of display RAM.  Only the bytes that changed are sent
+    void    write_frame(const U8* frame);
+
+    // These build the frame for a time, a number, or a string without displaying it
+    void    build_time(int hour, int minute, U8* frame);
+    void    build_number(int n, U8* frame);
+    void    build_string(const char* s, U8* frame);
+
+    // Copies what's currently in display RAM into "frame"
+    void    get_frame(U8* frame);
+
+    // Returns the current brightness level, or -1 if it's unknown
+    int     brightness() {return m_brightness;}
+
 protected:
+
+    // Sets the blink rate, unless it's already set
+    void    set_blink(int blink);
+
+    // Sends a single command byte to the device
+    bool    send_command(int command);
+
+    // Writes bytes into display RAM starting at the specified address
+    bool    send_ram(int address, const U8* data, int length);
+
     int     m_i2c_address;
 
-};
\ No newline at end of file
+    // What we know is in the device's display RAM
+    U8      m_frame[FRAME_SIZE];
+
+    // The blink rate and brightness the device is set to, or -1 if we don't know
+    int     m_blink;
+    int     m_brightness;
+
+    // Serializes access to the shadow copy and to the device
+    SemaphoreHandle_t m_mutex;
+
+};
@@ -1,12 +1,20 @@
 //=========================================================================================================
 // http_server.cpp - Implements our web server
 //=========================================================================================================
+#include <esp_timer.h>
 #include "webpage.h"
 #include "globals.h"
 #include "history.h"
+#include "ota.h"
 
 static CWebpage webpage;
 
+// Writes firmware images received via "HTTP POST /ota"
+static COTAUpdate ota;
+
+// This is the size of the chunks that a firmware image is received and written in
+const int OTA_CHUNK_SIZE = 1024;
+
 //=========================================================================================================
 // html_style[] - The heading of an HTML webpage, defining our style-sheet
 //=========================================================================================================
@@ -215,9 +223,9 @@ static const char script_on_config_save[] =
         "var result='';\n"
         "document.getElementById('save_button').disable=true;\n"
         "document.getElementById('exit_button').disable=true;\n"
-        "result+=';netssid='+document.getElementById('netssid').value;\n"
-        "result+=';netpw='+document.getElementById('netpw').value;\n"
-        "result+=';timezone='+document.getElementById('timezone').value;\n"
+        "result+='netssid='+encodeURIComponent(document.getElementById('netssid').value);\n"
+        "result+='&netpw='+encodeURIComponent(document.getElementById('netpw').value);\n"
+        "result+='&timezone='+encodeURIComponent(document.getElementById('timezone').value);\n"
 
         "var xhr=new XMLHttpRequest();\n"
         "xhr.onreadystatechange=function()\n"
@@ -229,7 +237,7 @@ static const char script_on_config_save[] =
             "}\n"
         "}\n"
         "xhr.open('POST','/updatecfg',true);\n"
-        "xhr.setRequestHeader('Content-Type','application/json');\n"
+        "xhr.setRequestHeader('Content-Type','application/x-www-form-urlencoded');\n"
         "xhr.send(result);\n"
     "}\n"
     "</script>\n";
@@ -267,18 +275,51 @@ static const char html_index_02[] =
 
 
 
+//---------------------------------------------------------------------------------------------------------
+// The rendered index page is cached and re-served until either the NVS generation changes (brightness
+// or configuration was saved) or the volatile fields on it (RSSI) are older than INDEX_REFRESH_US.
+// The firmware version can only change across a reboot, which always starts with an empty cache.
+//
+// The cache is the shared "webpage" buffer, so it's only valid until another page is rendered into it
+//---------------------------------------------------------------------------------------------------------
+const S64 INDEX_REFRESH_US = 10 * 1000000;
+
+static bool     index_is_valid = false;
+static U32      index_generation;
+static S64      index_rendered_at;
+
 void CHTTPServer::reply_to_index()
 {
-    webpage.start();
-    webpage += html_style;
-    webpage.addf(html_index_01, FW_VERSION, System.rssi());
-    webpage += html_index_02;
-    webpage += script_on_reboot;
-    webpage += script_on_main_screen_button;
-    webpage += script_on_brighter;
-    webpage += script_on_dimmer;
-    webpage += html_final;
-    reply(200, webpage.text());
+    S64 now = esp_timer_get_time();
+
+    // Find out whether the page we rendered last time is still good
+    bool is_stale = !index_is_valid
+                 || index_generation != NVS.generation()
+                 || now - index_rendered_at > INDEX_REFRESH_US;
+
+    // If it isn't, render it again
+    if (is_stale)
+    {
+        index_generation  = NVS.generation();
+        index_rendered_at = now;
+
+        webpage.start();
+        webpage += html_style;
+        webpage.addf(html_index_01, FW_VERSION, System.rssi());
+        webpage += html_index_02;
+        webpage += script_on_reboot;
+        webpage += script_on_main_screen_button;
+        webpage += script_on_brighter;
+        webpage += script_on_dimmer;
+        webpage += html_final;
+        index_is_valid = true;
+
+        Metrics.index_cache_misses.inc();
+        Metrics.index_render_us.set((S32)(esp_timer_get_time() - now));
+    }
+    else Metrics.index_cache_hits.inc();
+
+    reply(200, webpage.text(), webpage.length());
 }
 //=========================================================================================================
 
@@ -305,6 +346,9 @@ static const char html_config_03[] =
 
 void CHTTPServer::reply_to_config()
 {
+    // We're about to overwrite the cached index page
+    index_is_valid = false;
+
     webpage.start();
     webpage += html_style;
     webpage += html_config_01;
@@ -328,6 +372,149 @@ void CHTTPServer::reply_to_config()
 
 
 
+//=========================================================================================================
+// reply_to_metrics() - Replies to an "HTTP GET /metrics" in Prometheus text format
+//
+// The metrics are streamed to the socket one line at a time rather than being composed in a buffer
+//=========================================================================================================
+void CHTTPServer::emit_metrics(const char* text, void* context)
+{
+    ((CHTTPServer*)context)->reply_send(text);
+}
+
+void CHTTPServer::reply_to_metrics()
+{
+    reply_start(200, "text/plain; version=0.0.4");
+    Metrics.render(emit_metrics, this);
+    reply_finish();
+}
+//=========================================================================================================
+
+
+
+//=========================================================================================================
+// reply_to_history() - Replies to an "HTTP GET /history" with the entire telemetry log
+//
+// The log is sent in the compact format of series_codec.h, as a series of blocks that are each preceded
+// by a 2-byte length.  tools/history.py fetches and decodes it
+//=========================================================================================================
+void CHTTPServer::reply_to_history()
+{
+    U8  buffer[2 + TELEMETRY_EXPORT_BLOCK];
+    int index = 0, length;
+
+    // If there's no telemetry log, there's nothing to send
+    if (!TelemetryLog.is_ready())
+    {
+        Metrics.http_not_found.inc();
+        reply(404, "");
+        return;
+    }
+
+    // Send the log one block at a time
+    reply_start(200, "application/octet-stream");
+    while ((length = TelemetryLog.export_block(&index, buffer, sizeof buffer)) != 0)
+    {
+        reply_send(buffer, length);
+    }
+    reply_finish();
+}
+//=========================================================================================================
+
+
+
+//=========================================================================================================
+// reply_to_ota() - Replies to an "HTTP POST /ota"
+//
+// The content is a firmware image.   It is streamed into the inactive OTA partition in fixed size
+// chunks, and is never buffered in its entirety.  COTAUpdate performs each flash write in the flash
+// task, via CFlashIO.  If the image validates, the device reboots into it.
+//=========================================================================================================
+void CHTTPServer::reply_to_ota()
+{
+    static char chunk[OTA_CHUNK_SIZE];
+    char        response[100];
+
+    // The client must tell us how big the image is
+    if (m_request_content_length == 0)
+    {
+        reply(411, "Content-Length required");
+        return;
+    }
+
+    // The display manager runs at a lower priority than we do.  Drop our priority below its priority
+    // for the duration of the upload so that the display keeps updating on time
+    UBaseType_t old_priority = uxTaskPriorityGet(nullptr);
+    vTaskPrioritySet(nullptr, DEFAULT_TASK_PRI - 1);
+
+    // Prepare the inactive OTA partition to receive the image
+    bool ok = ota.begin(m_request_content_length);
+
+    // Copy the image from the socket to flash, one chunk at a time
+    int count = 0;
+    while (ok)
+    {
+        count = read_content(chunk, sizeof chunk);
+        if (count == 0) break;
+        ok = (count > 0) && ota.write(chunk, count);
+    }
+
+    // Validate the image and make it the boot partition
+    if (ok)
+        ok = ota.finish();
+    else
+        ota.abort();
+
+    // We're done with the heavy lifting
+    vTaskPrioritySet(nullptr, old_priority);
+
+    // If the client was too slow sending the image, tell it so
+    if (count == RX_TIMEOUT)
+    {
+        reject(408);
+        return;
+    }
+
+    // If the connection closed before the whole image arrived, say how much of it we got
+    if (count == RX_CLOSED)
+    {
+        snprintf(response, sizeof response, "Upload truncated: received %u of %u bytes",
+                 (unsigned)ota.bytes_written(), (unsigned)m_request_content_length);
+        reply(400, response);
+        return;
+    }
+
+    // If something else went wrong, tell the client what
+    if (!ok)
+    {
+        reply(500, ota.error());
+        return;
+    }
+
+    // Tell the client how the update went
+    snprintf(response, sizeof response, "%u bytes in %u ms (%u KB/s)",
+             (unsigned)ota.bytes_written(), (unsigned)ota.elapsed_ms(), (unsigned)ota.kb_per_sec());
+    reply(200, response);
+
+    // And reboot into the new firmware
+    msdelay(2000);
+    System.reboot();
+}
+//=========================================================================================================
+
+
+
+//=========================================================================================================
+// is_streamed_post() - Returns 'true' for the POSTs whose content we fetch ourselves
+//=========================================================================================================
+bool CHTTPServer::is_streamed_post(const char* resource)
+{
+    return strcmp(resource, "/ota") == 0;
+}
+//=========================================================================================================
+
+
+
 //=========================================================================================================
 // on_http_get() - Responds to an HTTP GET request
 //=========================================================================================================
@@ -340,7 +527,31 @@ void CHTTPServer::on_http_get(const char* resource)
         return;
     }
 
+    // Is this an HTTP get for "/metrics"?
+    if (strcmp(resource, "/metrics") == 0)
+    {
+        reply_to_metrics();
+        return;
+    }
+
+    // Is this an HTTP get for "/history"?
+    if (strcmp(resource, "/history") == 0)
+    {
+        reply_to_history();
+        return;
+    }
+
+    // Is this an HTTP get for a static asset?  Assets are sent straight from mapped flash
+    asset_t asset;
+    if (Assets.find(resource, &asset))
+    {
+        Metrics.asset_bytes.inc(asset.length);
+        reply(200, asset.data, asset.length, asset.content_type);
+        return;
+    }
+
     // If we get here, the client was looking for an unknown webpage
+    Metrics.http_not_found.inc();
     reply(404, "");
 }
 //=========================================================================================================
@@ -379,7 +590,7 @@ void CHTTPServer::on_http_post(const char* resource)
             NVS.data.brightness++;
             printf("New brightness = %i\n", NVS.data.brightness);
             Display.set_brightness(NVS.data.brightness);
-            NVS.write_to_flash();
+            NVS.write_behind();
         }
         return;
     }
@@ -396,7 +607,7 @@ void CHTTPServer::on_http_post(const char* resource)
             NVS.data.brightness--;
             printf("New brightness = %i\n", NVS.data.brightness);
             Display.set_brightness(NVS.data.brightness);
-            NVS.write_to_flash();
+            NVS.write_behind();
         }
         return;
     }
@@ -408,52 +619,135 @@ void CHTTPServer::on_http_post(const char* resource)
         return;
     }
 
+    // Is this "HTTP POST /ota" ?
+    if (strcmp(resource, "/ota") == 0)
+    {
+        reply_to_ota();
+        return;
+    }
+
     // Is this "HTTP POST /updatecfg" ?
     if (strcmp(resource, "/updatecfg") == 0)
     {
         save_updated_config();
-        reply(200, "");
         return;
     }
 
     // If we get here, the client was looking for an unknown webpage
+    Metrics.http_not_found.inc();
     reply(404, "");
 }
 //=========================================================================================================
 
 
 //=========================================================================================================
-// fetch_post_value() - Fetches the value portion of a "key=value" pair from the POST data
+// form_field_t - Describes one field that parse_form() looks for in "key=value" form data
+//=========================================================================================================
+struct form_field_t
+{
+    // The name of the field in the form data
+    const char* key;
+
+    // The maximum length of the decoded value
+    int         max;
+
+    // On exit from parse_form(), this points to the decoded value, or is nullptr if the field was absent
+    const char* value;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// hex_value() - Returns the value of a hexadecimal digit, or -1 if it isn't one
+//=========================================================================================================
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// parse_form() - Parses "application/x-www-form-urlencoded" data in a single pass
+//
+// Passed:  input = The form data.  Pairs are separated by '&' (or ';'), and values are percent-encoded
+//          table = The fields we're looking for
+//          count = The number of entries in the table
+//
+// Returns: 'true' if the form data is well formed and every field that is present is valid
+//
+// On Exit: The input buffer has been decoded in place.  table[n].value points into the input buffer.
+//          Keys that aren't in the table are ignored.
 //=========================================================================================================
-static bool fetch_post_value(const char* input, const char* key, char* output)
+static bool parse_form(char* input, form_field_t* table, int count)
 {
-    // This is the token we're going to look for
-    char token[30];
+    // None of the fields have been found yet
+    for (int i=0; i<count; ++i) table[i].value = nullptr;
+
+    // "in" is where we're reading from, "out" is where decoded bytes are written
+    char* in = input;
+
+    while (*in)
+    {
+        // This is where the key starts
+        const char* key = in;
 
-    // Ensure that the caller's output field starts out empty
-    *output = 0;
+        // Find the end of the key
+        while (*in && *in != '=' && *in != '&' && *in != ';') ++in;
 
-    // Build the token ";key="
-    token[0] = ';';
-    strcpy(token+1, key);
-    strcat(token, "=");
+        // A pair without an equals-sign has no value.  Skip it
+        if (*in != '=')
+        {
+            if (*in) ++in;
+            continue;
+        }
 
-    // Does our token exist in the input string?
-    const char* in = strstr(input, token);
+        // Nul-terminate the key and point to the start of the value
+        *in++ = 0;
+
+        // Decode the value in place.  Decoding never makes the value longer
+        char* value = in;
+        char* out = in;
+        while (*in && *in != '&' && *in != ';')
+        {
+            char c = *in++;
+
+            if (c == '+')
+                c = ' ';
+            else if (c == '%')
+            {
+                int hi = hex_value(in[0]);
+                int lo = (hi < 0) ? -1 : hex_value(in[1]);
+                if (lo < 0) return false;
+                c = (char)(hi << 4 | lo);
+                in += 2;
+            }
+
+            *out++ = c;
+        }
 
-    // If it doesn't, we're done here
-    if (in == nullptr) return false;
+        // Remember whether there are more pairs after this one, then nul-terminate the value
+        bool more = (*in != 0);
+        *out = 0;
+        if (more) ++in;
 
-    // Position ourselves immediately after the equals-sign
-    in = strchr(in, '=') + 1;
+        // If this is a field we're looking for, validate it and record where its value is
+        for (int i=0; i<count; ++i)
+        {
+            form_field_t& field = table[i];
+            if (strcmp(key, field.key) != 0) continue;
 
-    // Copy the requested value into the caller's buffer
-    while (*in && *in!=';') *output++ = *in++;
+            if (out - value > field.max) return false;
 
-    // Make sure the caller's buffer is nul-terminated
-    *output = 0;
+            field.value = value;
+            break;
+        }
+    }
 
-    // Tell the caller that we found their key and handed them the value they were looking for
+    // If we get here, the form data was well formed
     return true;
 }
 //=========================================================================================================
@@ -462,29 +756,32 @@ static bool fetch_post_value(const char* input, const char* key, char* output)
 
 
 //=========================================================================================================
-// save_updated_config() - Saves the updated configuration data
+// save_updated_config() - Saves the updated configuration data and replies to the client
+//
+// If any field is invalid, none of the configuration is changed and the client gets a 400
 //=========================================================================================================
 void CHTTPServer::save_updated_config()
 {
-    char buffer[128];
+    enum {NETSSID, NETPW, TIMEZONE};
 
-    // Fetch the network SSID
-    if (fetch_post_value(m_request_content, "netssid", buffer))
+    form_field_t field[] =
     {
-        safe_copy(NVS.data.network_ssid, buffer);
-    }
+        {"netssid",  sizeof(NVS.data.network_ssid) - 1, nullptr},
+        {"netpw",    NET_PW_RAW_LEN - 1,                 nullptr},
+        {"timezone", sizeof(NVS.data.timezone) - 1,     nullptr},
+    };
 
-    // Fetch the network password
-    if (fetch_post_value(m_request_content, "netpw", buffer))
+    // Parse and validate the form data in a single pass
+    if (!parse_form(m_request_content, field, array_count(field)))
     {
-        safe_copy(NVS.data.network_pw, buffer);
+        reply(400, "Invalid configuration");
+        return;
     }
 
-    // Fetch the local offset (in hours) from UTC
-    if (fetch_post_value(m_request_content, "timezone", buffer))
-    {
-        safe_copy(NVS.data.timezone, buffer);
-    }
+    // Store each field that was present
+    if (field[NETSSID ].value) safe_copy(NVS.data.network_ssid, field[NETSSID ].value);
+    if (field[NETPW   ].value) safe_copy(NVS.data.network_pw,   field[NETPW   ].value);
+    if (field[TIMEZONE].value) safe_copy(NVS.data.timezone,     field[TIMEZONE].value);
 
     // Commit these values to non-volatile storage
     NVS.write_to_flash();
@@ -496,5 +793,7 @@ void CHTTPServer::save_updated_config()
         tzset();
     }
 
+    // Tell the client that all is well
+    reply(200, "");
 }
 //=========================================================================================================
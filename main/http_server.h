@@ -21,6 +21,9 @@ protected:
     // Called when an HTTP POST is received
     void    on_http_post(const char* resource);
 
+    // Tells the base class which POSTs we fetch the content of ourselves
+    bool    is_streamed_post(const char* resource);
+
     // Reply to an HTTP GET /
     void    reply_to_index();
 
@@ -29,6 +32,16 @@ protected:
 
     // Save the updated configuration
     void    save_updated_config();
+
+    // Reply to an HTTP POST /ota by writing the content to the inactive firmware partition
+    void    reply_to_ota();
+
+    // Reply to an HTTP GET /metrics
+    void    reply_to_metrics();
+    void    reply_to_history();
+
+    // Hands a piece of rendered metrics text to reply_send()
+    static void emit_metrics(const char* text, void* context);
 };
 //=========================================================================================================
 
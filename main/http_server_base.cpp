@@ -8,6 +8,7 @@
 #include <lwip/netdb.h>
 #include <stdint.h>
 #include <stdarg.h>
+#include <esp_timer.h>
 #include "globals.h"
 
 static const char* TAG = "http_server";
@@ -80,16 +81,193 @@ void CHTTPServerBase::stop()
 
 
 //=========================================================================================================
-// execute() - State machine: Call this often, or with blocking set to true
-// 
-// If blocking is true:
-//     Virtual function read() should block until it has data to return
-//     If the input stream closes, read() should return -1
-//     If read() returns -1, this routine will return
+// Limits that keep a slow or malicious client from monopolizing the server
+//=========================================================================================================
+
+// How long we'll wait for the first byte of a request after a client connects
+const int IDLE_TIMEOUT_MS   = 5000;
+
+// How long the client has to send the request-line and all of the headers
+const int HEADER_TIMEOUT_MS = 5000;
+
+// How long the client has to send the content.  For a streamed POST, this is the longest we'll wait
+// for the next piece of content to arrive
+const int BODY_TIMEOUT_MS   = 10000;
+
+// The maximum number of bytes allowed in the request-line and headers combined
+const int MAX_HEADER_BYTES  = 2048;
+//=========================================================================================================
+
+
+//=========================================================================================================
+// start_phase() - Enters a new phase of receiving a request and starts the clock on its deadline
+//=========================================================================================================
+void CHTTPServerBase::start_phase(phase_t phase)
+{
+    int timeout_ms = IDLE_TIMEOUT_MS;
+    if (phase == PHASE_HEADER) timeout_ms = HEADER_TIMEOUT_MS;
+    if (phase == PHASE_BODY  ) timeout_ms = BODY_TIMEOUT_MS;
+
+    m_phase    = phase;
+    m_deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// receive() - Receives whatever data is available from the socket, but won't wait past m_deadline
+//
+// Returns: The number of bytes received, RX_TIMEOUT if the deadline passed, or RX_CLOSED if the
+//          client closed the connection
+//=========================================================================================================
+int CHTTPServerBase::receive(void* buffer, int length)
+{
+    struct timeval tv;
+
+    // If the socket has already been closed (by a reply), there's nothing to receive
+    if (m_sock == CLOSED) return RX_CLOSED;
+
+    // How much time is left before the deadline?
+    S64 remaining_us = m_deadline - esp_timer_get_time();
+    if (remaining_us <= 0) return RX_TIMEOUT;
+
+    // Don't let recv() block for longer than that
+    tv.tv_sec  = remaining_us / 1000000;
+    tv.tv_usec = remaining_us % 1000000;
+    setsockopt(m_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+    // Fetch whatever is available
+    int count = ::recv(m_sock, buffer, length, 0);
+
+    // If we received data, tell the caller how much
+    if (count > 0) return count;
+
+    // Otherwise, find out why we didn't
+    if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return RX_TIMEOUT;
+    return RX_CLOSED;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// next_char() - Fetches the next character from the receive buffer, refilling it when it's empty
+//
+// Returns: The character, RX_TIMEOUT, or RX_CLOSED
+//=========================================================================================================
+int CHTTPServerBase::next_char()
+{
+    // If the receive buffer is empty, refill it
+    if (m_rx_index == m_rx_count)
+    {
+        int count = receive(m_rx_buffer, sizeof m_rx_buffer);
+        if (count < 0) return count;
+        m_rx_index = 0;
+        m_rx_count = count;
+    }
+
+    // Hand the caller the next character
+    return (U8)m_rx_buffer[m_rx_index++];
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// read_rx_buffer() - Moves as many bytes as possible (up to "length") out of the receive buffer
+//
+// Returns: The number of bytes moved
+//=========================================================================================================
+int CHTTPServerBase::read_rx_buffer(void* buffer, int length)
+{
+    int available = m_rx_count - m_rx_index;
+    if (length > available) length = available;
+    memcpy(buffer, m_rx_buffer + m_rx_index, length);
+    m_rx_index += length;
+    return length;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// receive_content() - Receives the entire content of a request into m_request_content
+//
+// Returns: 0 on success, RX_TIMEOUT, or RX_CLOSED
+//=========================================================================================================
+int CHTTPServerBase::receive_content()
+{
+    // Some of the content may have arrived along with the headers
+    int received = read_rx_buffer(m_request_content, m_request_content_length);
+
+    // Fetch the rest of it from the socket
+    while (received < m_request_content_length)
+    {
+        int count = receive(m_request_content + received, m_request_content_length - received);
+        if (count < 0) return count;
+        received += count;
+    }
+
+    // Nul-terminate the content
+    m_request_content[m_request_content_length] = 0;
+    return 0;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// reason_phrase() - Returns the reason phrase that goes with an HTTP status code
+//=========================================================================================================
+static const char* reason_phrase(int code)
+{
+    switch (code)
+    {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 408: return "Request Timeout";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+    }
+
+    // A client must accept any reason phrase, so for a code we don't know, this will do
+    return (code < 400) ? "OK" : "Error";
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// reject() - Sends an error reply, counts the rejection, and closes the socket
+//=========================================================================================================
+void CHTTPServerBase::reject(int code)
+{
+    switch (code)
+    {
+        case 400: Metrics.http_rejected_400.inc(); break;
+        case 408: Metrics.http_rejected_408.inc(); break;
+        case 413: Metrics.http_rejected_413.inc(); break;
+        case 431: Metrics.http_rejected_431.inc(); break;
+    }
+
+    // The reason phrase doubles as the content of the reply
+    reply(code, reason_phrase(code));
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// execute() - Receives and handles HTTP requests until the client goes away
+//
+// Each phase of receiving a request (waiting for it to start, receiving the headers, receiving the
+// content) has a deadline.  A client that misses a deadline or sends too much gets an error reply
+// and is disconnected, so that it can't lock other clients out of the server.
 //=========================================================================================================
 void CHTTPServerBase::execute()
 {
-    char c;
+    int c;
+
+    // We're waiting for the first byte of a request
+    start_phase(PHASE_IDLE);
 
 again:
 
@@ -105,8 +283,36 @@ again:
      // For each character available
     while (true)
     {
-        // Fetch a single character from the socket;
-        if (recv(m_sock, &c, 1, 0) < 1) break;
+        // Fetch a single character from the socket
+        c = next_char();
+
+        // If the client closed the connection, we're done
+        if (c == RX_CLOSED) break;
+
+        // If the client missed a deadline, disconnect it.  A client that never started a 
+        // request doesn't get a reply
+        if (c == RX_TIMEOUT)
+        {
+            if (m_phase == PHASE_IDLE)
+                Metrics.http_idle_timeouts.inc();
+            else
+                reject(408);
+            return;
+        }
+
+        // The first byte of a request starts the clock on receiving the headers
+        if (m_phase == PHASE_IDLE)
+        {
+            start_phase(PHASE_HEADER);
+            m_header_bytes = 0;
+        }
+
+        // Don't allow the client to send an unreasonable amount of header data
+        if (++m_header_bytes > MAX_HEADER_BYTES)
+        {
+            reject(431);
+            return;
+        }
 
         // Throw away carriage returns
         if (c == 13) continue;
@@ -120,17 +326,45 @@ again:
             // If this was a blank line, go handle the request
             if (p_input == m_message)
             {
-                // If there is content to still be received, fetch it
-                if (m_request_content_length)
+                // We're now receiving the content
+                start_phase(PHASE_BODY);
+
+                // If the handler of this POST is going to fetch the content itself, let it
+                if (m_request_type == POST && is_streamed_post(m_request_resource))
+                {
+                    m_content_remaining = m_request_content_length;
+                }
+
+                // Otherwise, if there is content to still be received, fetch it
+                else if (m_request_content_length)
                 {
-                    ::recv(m_sock, m_request_content, m_request_content_length, 0);
-                    m_request_content[m_request_content_length] = 0;                  
+                    // If the content won't fit in our buffer, refuse it
+                    if (m_request_content_length >= (int)sizeof(m_request_content))
+                    {
+                        reject(413);
+                        return;
+                    }
+
+                    // Fetch the content
+                    int status = receive_content();
+                    if (status == RX_TIMEOUT) reject(408);
+                    if (status < 0) return;
                 }
 
+                // Keep track of how long it takes to handle this request
+                S64 start_time = esp_timer_get_time();
+
                 if (m_request_type == GET)
                     on_http_get(m_request_resource);
                 else if (m_request_type == POST)
                     on_http_post(m_request_resource);
+
+                Metrics.http_requests.inc();
+                Metrics.http_request_us.observe((U32)(esp_timer_get_time() - start_time));
+
+                // Get ready for the next request
+                reset_request();
+                start_phase(PHASE_IDLE);
                 goto again;
             }
 
@@ -145,9 +379,14 @@ again:
             }
 
             // If this line is the content length, record it
-            if (strncmp(m_message, "Content-Length:", 15) == 0)
+            if (strncasecmp(m_message, "Content-Length:", 15) == 0)
             {
                 m_request_content_length = atoi(m_message + 15);
+                if (m_request_content_length < 0)
+                {
+                    reject(400);
+                    return;
+                }
                 goto again;
             }
 
@@ -244,15 +483,29 @@ bool CHTTPServerBase::wait_for_connection()
     // We now have a client connected
     m_has_client = true;
 
+    // The receive buffer starts out empty
+    m_rx_index = m_rx_count = 0;
+
     // Initialize information about the HTTP request we're about to receive
+    reset_request();
+
+    // Tell the caller that all is well
+    return true;
+}
+//========================================================================================================= 
+
+
+//========================================================================================================= 
+// reset_request() - Initializes information about the HTTP request we're about to receive
+//========================================================================================================= 
+void CHTTPServerBase::reset_request()
+{
     m_line_number = 0;
     m_request_type = UNKNOWN;
     m_request_resource[0] = 0;
     m_request_content[0] = 0;
     m_request_content_length = 0;
-
-    // Tell the caller that all is well
-    return true;
+    m_content_remaining = 0;
 }
 //========================================================================================================= 
 
@@ -361,15 +614,22 @@ void CHTTPServerBase::parse_first_line()
 //========================================================================================================= 
 void CHTTPServerBase::reply(int code, const char* content)
 {
-    char buffer[100];
-    
-    const char response[] = "HTTP/1.1 %i OK\r\nContent-Type: text/html\r\nContent-Length: %i\r\n\r\n";
+    reply(code, content, strlen(content));
+}
 
-    // This is how long the content is
-    int content_length = strlen(content);
+void CHTTPServerBase::reply(int code, const char* content, int content_length)
+{
+    reply(code, content, content_length, "text/html");
+}
+
+void CHTTPServerBase::reply(int code, const char* content, int content_length, const char* content_type)
+{
+    char buffer[160];
+    
+    const char response[] = "HTTP/1.1 %i %s\r\nContent-Type: %s\r\nContent-Length: %i\r\n\r\n";
 
     // Format the response header
-    sprintf(buffer, response, code, content_length);
+    snprintf(buffer, sizeof buffer, response, code, reason_phrase(code), content_type, content_length);
 
     // Send the response header
     ::send(m_sock, buffer, strlen(buffer), 0);
@@ -381,4 +641,86 @@ void CHTTPServerBase::reply(int code, const char* content)
     close(m_sock);
     m_sock = -1;
 }
+//=========================================================================================================
+
+
+//=========================================================================================================
+// read_content() - Fetches the next piece of the content of a streamed POST
+//
+// Returns: The number of bytes stored in the buffer, 0 if there's no content left, RX_TIMEOUT if the
+//          client was too slow to send it, or RX_CLOSED if the client went away
+//=========================================================================================================
+int CHTTPServerBase::read_content(void* buffer, int max_length)
+{
+    // If we've already fetched all of the content, tell the caller
+    if (m_content_remaining == 0) return 0;
+
+    // Don't read past the end of the content
+    if (max_length > m_content_remaining) max_length = m_content_remaining;
+
+    // If some of the content arrived along with the headers, hand that to the caller first
+    int count = read_rx_buffer(buffer, max_length);
+
+    // Otherwise, fetch whatever is available from the socket.  The client has BODY_TIMEOUT_MS 
+    // to send each piece of the content
+    if (count == 0)
+    {
+        start_phase(PHASE_BODY);
+        count = receive(buffer, max_length);
+    }
+
+    // If the socket closed or the client was too slow, tell the caller
+    if (count < 0) return count;
+
+    // Keep track of how much content is left
+    m_content_remaining -= count;
+
+    // And tell the caller how many bytes we fetched
+    return count;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// reply_start() - Sends the header of a reply that has no Content-Length.  The client knows the content
+//                 is complete when reply_finish() closes the socket
+//=========================================================================================================
+void CHTTPServerBase::reply_start(int code, const char* content_type)
+{
+    char buffer[160];
+
+    const char response[] = "HTTP/1.1 %i %s\r\nContent-Type: %s\r\nConnection: close\r\n\r\n";
+
+    // Format the response header
+    snprintf(buffer, sizeof buffer, response, code, reason_phrase(code), content_type);
+
+    // Send the response header
+    ::send(m_sock, buffer, strlen(buffer), 0);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// reply_send() - Sends a piece of the content of a reply that was started with reply_start()
+//=========================================================================================================
+void CHTTPServerBase::reply_send(const char* content)
+{
+    reply_send(content, strlen(content));
+}
+
+void CHTTPServerBase::reply_send(const void* content, int length)
+{
+    if (length) ::send(m_sock, content, length, 0);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// reply_finish() - Finishes a reply that was started with reply_start()
+//=========================================================================================================
+void CHTTPServerBase::reply_finish()
+{
+    close(m_sock);
+    m_sock = -1;
+}
 //========================================================================================================= 
@@ -42,6 +42,10 @@ public:
     virtual void  on_http_get (const char* resource) = 0;
     virtual void  on_http_post(const char* resource) = 0;
 
+    // Over-ride this to return 'true' for any POST whose handler will fetch the content itself
+    // by calling read_content(), rather than having it stored in m_request_content
+    virtual bool  is_streamed_post(const char* resource) {return false;}
+
     //--------------------------------------------------------------------------------
     // Tools for request handlers to use
     //--------------------------------------------------------------------------------
@@ -59,8 +63,30 @@ protected:
     // The length of m_request_content
     int     m_request_content_length;
 
+    // The number of bytes of a streamed POST's content that haven't been fetched by read_content()
+    int     m_content_remaining;
+
+    // These are returned by read_content() (and the routines that receive from the socket)
+    enum {RX_CLOSED = -1, RX_TIMEOUT = -2};
+
+    // A streamed POST handler calls this to fetch the next piece of the content.  Returns the number
+    // of bytes fetched, 0 when there is no more content, or RX_CLOSED/RX_TIMEOUT on error
+    int     read_content(void* buffer, int max_length);
+
+    // Call this to send an error reply (400, 408, 413, or 431) and count the rejection
+    void    reject(int code);
+
     // Call this to send a reply to an HTTP POST or HTTP GET
     void    reply(int code, const char* content = "");
+    void    reply(int code, const char* content, int content_length);
+    void    reply(int code, const char* content, int content_length, const char* content_type);
+
+    // Call these to stream a reply whose length isn't known in advance: start the reply, send
+    // any number of pieces of content, then finish the reply (which closes the socket)
+    void    reply_start(int code, const char* content_type);
+    void    reply_send(const char* content);
+    void    reply_send(const void* content, int length);
+    void    reply_finish();
 
     //--------------------------------------------------------------------------------
     // Functions and data that are private to the base class
@@ -76,6 +102,42 @@ private:
     // Parses the first line of an HTTP request
     void    parse_first_line();
 
+    // Initializes information about the HTTP request we're about to receive
+    void    reset_request();
+
+    // The phases of receiving a request.  Each one has its own deadline
+    enum phase_t {PHASE_IDLE, PHASE_HEADER, PHASE_BODY};
+
+    // Enters a new phase and starts the clock on its deadline
+    void    start_phase(phase_t phase);
+
+    // Receives data from the socket, but won't wait past the deadline
+    int     receive(void* buffer, int length);
+
+    // Fetches the next character that arrived from the socket
+    int     next_char();
+
+    // Moves bytes that have already arrived out of the receive buffer
+    int     read_rx_buffer(void* buffer, int length);
+
+    // Receives the content of a request into m_request_content
+    int     receive_content();
+
+    // The phase of receiving a request that we're in
+    phase_t m_phase;
+
+    // The time (in microseconds since boot) by which the current phase must be complete
+    S64     m_deadline;
+
+    // The number of bytes of request-line and headers that we've received for this request
+    int     m_header_bytes;
+
+    // Data arrives from the socket into this buffer
+    char    m_rx_buffer[64];
+
+    // The index of the next unused byte in m_rx_buffer, and the number of bytes in it
+    int     m_rx_index, m_rx_count;
+
     // This is our incoming message
     char    m_message[128];
     
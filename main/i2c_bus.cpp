@@ -1,7 +1,52 @@
 //=========================================================================================================
 // i2c_bus.cpp - Implements the interfaces to an I2C multi-drop serial bus
 //=========================================================================================================
-#include "globals.h"
+#include <stdio.h>
+#include <esp_timer.h>
+#include <esp_rom_sys.h>
+#include "i2c_bus.h"
+#include "metrics.h"
+
+// This is the maximum number of requests that can be waiting at each priority
+const int REQUEST_QUEUE_DEPTH = 8;
+
+// The bounds (in microseconds) of the per-device latency histograms
+static const U32 latency_bounds[I2C_LATENCY_BUCKETS - 1] = {100, 250, 500, 1000, 2000, 5000, 10000};
+
+// The range of addresses a bus scan probes.  The addresses outside of this range are reserved
+const int FIRST_SCAN_ADDRESS = 0x08;
+const int LAST_SCAN_ADDRESS  = 0x77;
+
+// The clock speeds the bus can run at, fastest first.  We start at Fast-mode and step down whenever
+// the error rate is too high.  Fast-mode Plus is out: the HT16K33 is only rated for 400 kHz, and the bus
+// relies on the ESP32's weak internal pull-ups
+static const U32 bus_speeds[] = {400000, 100000};
+
+// The error rate is evaluated once every this many transactions...
+const int HEALTH_WINDOW = 32;
+
+// ...and if more than 1 in this many failed, we step down to the next slower speed
+const int MAX_ERROR_RATIO = 4;
+
+//=========================================================================================================
+// classify() - Sorts the result of i2c_master_cmd_begin() into one of the outcomes we keep track of.
+//              ESP_FAIL means the device didn't acknowledge
+//=========================================================================================================
+static i2c_result_t classify(esp_err_t status)
+{
+    if (status == ESP_OK         ) return I2C_RESULT_OK;
+    if (status == ESP_FAIL       ) return I2C_RESULT_NAK;
+    if (status == ESP_ERR_TIMEOUT) return I2C_RESULT_TIMEOUT;
+    return I2C_RESULT_OTHER;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// launch_task() - Just calls the task() method of our I2C object
+//=========================================================================================================
+static void launch_task(void *pvParameters) {I2C.task();}
+//=========================================================================================================
 
 
 //=========================================================================================================
@@ -12,11 +57,376 @@
 //         scl_pin = The name of the GPIO that will be the I2C clock (SCL) pin 
 //=========================================================================================================
 void CI2C::init(i2c_port_t port, gpio_num_t sda_pin, gpio_num_t scl_pin)
+{
+    bool is_learned = false;
+
+    // Save the port number and pins for future use
+    m_port    = port;
+    m_sda_pin = sda_pin;
+    m_scl_pin = scl_pin;
+
+    // We haven't talked to any devices or performed any transactions yet
+    m_device_count = 0;
+    m_trace_head   = 0;
+
+    // If we settled on a speed before a warm reboot, we'll use it
+    for (int index = 0; index < array_count(bus_speeds); ++index)
+    {
+        if (NVRAM.i2c_speed == bus_speeds[index]) is_learned = true;
+    }
+
+    // Otherwise, we start out at the slowest speed
+    if (!is_learned)
+    {
+        NVRAM.i2c_speed         = bus_speeds[array_count(bus_speeds) - 1];
+        NVRAM.i2c_window_count  = 0;
+        NVRAM.i2c_window_errors = 0;
+    }
+
+    // If there's a real bus, set it up
+    if (m_hal == nullptr)
+    {
+        // Configure the bus and install the I2C bus driver
+        install_driver();
+
+        // A device may have been left holding the bus by a brownout or a reset mid-transaction
+        if (is_bus_stuck()) recover();
+
+        // If we don't have a speed yet, find the fastest one that every device on the bus can handle
+        if (!is_learned) choose_speed();
+    }
+
+    // Tell the engineer what speed we're running at
+    printf("I2C bus running at %u kHz\n", (unsigned)(NVRAM.i2c_speed / 1000));
+
+    // Other tasks write pointers to their requests into these queues
+    for (int priority = 0; priority < I2C_PRIO_COUNT; ++priority)
+    {
+        m_request_qh[priority] = xQueueCreate(REQUEST_QUEUE_DEPTH, sizeof(i2c_request_t*));
+    }
+
+    // This counts the requests waiting in all of the queues
+    m_pending = xSemaphoreCreateCounting(REQUEST_QUEUE_DEPTH * I2C_PRIO_COUNT, 0);
+
+    // And finally, launch the task that owns the bus
+    xTaskCreatePinnedToCore(::launch_task, "i2c", 3000, nullptr, TASK_PRIO_I2C, NULL, TASK_CPU);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// task() - Runs in an infinite loop performing I2C transactions, highest priority first
+//=========================================================================================================
+void CI2C::task()
+{
+    i2c_request_t* request = nullptr;
+
+    // We're going to sit in a loop forever listening for requests
+    while (true)
+    {
+        // Wait for a request to arrive in any of the queues
+        xSemaphoreTake(m_pending, portMAX_DELAY);
+
+        // Fetch the request from the highest priority queue that has one
+        for (int priority = I2C_PRIO_COUNT - 1; priority >= 0; --priority)
+        {
+            if (xQueueReceive(m_request_qh[priority], &request, 0) == pdTRUE) break;
+        }
+
+        // Keep track of how long the request sat in the queue
+        Metrics.i2c_queue_wait_us.observe((U32)(esp_timer_get_time() - request->queued_at));
+
+        // Perform the transaction
+        request->status = execute(request);
+
+        // Fetch the task to notify before marking the request complete.  Once it's complete, the
+        // requester is free to re-use or discard the request object
+        i2c_callback_t callback    = request->callback;
+        TaskHandle_t   notify_task = request->notify_task;
+
+        // If the requester wants a callback, call it
+        if (callback) callback(request);
+
+        // The request is complete
+        request->is_complete = true;
+
+        // If a task is waiting for this request to complete, wake it up
+        if (notify_task) xTaskNotifyGive(notify_task);
+    }
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// create_link() - Fetches an empty command link
+//
+// The link is built in m_link_buffer, so no memory is allocated.  Links only come from the heap when
+// I2C_STATIC_LINKS is turned off (or the ESP-IDF is too old for static links), and are counted in
+// clock_i2c_heap_links_total
+//=========================================================================================================
+i2c_cmd_handle_t CI2C::create_link()
+{
+    // Use the static buffer unless we've been told not to
+    m_link_is_static = I2C_STATIC_LINKS;
+
+    // If we're using the static buffer, build the link in it
+    #if I2C_STATIC_LINKS
+    return i2c_cmd_link_create_static(m_link_buffer, sizeof m_link_buffer);
+    #endif
+
+    // Otherwise, allocate the link from the heap
+    Metrics.i2c_heap_links.inc();
+    return i2c_cmd_link_create();
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// delete_link() - Frees a link obtained from create_link()
+//=========================================================================================================
+void CI2C::delete_link(i2c_cmd_handle_t cmd)
+{
+    // If the link was built in the static buffer, there's nothing to free
+    #if I2C_STATIC_LINKS
+    if (m_link_is_static) return i2c_cmd_link_delete_static(cmd);
+    #endif
+
+    // Otherwise, hand the link back to the heap
+    i2c_cmd_link_delete(cmd);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// build_link() - Builds the command link for a request
+//=========================================================================================================
+i2c_cmd_handle_t CI2C::build_link(i2c_request_t* request)
+{
+    U8* p_data = (U8*) request->data;
+    int length = request->length;
+
+    // Fetch a command link.  No transaction needs more than 8 commands
+    i2c_cmd_handle_t cmd = create_link();
+
+    // Start the transaction
+    i2c_master_start(cmd);
+
+    // If there's a register address or command, write it
+    if (request->reg_length)
+    {
+        i2c_master_write_byte(cmd, request->address << 1 | I2C_MASTER_WRITE, true);
+        i2c_master_write(cmd, request->reg, request->reg_length, true);
+    }
+
+    // A write sends the data straight from the caller's buffer
+    if (request->op == I2C_WRITE)
+    {
+        if (request->reg_length == 0) i2c_master_write_byte(cmd, request->address << 1 | I2C_MASTER_WRITE, true);
+        if (length > 0) i2c_master_write(cmd, p_data, length, true);
+    }
+
+    // A read follows the register address (if any) with a repeated start
+    if (request->op == I2C_READ && length > 0)
+    {
+        if (request->reg_length) i2c_master_start(cmd);
+        i2c_master_write_byte(cmd, request->address << 1 | I2C_MASTER_READ, true);
+        if (length > 1) i2c_master_read(cmd, p_data, length-1, I2C_MASTER_ACK);
+        i2c_master_read_byte(cmd, p_data + length - 1, I2C_MASTER_NACK);
+    }
+
+    // Finalize the command buffer
+    i2c_master_stop(cmd);
+
+    // And hand it to the caller
+    return cmd;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// execute() - Performs a request on the bus (or hands it to the attached HAL).  This runs only in the
+//             bus task
+//=========================================================================================================
+esp_err_t CI2C::execute(i2c_request_t* request)
+{
+    i2c_cmd_handle_t cmd = nullptr;
+    esp_err_t        status;
+
+    // These map the outcomes a HAL reports to the errors the I2C driver would have returned
+    static const esp_err_t hal_status[] = {ESP_OK, ESP_FAIL, ESP_ERR_TIMEOUT, ESP_ERR_INVALID_STATE};
+
+    // Keep track of how long it takes to build and free the link
+    S64 start_time = esp_timer_get_time();
+
+    // If the real bus is in use, build the command link
+    if (m_hal == nullptr) cmd = build_link(request);
+
+    // This is how long it took to build the link
+    S64 setup_us = esp_timer_get_time() - start_time;
+
+    // Perform the transaction, keeping track of how long it takes
+    S64 bus_start = esp_timer_get_time();
+    if (m_hal)
+    {
+        i2c_result_t result = m_hal->transact(request->address, request->op == I2C_READ, request->reg,
+                                              request->reg_length, (U8*)request->data, request->length);
+        status = hal_status[result];
+    }
+    else status = i2c_master_cmd_begin(m_port, cmd, 0);
+    S64 bus_us = esp_timer_get_time() - bus_start;
+
+    // Free the link
+    start_time = esp_timer_get_time();
+    if (cmd) delete_link(cmd);
+    setup_us += esp_timer_get_time() - start_time;
+
+    // Record the transaction in the trace
+    trace(request, status, bus_start, (U32)bus_us);
+
+    // Record the transaction in our metrics
+    Metrics.i2c_transactions.inc();
+    Metrics.i2c_transaction_us.observe((U32)bus_us);
+    Metrics.i2c_setup_us.observe((U32)setup_us);
+    if (status != ESP_OK) Metrics.i2c_errors.inc();
+
+    // Record the transaction in the statistics for this device, and keep an eye on the bus's health.
+    // Probes of empty addresses fail by design, so they don't count
+    if (!request->is_probe)
+    {
+        record_stats(request, status, (U32)bus_us);
+        if (m_hal == nullptr) check_health(status);
+    }
+
+    // Tell the caller whether or not this transaction was successful
+    return status;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// record_stats() - Records the outcome of a transaction in the statistics for its device.  This runs
+//                  only in the bus task, right after the transaction, so it's just a short search and
+//                  a handful of increments
+//=========================================================================================================
+void CI2C::record_stats(i2c_request_t* request, esp_err_t status, U32 bus_us)
+{
+    int index, bucket;
+
+    // Find the statistics for this device
+    for (index = 0; index < m_device_count; ++index)
+    {
+        if (m_device[index].address == request->address) break;
+    }
+
+    // If this is a device we haven't seen before, start keeping statistics for it
+    if (index == m_device_count)
+    {
+        if (m_device_count == I2C_MAX_DEVICES) return;
+        memset(&m_device[index], 0, sizeof m_device[index]);
+        m_device[index].address = request->address;
+        ++m_device_count;
+    }
+
+    // Get a handy reference to the device's statistics
+    i2c_device_stats_t& stats = m_device[index];
+
+    // Count the transaction and the time it spent on the bus
+    ++stats.transactions;
+    stats.total_us += bus_us;
+
+    // Find the latency bucket this transaction belongs in, and count it
+    for (bucket = 0; bucket < I2C_LATENCY_BUCKETS - 1; ++bucket)
+    {
+        if (bus_us <= latency_bounds[bucket]) break;
+    }
+    ++stats.latency[bucket];
+
+    // Count the outcome
+    switch (classify(status))
+    {
+        case I2C_RESULT_OK:      stats.bytes += request->reg_length + request->length; break;
+        case I2C_RESULT_NAK:     ++stats.naks;                                         break;
+        case I2C_RESULT_TIMEOUT: ++stats.timeouts;                                     break;
+        case I2C_RESULT_OTHER:   ++stats.other_errors;                                 break;
+    }
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// trace() - Writes a record of a transaction into the trace ring
+//
+// The bus task is the only writer, so no lock is needed.  The record is filled in first and only then
+// is m_trace_head advanced to publish it.  This is a couple dozen stores, well under a microsecond
+//=========================================================================================================
+void CI2C::trace(i2c_request_t* request, esp_err_t status, S64 start_time, U32 bus_us)
+{
+#if I2C_TRACE
+    // Find the slot this record goes into
+    U32 sequence = m_trace_head;
+    i2c_trace_t& record = m_trace[sequence % I2C_TRACE_SIZE];
+
+    // Fill in the record
+    record.timestamp  = (U32)start_time;
+    record.bus_us     = (bus_us > 0xFFFF) ? 0xFFFF : bus_us;
+    record.address    = request->address;
+    record.op         = request->op;
+    record.length     = (request->length > 0xFFFF) ? 0xFFFF : request->length;
+    record.reg_length = request->reg_length;
+    record.result     = classify(status);
+
+    // Capture the first bytes on the wire: the register bytes, then the data
+    const U8* p_data = (const U8*)request->data;
+    for (int i=0; i<sizeof(record.first); ++i)
+    {
+        if (i < request->reg_length)
+            record.first[i] = request->reg[i];
+        else if (i - request->reg_length < request->length)
+            record.first[i] = p_data[i - request->reg_length];
+        else
+            record.first[i] = 0;
+    }
+
+    // Make sure the record is complete before publishing it
+    __sync_synchronize();
+    m_trace_head = sequence + 1;
+#endif
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// read_trace() - Copies a trace record
+//
+// Passed: sequence = The sequence number of the record.  trace_head() - 1 is the newest
+//
+// Returns: false if that record hasn't been written yet, or has been (or is being) overwritten
+//=========================================================================================================
+bool CI2C::read_trace(U32 sequence, i2c_trace_t* p_record)
+{
+#if I2C_TRACE
+    // The slot the writer fills next holds record "head - I2C_TRACE_SIZE", so that one is never safe
+    if (sequence >= m_trace_head || m_trace_head - sequence >= I2C_TRACE_SIZE) return false;
+
+    // Copy the record
+    *p_record = m_trace[sequence % I2C_TRACE_SIZE];
+
+    // If the writer lapped us while we were copying, the copy might be torn
+    __sync_synchronize();
+    return m_trace_head - sequence < I2C_TRACE_SIZE;
+#else
+    return false;
+#endif
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// install_driver() - Configures the bus at the current speed and installs the I2C driver
+//=========================================================================================================
+void CI2C::install_driver()
 {
     i2c_config_t conf;
-    
-    // Save the port number for future use
-    m_port = port;
 
     // Initialize the I2C configuration structure to known values
     memset(&conf, 0, sizeof conf);
@@ -25,114 +435,360 @@ void CI2C::init(i2c_port_t port, gpio_num_t sda_pin, gpio_num_t scl_pin)
     conf.mode = I2C_MODE_MASTER;
 
     // Keep track of which pins are going to serve as data (SDA) and clock (SDC)
-    conf.sda_io_num = sda_pin;
-    conf.scl_io_num = scl_pin;
+    conf.sda_io_num = m_sda_pin;
+    conf.scl_io_num = m_scl_pin;
 
     // Enable the pullup resistors for the clock and data pins
     conf.sda_pullup_en = GPIO_PULLUP_ENABLE;
     conf.scl_pullup_en = GPIO_PULLUP_ENABLE;
 
-    // Set the I2C bus clock to 100 kilohertz
-    conf.master.clk_speed = 100000;
+    // Set the I2C bus clock speed
+    conf.master.clk_speed = NVRAM.i2c_speed;
 
     // Configure this I2C serial bus
-    i2c_param_config(port, &conf);
+    i2c_param_config(m_port, &conf);
 
     // And install the I2C bus driver
-    i2c_driver_install(port, conf.mode, 0, 0, 0);
-    
-    // Create the mutex that we will use to ensure thread-safe access to the I2C bus
-    m_mutex = xSemaphoreCreateMutex();
+    i2c_driver_install(m_port, conf.mode, 0, 0, 0);
 }
 //=========================================================================================================
 
 
 //=========================================================================================================
-// perform() - Performs an I2C read or write transaction
+// check_health() - Called after every transaction.  A stuck bus is recovered right away.  Otherwise,
+//                  if too many transactions in the evaluation window failed, we step down to the
+//                  next slower clock speed.  The window lives in NVRAM, so a warm reboot doesn't
+//                  lose it
 //=========================================================================================================
-bool CI2C::perform(i2c_cmd_handle_t cmd)
+void CI2C::check_health(esp_err_t status)
 {
-    // Perform the read or write transaction
-    esp_err_t status = i2c_master_cmd_begin(m_port, cmd, 0);
+    // Count this transaction
+    ++NVRAM.i2c_window_count;
+    if (status != ESP_OK) ++NVRAM.i2c_window_errors;
+
+    // If a transaction timed out and a device is holding the bus, free it
+    if (status == ESP_ERR_TIMEOUT && is_bus_stuck()) recover();
+
+    // Once this many transactions in a window have failed, the error rate is too high no matter how
+    // the rest of the window goes
+    const int MAX_ERRORS = HEALTH_WINDOW / MAX_ERROR_RATIO;
+
+    // If the window isn't complete yet and the error rate isn't already too high, we're done
+    if (NVRAM.i2c_window_count < HEALTH_WINDOW && NVRAM.i2c_window_errors <= MAX_ERRORS) return;
+
+    // Find out whether the error rate was acceptable, and start a new window
+    bool too_many_errors = NVRAM.i2c_window_errors > MAX_ERRORS;
+    NVRAM.i2c_window_count  = 0;
+    NVRAM.i2c_window_errors = 0;
+    if (!too_many_errors) return;
+
+    // Find the next slower speed.  If we're already at the slowest, there's nothing to be done
+    int index = 0;
+    while (bus_speeds[index] != NVRAM.i2c_speed) ++index;
+    if (index == array_count(bus_speeds) - 1) return;
+
+    // Re-install the driver at the slower speed
+    NVRAM.i2c_speed = bus_speeds[index + 1];
+    printf("Too many I2C errors, slowing the bus to %u kHz\n", (unsigned)(NVRAM.i2c_speed / 1000));
+    i2c_driver_delete(m_port);
+    install_driver();
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// probe() - Returns true if a device responds at the specified address.  This performs the transaction
+//           directly, so it must only be called from init() or the bus task
+//=========================================================================================================
+bool CI2C::probe(int address)
+{
+    i2c_request_t request;
 
-    // Tell the caller whether or not this read or write operation was successful
-    return status == ESP_OK;
+    // A probe is just the address with no data.  A device that's present acknowledges it
+    prepare(&request, I2C_WRITE, address, 0, 0, nullptr, 0, I2C_PRIO_LOW);
+    request.is_probe = true;
+    return execute(&request) == ESP_OK;
 }
 //=========================================================================================================
 
 
 //=========================================================================================================
-// read() - A convenience method that reads data from an I2C device
+// choose_speed() - Finds the fastest speed at which every device on the bus responds reliably.  This
+//                  is called at power-up, with the driver installed at the slowest speed
 //=========================================================================================================
-bool  CI2C::read(int i2c_address, void* vp_data, int length)
+void CI2C::choose_speed()
 {
-    // Allow 0 length reads
-    if (length < 1) return true;
-   
-    // Turn the output-buffer void* into a U8*
-    U8* p_data = (U8*) vp_data;
-
-    // Allocate an I2C command buffers
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
- 
-    // Initialize the command buffer that will perform the I2C read operation
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, i2c_address << 1 | I2C_MASTER_READ, true);
-    if (length > 1) i2c_master_read(cmd, p_data, length-1, I2C_MASTER_ACK);
-    i2c_master_read_byte(cmd, p_data + length - 1, I2C_MASTER_NACK);
-    i2c_master_stop(cmd);
- 
-    // Perform the I2C read operation
-    bool status = I2C.perform(cmd);
- 
-    // Free the resources we allocated earlier
-    i2c_cmd_link_delete(cmd);
- 
-    // Tell the caller whether or not this read operation was successful
-    return status;
+    U8  present[16];
+    int count = 0;
+
+    // Find out which devices are present
+    for (int address = FIRST_SCAN_ADDRESS; address <= LAST_SCAN_ADDRESS; ++address)
+    {
+        if (count < array_count(present) && probe(address)) present[count++] = address;
+    }
+
+    // If nothing responded, we have no way to tell whether a faster speed works, so we stay at the
+    // slowest speed, where the driver is already installed
+    if (count == 0) return;
+
+    // Try each speed, fastest first
+    for (int index = 0; index < array_count(bus_speeds) - 1; ++index)
+    {
+        // Re-install the driver at this speed
+        i2c_driver_delete(m_port);
+        NVRAM.i2c_speed = bus_speeds[index];
+        install_driver();
+
+        // Every device must respond to several probes in a row
+        bool ok = true;
+        for (int i=0; ok && i<count; ++i)
+        {
+            for (int attempt = 0; ok && attempt < 3; ++attempt) ok = probe(present[i]);
+        }
+
+        // If they all did, this is our speed
+        if (ok) return;
+    }
+
+    // If we get here, only the slowest speed will do
+    i2c_driver_delete(m_port);
+    NVRAM.i2c_speed = bus_speeds[array_count(bus_speeds) - 1];
+    install_driver();
 }
 //=========================================================================================================
 
 
+//=========================================================================================================
+// is_bus_stuck() - Returns true if a device is holding SDA or SCL low.  This is only meaningful when
+//                  no transaction is in progress, when both lines should be pulled high
+//=========================================================================================================
+bool CI2C::is_bus_stuck()
+{
+    return gpio_get_level(m_sda_pin) == 0 || gpio_get_level(m_scl_pin) == 0;
+}
+//=========================================================================================================
+
 
 //=========================================================================================================
-// write() - A convenience method that writes data from an I2C device
+// recover() - Frees a bus that a device is holding
+//
+// A device that was reset or browned-out in the middle of a read can be left driving SDA low, waiting
+// for clocks that will never come.  We take the pins away from the I2C driver, clock SCL up to nine
+// times until the device lets go of SDA, generate a STOP, then give the pins back to the driver
 //=========================================================================================================
-bool CI2C::write(int i2c_address, void* vp_data, int length)
+void CI2C::recover()
 {
-    // Allow 0 length writes
-    if (length < 1) return true;
-   
-    // Turn the void* into a U8*
-    U8* p_data = (U8*) vp_data;
+    gpio_config_t io;
+
+    // Half of a 100 kHz clock period
+    const int HALF_PERIOD_US = 5;
+
+    printf("*** I2C bus is stuck, recovering!! ***\n");
+
+    // Remove the I2C driver so that we can drive the pins ourselves
+    i2c_driver_delete(m_port);
+
+    // Make both pins open-drain GPIOs with pullups
+    memset(&io, 0, sizeof io);
+    io.pin_bit_mask = (1ULL << m_sda_pin) | (1ULL << m_scl_pin);
+    io.mode         = GPIO_MODE_INPUT_OUTPUT_OD;
+    io.pull_up_en   = GPIO_PULLUP_ENABLE;
+    gpio_config(&io);
+
+    // Let both lines float high
+    gpio_set_level(m_sda_pin, 1);
+    gpio_set_level(m_scl_pin, 1);
+    esp_rom_delay_us(HALF_PERIOD_US);
+
+    // Clock SCL until the device releases SDA.  Nine clocks finishes any byte it could be sending
+    for (int clock = 0; clock < 9 && gpio_get_level(m_sda_pin) == 0; ++clock)
+    {
+        gpio_set_level(m_scl_pin, 0);
+        esp_rom_delay_us(HALF_PERIOD_US);
+        gpio_set_level(m_scl_pin, 1);
+        esp_rom_delay_us(HALF_PERIOD_US);
+    }
+
+    // Generate a STOP: SDA rises while SCL is high
+    gpio_set_level(m_scl_pin, 0);
+    esp_rom_delay_us(HALF_PERIOD_US);
+    gpio_set_level(m_sda_pin, 0);
+    esp_rom_delay_us(HALF_PERIOD_US);
+    gpio_set_level(m_scl_pin, 1);
+    esp_rom_delay_us(HALF_PERIOD_US);
+    gpio_set_level(m_sda_pin, 1);
+    esp_rom_delay_us(HALF_PERIOD_US);
+
+    // Tell the engineer whether it worked
+    if (is_bus_stuck()) printf("*** I2C bus recovery failed!! ***\n");
+
+    // Give the pins back to the I2C driver
+    install_driver();
+
+    // And keep track of how often this happens
+    ++NVRAM.i2c_recoveries;
+    Metrics.i2c_recoveries.inc();
+}
+//=========================================================================================================
 
-    // Allocate an I2C command buffers
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
 
-    // Initialize the write-operation buffer
-    i2c_master_start(cmd);
+//=========================================================================================================
+// latency_bound() - Returns the upper bound (in microseconds) of a latency bucket, or 0 for the last
+//                   bucket, which has no upper bound
+//=========================================================================================================
+U32 CI2C::latency_bound(int bucket)
+{
+    return (bucket < I2C_LATENCY_BUCKETS - 1) ? latency_bounds[bucket] : 0;
+}
+//=========================================================================================================
 
-    // Tell the I2C bus that this is going to be a write operation to the specified device
-    i2c_master_write_byte(cmd, i2c_address << 1 | I2C_MASTER_WRITE, true);
 
-    // Buffer up the bytes to be written
-    while (length--) i2c_master_write_byte(cmd, *p_data++, true);
+//=========================================================================================================
+// scan() - Probes every 7-bit address to find out which devices are present
+//
+// Passed: p_found   = Filled in with the addresses of the devices that responded
+//         max_found = The number of entries p_found has room for
+//
+// Returns: the number of devices found
+//=========================================================================================================
+int CI2C::scan(U8* p_found, int max_found)
+{
+    i2c_request_t request;
+    int found = 0;
+
+    for (int address = FIRST_SCAN_ADDRESS; address <= LAST_SCAN_ADDRESS; ++address)
+    {
+        // A probe is just the address with no data.  A device that's present acknowledges it.  We
+        // queue this one, since the bus task owns the bus
+        prepare(&request, I2C_WRITE, address, 0, 0, nullptr, 0, I2C_PRIO_LOW);
+        request.is_probe = true;
+
+        // If the device responded, record its address
+        if (perform(&request) && found < max_found) p_found[found++] = address;
+    }
+
+    // Tell the caller how many devices responded
+    return found;
+}
+//=========================================================================================================
 
-    // Finalize the command buffer
-    i2c_master_stop(cmd);
- 
-    // Perform the I2C write commands
-    bool status = I2C.perform(cmd);
 
-    // Free up the resources we allocated earlier
-    i2c_cmd_link_delete(cmd);
- 
-    // Tell the caller whether this I2C write operation worked
-    return status;
+//=========================================================================================================
+// prepare() - Fills in a request
+//
+// Passed: request     = The request to fill in
+//         op          = I2C_READ or I2C_WRITE
+//         i2c_address = The I2C address of the device
+//         reg         = The register address (or command) that precedes the data
+//         reg_len     = The number of bytes of "reg" to write (0 thru 4)
+//         vp_data     = The data to write, or the buffer to read into
+//         length      = The number of bytes to write or read
+//         priority    = I2C_PRIO_HIGH or I2C_PRIO_LOW
+//=========================================================================================================
+void CI2C::prepare(i2c_request_t* request, i2c_op_t op, int i2c_address, int reg, int reg_len,
+                   void* vp_data, int length, i2c_priority_t priority)
+{
+    request->op          = op;
+    request->address     = i2c_address;
+    request->reg_length  = pack(request->reg, reg, reg_len);
+    request->data        = vp_data;
+    request->length      = length;
+    request->priority    = priority;
+    request->callback    = nullptr;
+    request->context     = nullptr;
+    request->notify_task = nullptr;
+    request->is_probe    = false;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// submit() - Queues a request for the bus task and returns immediately
+//=========================================================================================================
+void CI2C::submit(i2c_request_t* request)
+{
+    // The request isn't complete yet
+    request->is_complete = false;
+
+    // Record when it was queued so that we can measure time-in-queue
+    request->queued_at = esp_timer_get_time();
+
+    // Hand it to the bus task.  If the queue is full, this waits for room
+    xQueueSend(m_request_qh[request->priority], &request, portMAX_DELAY);
+
+    // And tell the bus task there's another request waiting
+    xSemaphoreGive(m_pending);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// wait() - Waits for a submitted request to complete.  The request must have been submitted with
+//          "notify_task" set to the calling task
+//
+// Returns: 'true' if the transaction was successful
+//=========================================================================================================
+bool CI2C::wait(i2c_request_t* request)
+{
+    while (!request->is_complete) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    return request->status == ESP_OK;
 }
 //=========================================================================================================
 
 
+//=========================================================================================================
+// perform() - Queues a request and blocks until the bus task has completed it
+//
+// Returns: 'true' if the transaction was successful
+//=========================================================================================================
+bool CI2C::perform(i2c_request_t* request)
+{
+    // We want to be notified when the request is complete
+    request->notify_task = xTaskGetCurrentTaskHandle();
+
+    // Hand the request to the bus task
+    submit(request);
+
+    // And wait for it to complete
+    return wait(request);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// read() - A convenience method that reads data from an I2C device
+//=========================================================================================================
+bool  CI2C::read(int i2c_address, void* vp_data, int length, i2c_priority_t priority)
+{
+    i2c_request_t request;
+
+    // Allow 0 length reads
+    if (length < 1) return true;
+
+    // Perform the read and tell the caller whether it was successful
+    prepare(&request, I2C_READ, i2c_address, 0, 0, vp_data, length, priority);
+    return perform(&request);
+}
+//=========================================================================================================
+
+
+
+//=========================================================================================================
+// write() - A convenience method that writes data to an I2C device
+//=========================================================================================================
+bool CI2C::write(int i2c_address, void* vp_data, int length, i2c_priority_t priority)
+{
+    i2c_request_t request;
+
+    // Allow 0 length writes
+    if (length < 1) return true;
+
+    // Perform the write and tell the caller whether it was successful
+    prepare(&request, I2C_WRITE, i2c_address, 0, 0, vp_data, length, priority);
+    return perform(&request);
+}
+//=========================================================================================================
+
 
 
 //=========================================================================================================
@@ -144,50 +800,98 @@ bool CI2C::write(int i2c_address, void* vp_data, int length)
 //         len1        = Number of bytes of val1 to write
 //         val2        = The second value to be written to the device
 //         len2        = Number of byutes of val2 to write
+//         priority    = I2C_PRIO_HIGH or I2C_PRIO_LOW
 //
 // Returns: 'true' if the I2C write operation was successful, otherwise 'false'
 //=========================================================================================================
-bool  CI2C::write(int i2c_address, int val1, int len1, int val2, int len2)
+bool  CI2C::write(int i2c_address, int val1, int len1, int val2, int len2, i2c_priority_t priority)
 {
-    // Allocate an I2C command buffer for the write operation
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    U8 data[8];
 
-    // Initialize the write-operation buffer
-    i2c_master_start(cmd);
+    // Pack both values into the buffer, most significant byte first
+    int length = pack(data, val1, len1);
+    length += pack(data + length, val2, len2);
 
-    // Tell the I2C bus that this is going to be a write operation to the specified device
-    i2c_master_write_byte(cmd, i2c_address << 1 | I2C_MASTER_WRITE, true);
+    // And write the buffer to the device
+    return write(i2c_address, data, length, priority);
+}
+//=========================================================================================================
 
-    // Buffer up the first value to be written
-    if (len1 >= 4) i2c_master_write_byte(cmd, val1 >> 24, true);
-    if (len1 >= 3) i2c_master_write_byte(cmd, val1 >> 16, true);
-    if (len1 >= 2) i2c_master_write_byte(cmd, val1 >>  8, true);
-    if (len1 >= 1) i2c_master_write_byte(cmd, val1      , true);
 
-    // Buffer up the second value to be written
-    if (len2 >= 4) i2c_master_write_byte(cmd, val2 >> 24, true);
-    if (len2 >= 3) i2c_master_write_byte(cmd, val2 >> 16, true);
-    if (len2 >= 2) i2c_master_write_byte(cmd, val2 >>  8, true);
-    if (len2 >= 1) i2c_master_write_byte(cmd, val2      , true);
+//=========================================================================================================
+// write_reg() - Writes a register address (or command) followed by a block of data, in a single
+//               transaction and without copying the data
+//
+// Passed: i2c_address = The I2C address of the device
+//         reg         = The register address
+//         reg_len     = The number of bytes of "reg" to write (1 thru 4)
+//         vp_data     = The data to write after the register address
+//         length      = The number of bytes of data
+//         priority    = I2C_PRIO_HIGH or I2C_PRIO_LOW
+//=========================================================================================================
+bool CI2C::write_reg(int i2c_address, int reg, int reg_len, const void* vp_data, int length,
+                     i2c_priority_t priority)
+{
+    i2c_request_t request;
 
-    // Finalize the command buffer
-    i2c_master_stop(cmd);
- 
-    // Perform the I2C write commands
-    bool status = I2C.perform(cmd);
+    // Perform the write and tell the caller whether it was successful
+    prepare(&request, I2C_WRITE, i2c_address, reg, reg_len, (void*)vp_data, length, priority);
+    return perform(&request);
+}
+//=========================================================================================================
 
-    // Free up the resources we allocated earlier
-    i2c_cmd_link_delete(cmd);
- 
-    // Tell the caller whether this I2C write operation worked
-    return status;
+
+//=========================================================================================================
+// read_reg() - Writes a register address, then reads data from the device following a repeated
+//              start, all in a single transaction
+//
+// Passed: i2c_address = The I2C address of the device
+//         reg         = The register address
+//         reg_len     = The number of bytes of "reg" to write (1 thru 4)
+//         vp_data     = The buffer the data is read into
+//         length      = The number of bytes to read
+//         priority    = I2C_PRIO_HIGH or I2C_PRIO_LOW
+//=========================================================================================================
+bool CI2C::read_reg(int i2c_address, int reg, int reg_len, void* vp_data, int length,
+                    i2c_priority_t priority)
+{
+    i2c_request_t request;
+
+    // Allow 0 length reads
+    if (length < 1) return true;
+
+    // Perform the read and tell the caller whether it was successful
+    prepare(&request, I2C_READ, i2c_address, reg, reg_len, vp_data, length, priority);
+    return perform(&request);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// pack() - Stores the low "length" bytes of a value into a buffer, most significant byte first
+//
+// Returns: the number of bytes stored, which is "length" clamped to the range 0 thru 4
+//=========================================================================================================
+int CI2C::pack(U8* p_out, int value, int length)
+{
+    // We can store at most 4 bytes of an int
+    if (length < 0) length = 0;
+    if (length > 4) length = 4;
+
+    // Store the bytes, most significant first
+    for (int i=0; i<length; ++i) p_out[i] = value >> (8 * (length - 1 - i));
+
+    // Tell the caller how many bytes we stored
+    return length;
 }
 //=========================================================================================================
 
 
 //=========================================================================================================
-// lock() / unlock() - These are used to manage thread-safe exclusive access to the I2C bus.
+// queue_depth() - Returns the number of requests waiting for the bus task
 //=========================================================================================================
-void CI2C::lock()   {xSemaphoreTake(m_mutex, portMAX_DELAY);}
-void CI2C::unlock() {xSemaphoreGive(m_mutex);}
+int CI2C::queue_depth()
+{
+    return (int)uxSemaphoreGetCount(m_pending);
+}
 //=========================================================================================================
@@ -1,40 +1,312 @@
 //=========================================================================================================
 // i2c_bus.h - Defines the interfaces to an I2C multi-drop serial bus
+//
+// A single bus-owner task performs every transaction on the bus.  Other tasks describe a transaction
+// in an i2c_request_t and queue it.  Requests are performed highest priority first, so a display
+// refresh never waits behind a queue of background sensor reads
 //=========================================================================================================
 #pragma once
+#include <esp_idf_version.h>
 #include "common.h"
+#include "nvram.h"
+#include "i2c_hal.h"
+
+//=========================================================================================================
+// Change this 1 to a 0 to build I2C command links on the heap instead of in the bus's own static
+// buffer.  This exists so the two can be compared via the clock_i2c_setup_us metric
+//=========================================================================================================
+#define I2C_STATIC_LINKS 1
+
+// Static links are built with i2c_cmd_link_create_static(), which first appeared in ESP-IDF 4.4.  With
+// an older ESP-IDF, links always come from the heap
+#if I2C_STATIC_LINKS && ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(4, 4, 0)
+#undef  I2C_STATIC_LINKS
+#define I2C_STATIC_LINKS 0
+#endif
+//=========================================================================================================
+
+
+//=========================================================================================================
+// Change this 1 to a 0 to compile out the I2C transaction trace.  See i2c_trace_t
+//=========================================================================================================
+#define I2C_TRACE 1
+//=========================================================================================================
+
+
+//=========================================================================================================
+// Change this 0 to a 1 to run against the simulated devices in sim_i2c.h instead of the real bus
+//=========================================================================================================
+#define I2C_SIMULATED 0
+//=========================================================================================================
+
+
+// The kinds of transaction the bus task can perform
+enum i2c_op_t {I2C_WRITE, I2C_READ};
+
+// The priority of a transaction.  Higher priority requests are performed first
+enum i2c_priority_t {I2C_PRIO_LOW, I2C_PRIO_HIGH, I2C_PRIO_COUNT};
+
+// The number of devices that statistics are kept for
+enum {I2C_MAX_DEVICES = 8};
+
+// The number of records the transaction trace holds
+enum {I2C_TRACE_SIZE = 128};
+
+// The number of buckets in each device's latency histogram.  The last bucket is for anything slower
+// than the largest bound
+enum {I2C_LATENCY_BUCKETS = 8};
+
+struct i2c_request_t;
+
+// A completion callback has this signature.  It runs in the context of the bus task, so it must be
+// brief and must not block
+typedef void (*i2c_callback_t)(i2c_request_t* request);
+
+//=========================================================================================================
+// i2c_request_t - Describes a single transaction.  The caller owns this object, and it (and its data
+//                 buffer) must remain valid until "is_complete" becomes true
+//
+// I2C_WRITE: writes the register bytes (if any) then the data
+// I2C_READ : if there are register bytes, writes them then issues a repeated start.  Then reads data
+//=========================================================================================================
+struct i2c_request_t
+{
+    // Read or write?
+    i2c_op_t            op;
+
+    // The 7-bit address of the device
+    int                 address;
+
+    // A register address or command that precedes the data, most significant byte first
+    U8                  reg[4];
+    int                 reg_length;
+
+    // The data to be written, or the buffer to read into
+    void*               data;
+    int                 length;
+
+    // Display refreshes should be I2C_PRIO_HIGH, background work I2C_PRIO_LOW
+    i2c_priority_t      priority;
+
+    // If not null, this is called when the request is complete
+    i2c_callback_t      callback;
+
+    // For use by the callback
+    void*               context;
+
+    // If not null, this task is sent a task-notification when the request is complete
+    TaskHandle_t        notify_task;
+
+    // Becomes true when the request is complete
+    volatile bool       is_complete;
+
+    // The result of the transaction.  Valid once the request is complete
+    esp_err_t           status;
+
+    // The time (in microseconds since boot) the request was queued.  Filled in by submit()
+    S64                 queued_at;
+
+    // True if this is a bus-scan probe, which isn't counted in the per-device statistics
+    bool                is_probe;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// i2c_device_stats_t - Statistics for a single device address.  These are only ever written by the
+//                      bus task
+//=========================================================================================================
+struct i2c_device_stats_t
+{
+    // The 7-bit address of the device
+    int                 address;
+
+    // Transactions performed, and the register and data bytes transferred by the ones that succeeded
+    U32                 transactions;
+    U32                 bytes;
+
+    // Failed transactions: the device didn't acknowledge, the bus timed out, or anything else.  The
+    // driver reports a lost arbitration as a timeout
+    U32                 naks;
+    U32                 timeouts;
+    U32                 other_errors;
+
+    // The total time spent on the bus, and a histogram of transaction times
+    U32                 total_us;
+    U32                 latency[I2C_LATENCY_BUCKETS];
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// i2c_trace_t - A compact record of a single transaction.  The bus task writes one of these into a
+//               ring for every transaction it performs.  tools/i2ctrace.py renders them as a timeline
+//=========================================================================================================
+struct i2c_trace_t
+{
+    U32     timestamp;      // When the transaction started (low 32 bits of microseconds since boot)
+    U16     bus_us;         // How long it took on the bus, in microseconds
+    U8      address;        // The 7-bit device address
+    U8      op;             // I2C_WRITE or I2C_READ
+    U16     length;         // The number of data bytes
+    U8      reg_length;     // The number of register bytes that preceded the data
+    U8      result;         // An i2c_result_t
+    U8      first[4];       // The first bytes on the wire: the register bytes, then the data
+};
+//=========================================================================================================
 
 
 class CI2C
 {
 public:
 
-    // Call this once at bootup to initialize this I2C bus
+    // Call this once at bootup to initialize this I2C bus and start the bus task
     void    init(i2c_port_t port, gpio_num_t sda_pin, gpio_num_t scl_pin);
 
-    // These should be called before and after a set of "perform" and/or "read" operations to 
-    // obtain thread-safe exclusive access to the bus.
-    void    lock();
-    void    unlock();
+    // Call this before init() to have transactions performed by "hal" instead of the I2C controller
+    void    attach_hal(CI2CHal* hal) {m_hal = hal;}
+
+    // This is the thread that owns the bus and performs transactions
+    void    task();
+
+    // Fills in a request.  The register is written most significant byte first (reg_len = 0 thru 4)
+    void    prepare(i2c_request_t* request, i2c_op_t op, int i2c_address, int reg, int reg_len,
+                    void* vp_data, int length, i2c_priority_t priority);
+
+    // Call this to queue a request for the bus task.  Returns immediately
+    void    submit(i2c_request_t* request);
+
+    // Call this to wait for a request that was submitted with "notify_task" set to the calling task
+    bool    wait(i2c_request_t* request);
+
+    // Call this to queue a request and wait for it to complete
+    bool    perform(i2c_request_t* request);
+
+    // The convenience methods below queue their request at "priority".  Only display refreshes should
+    // pass I2C_PRIO_HIGH; everything else defaults to I2C_PRIO_LOW
 
     // This is a convenience method that calls "perform" to do an I2C read for a specified number of bytes
-    bool    read(int i2c_address, void* vp_data, int length);
+    bool    read(int i2c_address, void* vp_data, int length, i2c_priority_t priority = I2C_PRIO_LOW);
 
     // This is a convience method that calls "perform" to do an I2C write for a specified number of bytes
-    bool    write(int i2c_address, void* vp_data, int length);
+    bool    write(int i2c_address, void* vp_data, int length, i2c_priority_t priority = I2C_PRIO_LOW);
 
     // This is a convenience method that calls "perform" to write one or two integer values to an I2C device
-    bool    write(int i2c_address, int val1, int len1, int val2=0, int len2=0);
+    bool    write(int i2c_address, int val1, int len1, int val2=0, int len2=0,
+                  i2c_priority_t priority = I2C_PRIO_LOW);
+
+    // Writes a 1 to 4 byte register address followed by a block of data, in a single transaction
+    bool    write_reg(int i2c_address, int reg, int reg_len, const void* vp_data, int length,
+                      i2c_priority_t priority = I2C_PRIO_LOW);
+
+    // Writes a 1 to 4 byte register address, then reads a block of data after a repeated start
+    bool    read_reg(int i2c_address, int reg, int reg_len, void* vp_data, int length,
+                     i2c_priority_t priority = I2C_PRIO_LOW);
+
+    // Returns the number of requests waiting for the bus task
+    int     queue_depth();
+
+    // Probes every 7-bit address and fills in the ones that respond.  Returns the number found
+    int     scan(U8* p_found, int max_found);
+
+    // Returns the number of devices that statistics are being kept for
+    int     device_count() {return m_device_count;}
+
+    // Returns the statistics for a device.  "index" is 0 thru device_count() - 1
+    const i2c_device_stats_t& device_stats(int index) {return m_device[index];}
+
+    // Returns the upper bound (in microseconds) of a latency bucket, or 0 for the last bucket
+    U32     latency_bound(int bucket);
+
+    // Returns the sequence number the next trace record will be given.  Numbering starts at 0 at boot
+    U32     trace_head() {return m_trace_head;}
+
+    // Copies a trace record.  Returns false if it hasn't been written yet or has been overwritten
+    bool    read_trace(U32 sequence, i2c_trace_t* p_record);
 
-    // Call this to perform an arbitrary set of I2C read/write commands
-    bool    perform(i2c_cmd_handle_t cmd);
+    // Returns the current bus clock speed in Hz
+    U32     speed() {return NVRAM.i2c_speed;}
 
 protected:
 
+    // The number of commands (start, stop, address, and each read or write) the static link can hold
+    enum {LINK_COMMANDS = 10};
+
+    // Stores the low "length" bytes of a value into a buffer, most significant byte first
+    int     pack(U8* p_out, int value, int length);
+
+    // Builds the command link for a request and performs it on the bus
+    esp_err_t   execute(i2c_request_t* request);
+
+    // Builds the command link for a request
+    i2c_cmd_handle_t build_link(i2c_request_t* request);
+
+    // Fetches an empty command link from the static buffer (or the heap)
+    i2c_cmd_handle_t create_link();
+
+    // Frees a link obtained from create_link()
+    void    delete_link(i2c_cmd_handle_t cmd);
+
+    // Writes a record of a transaction into the trace ring
+    void    trace(i2c_request_t* request, esp_err_t status, S64 start_time, U32 bus_us);
+
+    // Records the outcome of a transaction in the statistics for its device
+    void    record_stats(i2c_request_t* request, esp_err_t status, U32 bus_us);
+
+    // Configures the bus at NVRAM.i2c_speed and installs the I2C driver
+    void    install_driver();
+
+    // Tracks the error rate, stepping the speed down or recovering the bus when necessary
+    void    check_health(esp_err_t status);
+
+    // Returns true if a device is holding SDA or SCL low while the bus should be idle
+    bool    is_bus_stuck();
+
+    // Clocks SCL until a stuck device releases SDA, then re-installs the driver
+    void    recover();
+
+    // Performs a probe transaction directly, without going through the queue
+    bool    probe(int address);
+
+    // Finds the fastest speed at which every device on the bus responds reliably
+    void    choose_speed();
+
     // This is the I2C port number of this I2C bus
     i2c_port_t          m_port;
-        
-    // This is the handle to the mutex that ensures thread-safe access to the I2C bus
-    SemaphoreHandle_t   m_mutex;
 
-};
\ No newline at end of file
+    // If this isn't null, it performs transactions instead of the I2C controller
+    CI2CHal*            m_hal;
+
+    // The pins the bus is on
+    gpio_num_t          m_sda_pin;
+    gpio_num_t          m_scl_pin;
+
+    // One queue of pending requests for each priority
+    QueueHandle_t       m_request_qh[I2C_PRIO_COUNT];
+
+    // This counts the requests waiting in all of the queues
+    SemaphoreHandle_t   m_pending;
+
+    // True if the command link that's in use lives in m_link_buffer rather than on the heap
+    bool                m_link_is_static;
+
+    // The storage that command links are built in, so that transactions don't touch the heap.  Only
+    // the bus task builds links, so this needs no locking
+    #if I2C_STATIC_LINKS
+    U8                  m_link_buffer[I2C_LINK_RECOMMENDED_SIZE(LINK_COMMANDS / 5)];
+    #endif
+
+    // The ring of trace records, and the sequence number of the next one to be written.  Only the
+    // bus task writes to these
+    #if I2C_TRACE
+    i2c_trace_t         m_trace[I2C_TRACE_SIZE];
+    #endif
+    volatile U32        m_trace_head;
+
+    // Statistics for each device address we've talked to
+    i2c_device_stats_t  m_device[I2C_MAX_DEVICES];
+    int                 m_device_count;
+
+};
+
+extern CI2C I2C;
@@ -0,0 +1,30 @@
+//=========================================================================================================
+// i2c_hal.h - Defines the seam between CI2C and the hardware that carries out its transactions
+//
+// Normally CI2C drives the ESP32's I2C controller directly.  If a CI2CHal is attached, every
+// transaction is handed to it instead, which is how CSimI2CBus stands in for the real bus.  This file
+// deliberately depends on nothing but the C standard library, so that implementations of it can be
+// compiled and run on a Linux host
+//=========================================================================================================
+#pragma once
+#include <stdint.h>
+
+// The outcome of a transaction
+enum i2c_result_t {I2C_RESULT_OK, I2C_RESULT_NAK, I2C_RESULT_TIMEOUT, I2C_RESULT_OTHER};
+
+
+//=========================================================================================================
+// CI2CHal - Carries out I2C transactions
+//=========================================================================================================
+class CI2CHal
+{
+public:
+
+    // Performs a single transaction
+    //
+    // A write sends the register bytes (if any) then the data.  A read sends the register bytes (if
+    // any), issues a repeated start, then reads "length" bytes into "data"
+    virtual i2c_result_t transact(int address, bool is_read, const uint8_t* reg, int reg_length,
+                                  uint8_t* data, int length) = 0;
+};
+//=========================================================================================================
@@ -0,0 +1,41 @@
+//=========================================================================================================
+// log_store.h - Defines the seam between CTelemetryLog and the flash that holds it
+//
+// On the ESP32 the log lives in a flash partition (CTelemetryStore).  On a Linux host it can live in a
+// file instead, which is how the host tests exercise the log.  Like i2c_hal.h, this file depends on
+// nothing but the C standard library
+//=========================================================================================================
+#pragma once
+#include <stdint.h>
+
+
+//=========================================================================================================
+// CLogStore - A region of NOR flash
+//
+// An erase sets every byte of a range to 0xFF.  A write can only clear bits, so writing over bytes that
+// have already been written ANDs the new data into them
+//=========================================================================================================
+class CLogStore
+{
+public:
+
+    // The size of the smallest range that can be erased.  Erases are whole, aligned sectors
+    enum {SECTOR_SIZE = 4096};
+
+    // Returns the size of the store in bytes
+    virtual uint32_t size() = 0;
+
+    // Reads bytes from the store
+    virtual bool    read(uint32_t offset, void* buffer, int length) = 0;
+
+    // Writes bytes to the store
+    virtual bool    write(uint32_t offset, const void* data, int length) = 0;
+
+    // Erases one or more sectors
+    virtual bool    erase(uint32_t offset, int length) = 0;
+
+    // The log calls these around every access, so that a store shared between tasks can serialize them
+    virtual void    lock() {}
+    virtual void    unlock() {}
+};
+//=========================================================================================================
@@ -8,6 +8,13 @@
 //=========================================================================================================
 void periodic_task(void*);
 void do_periodic();
+void record_telemetry();
+
+//=========================================================================================================
+// This is how often (in seconds) a temperature/humidity reading is added to the telemetry log
+//=========================================================================================================
+const int TELEMETRY_INTERVAL = 60;
+//=========================================================================================================
 
 //=========================================================================================================
 // This is used by the 'exeversion' utility to extract our version number from the executable file
@@ -56,6 +63,13 @@ void cpp_main()
     // Initialize the provisioning button
     ProvButton.init(PIN_PROV_BUTTON);
 
+    // If we're running without real I2C devices, put the simulated ones on the bus
+    #if I2C_SIMULATED
+    SimI2C.attach(&SimDisplay);
+    SimI2C.attach(&SimSensor);
+    I2C.attach_hal(&SimI2C);
+    #endif
+
     // Configure the I2C bus.   This must be done before initializing I2C peripherals
     I2C.init(I2C_NUM_0, PIN_I2C_SDA, PIN_I2C_SCL);
 
@@ -63,9 +77,18 @@ void cpp_main()
     Display.init(0x70);
     Display.set_brightness(NVS.data.brightness);
 
+    // Create the timer that drives display animations
+    Animator.init();
+
     // Start the display manager
     DisplayMgr.start();
 
+    // Find the end of the temperature/humidity history
+    if (TelemetryStore.begin()) TelemetryLog.begin(&TelemetryStore);
+
+    // Map the partition that holds our static web content
+    Assets.begin();
+
     // Find out if we should start the Wi-Fi in "Access-Point" mode
     bool start_as_ap = ProvButton.is_pressed()       ||
                        NVS.data.network_ssid[0] == 0 ||
@@ -79,7 +102,7 @@ void cpp_main()
     // connect to the local WiFi network.
     if (start_as_ap)  
     {
-        Display.show_string(" AP ");
+        Display.show_ap_mode();
         Network.start_as_ap(AP_MODE_DEFAULT);
     }
     else
@@ -145,6 +168,18 @@ void periodic_task(void* arg)
 //=========================================================================================================
 void do_periodic()
 {
+    static int seconds;
+
+    // Commit any deferred changes to non-volatile storage that are due
+    NVS.service();
+
+    // Periodically add a temperature/humidity reading to the telemetry log
+    if (++seconds >= TELEMETRY_INTERVAL)
+    {
+        seconds = 0;
+        record_telemetry();
+    }
+
     // If the provisioning button has been down for more than 4 seconds and our network is 
     // in STA mode, re-start the network in wireless-access-point mode
     if (ProvButton.is_pressed_at_least(4000) && Network.wifi_status() != WIFI_AP_MODE)
@@ -156,6 +191,27 @@ void do_periodic()
 
 
 
+//=========================================================================================================
+// record_telemetry() - Reads the temperature and humidity and adds them to the telemetry log
+//=========================================================================================================
+void record_telemetry()
+{
+    float temp;
+    int   rh;
+
+    // Records are kept in timestamp order, so we can't log anything until we know what time it is
+    if (!System.has_current_time || !TelemetryLog.is_ready()) return;
+
+    // Take a reading
+    if (!SHT31.read_c(&temp, &rh)) return;
+
+    // And add it to the log
+    if (TelemetryLog.append((U32)time(nullptr), (S16)(temp * 100), (U8)rh)) Metrics.telemetry_appends.inc();
+}
+//=========================================================================================================
+
+
+
 //=========================================================================================================
 // app_main() - The entry-point from the boot-loader
 //=========================================================================================================
@@ -0,0 +1,20 @@
+//=========================================================================================================
+// metric_samplers.cpp - Implements the samplers that fetch gauge values at render time
+//
+// These are kept apart from metrics.cpp so that the registry depends on nothing but metrics.h, and can
+// be built into the host tests along with the code that updates it
+//=========================================================================================================
+#include <esp_timer.h>
+#include "globals.h"
+
+
+//=========================================================================================================
+// Samplers for the gauges whose values are fetched at render time
+//=========================================================================================================
+S32 sample_rssi()        {return Network.wifi_status() == WIFI_CONNECTED ? System.rssi() : 0;}
+S32 sample_free_heap()   {return (S32)xPortGetFreeHeapSize();}
+S32 sample_uptime()      {return (S32)(esp_timer_get_time() / 1000000);}
+S32 sample_flash_queue() {return FlashIO.queue_depth();}
+S32 sample_i2c_queue()   {return I2C.queue_depth();}
+S32 sample_i2c_speed()   {return (S32)NVRAM.i2c_speed;}
+//=========================================================================================================
@@ -0,0 +1,246 @@
+//=========================================================================================================
+// metrics.cpp - Implements a registry of counters, gauges and histograms in Prometheus text format
+//=========================================================================================================
+#include <stdio.h>
+#include "metrics.h"
+
+// The registry starts out empty.  These are zero-initialized before any constructor runs
+CMetric* CMetric::s_head = nullptr;
+CMetric* CMetric::s_tail = nullptr;
+
+
+//=========================================================================================================
+// Bucket boundaries (in microseconds) for the latency histograms
+//=========================================================================================================
+static const U32 http_bounds [] = {1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000};
+static const U32 flash_bounds[] = {500, 1000, 2500, 5000, 10000, 25000, 50000, 100000};
+static const U32 i2c_bounds  [] = {100, 250, 500, 1000, 2000, 5000, 10000};
+static const U32 link_bounds [] = {2, 5, 10, 20, 50, 100};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// Constructor() - Links this metric onto the end of the registry
+//=========================================================================================================
+CMetric::CMetric(const char* name, const char* help, metric_type_t type)
+{
+    m_name = name;
+    m_help = help;
+    m_type = type;
+    m_next = nullptr;
+
+    // Append this metric to the registry so that metrics render in the order they were declared
+    if (s_tail)
+        s_tail->m_next = this;
+    else
+        s_head = this;
+    s_tail = this;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// render() - Outputs the "# HELP" and "# TYPE" lines, then the sample line(s)
+//=========================================================================================================
+void CMetric::render(metric_emit_t emit, void* context)
+{
+    static const char* type_name[] = {"counter", "gauge", "histogram"};
+    char buffer[160];
+
+    // Compose both lines so they go out as a single piece of output
+    int length = snprintf(buffer, sizeof buffer, "# HELP %s %s\n# TYPE %s %s\n",
+                          m_name, m_help, m_name, type_name[m_type]);
+
+    // If they fit, output them.  Otherwise, output them a piece at a time rather than truncated
+    if (length >= 0 && length < (int)sizeof buffer)
+        emit(buffer, context);
+    else
+    {
+        const char* piece[] = {"# HELP ", m_name, " ", m_help, "\n# TYPE ", m_name, " ", type_name[m_type], "\n"};
+        for (int i=0; i<array_count(piece); ++i) emit(piece[i], context);
+    }
+
+    render_samples(emit, context);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// render_samples() - Outputs the single sample line of a counter
+//=========================================================================================================
+void CCounter::render_samples(metric_emit_t emit, void* context)
+{
+    char buffer[80];
+    snprintf(buffer, sizeof buffer, "%s %u\n", m_name, (unsigned)value());
+    emit(buffer, context);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// render_samples() - Outputs the single sample line of a gauge
+//=========================================================================================================
+void CGauge::render_samples(metric_emit_t emit, void* context)
+{
+    char buffer[80];
+    snprintf(buffer, sizeof buffer, "%s %i\n", m_name, (int)value());
+    emit(buffer, context);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// Constructor() - Saves the bucket boundaries and clears all of the buckets
+//=========================================================================================================
+CHistogram::CHistogram(const char* name, const char* help, const U32* bounds, int bound_count)
+: CMetric(name, help, METRIC_HISTOGRAM)
+{
+    // Any bounds beyond the number of buckets we have room for are ignored
+    if (bound_count > MAX_BUCKETS) bound_count = MAX_BUCKETS;
+
+    m_bounds      = bounds;
+    m_bound_count = bound_count;
+
+    for (int i=0; i<=MAX_BUCKETS; ++i) m_bucket[i] = 0;
+    m_sum = 0;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// observe() - Records a single observation in the first bucket whose upper bound it doesn't exceed
+//=========================================================================================================
+void CHistogram::observe(U32 value)
+{
+    int idx = 0;
+    while (idx < m_bound_count && value > m_bounds[idx]) ++idx;
+
+    m_bucket[idx].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// count() - Returns the total number of observations across all buckets
+//=========================================================================================================
+U32 CHistogram::count()
+{
+    U32 total = 0;
+    for (int i=0; i<=m_bound_count; ++i) total += m_bucket[i].load(std::memory_order_relaxed);
+    return total;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// render_samples() - Outputs the cumulative bucket lines, followed by the sum and count lines
+//=========================================================================================================
+void CHistogram::render_samples(metric_emit_t emit, void* context)
+{
+    char buffer[100];
+    U32  cumulative = 0;
+
+    // Prometheus buckets are cumulative: each one counts every observation <= its upper bound
+    for (int i=0; i<m_bound_count; ++i)
+    {
+        cumulative += m_bucket[i].load(std::memory_order_relaxed);
+        snprintf(buffer, sizeof buffer, "%s_bucket{le=\"%u\"} %u\n", m_name, (unsigned)m_bounds[i], (unsigned)cumulative);
+        emit(buffer, context);
+    }
+
+    // The "+Inf" bucket is the total count.  Computing it from the buckets keeps it consistent with them
+    cumulative += m_bucket[m_bound_count].load(std::memory_order_relaxed);
+    snprintf(buffer, sizeof buffer, "%s_bucket{le=\"+Inf\"} %u\n", m_name, (unsigned)cumulative);
+    emit(buffer, context);
+
+    snprintf(buffer, sizeof buffer, "%s_sum %u\n%s_count %u\n", m_name, (unsigned)sum(), m_name, (unsigned)cumulative);
+    emit(buffer, context);
+}
+//=========================================================================================================
+
+
+
+//=========================================================================================================
+// Constructor() - Declares every metric.  They appear in the output in the order they're listed here
+//=========================================================================================================
+CMetrics::CMetrics() :
+    tcp_connections   ("clock_tcp_connections_total",  "TCP command-server connections accepted"),
+    tcp_commands      ("clock_tcp_commands_total",     "TCP commands handled"),
+
+    http_requests     ("clock_http_requests_total",    "HTTP requests handled"),
+    http_not_found    ("clock_http_not_found_total",   "HTTP requests answered with 404"),
+    http_request_us   ("clock_http_request_us",        "Time spent handling an HTTP request (microseconds)",
+                        http_bounds, array_count(http_bounds)),
+    http_idle_timeouts("clock_http_idle_timeouts_total", "HTTP clients disconnected for never starting a request"),
+    http_rejected_400 ("clock_http_rejected_400_total", "HTTP requests rejected as malformed"),
+    http_rejected_408 ("clock_http_rejected_408_total", "HTTP requests rejected for arriving too slowly"),
+    http_rejected_413 ("clock_http_rejected_413_total", "HTTP requests rejected for having too much content"),
+    http_rejected_431 ("clock_http_rejected_431_total", "HTTP requests rejected for having too much header data"),
+    index_cache_hits  ("clock_index_cache_hits_total", "Index page requests served from the render cache"),
+    index_cache_misses("clock_index_cache_misses_total", "Index page requests that had to re-render the page"),
+    index_render_us   ("clock_index_render_us",        "Time taken by the most recent index page render (microseconds)"),
+    asset_bytes       ("clock_asset_bytes_total",      "Bytes of static assets sent straight from mapped flash"),
+
+    flash_reads       ("clock_flash_reads_total",      "NVS blob reads performed by the flash task"),
+    flash_writes      ("clock_flash_writes_total",     "NVS blob writes performed by the flash task"),
+    flash_errors      ("clock_flash_errors_total",     "NVS operations that returned an error"),
+    flash_op_us       ("clock_flash_op_us",            "Time spent performing an NVS operation (microseconds)",
+                        flash_bounds, array_count(flash_bounds)),
+    flash_queue_wait_us("clock_flash_queue_wait_us",   "Time a request waited in the flash task's queue (microseconds)",
+                        flash_bounds, array_count(flash_bounds)),
+    flash_queue_depth ("clock_flash_queue_depth",      "Requests waiting for the flash task", sample_flash_queue),
+    nvs_commits       ("clock_nvs_commits_total",      "Times the NVS data structure was committed to flash"),
+    nvs_commits_avoided("clock_nvs_commits_avoided_total", "Deferred NVS writes that were coalesced into a pending commit"),
+    nvs_writes_skipped("clock_nvs_writes_skipped_total", "NVS commits skipped because nothing had changed"),
+    nvs_bytes_written ("clock_nvs_bytes_written_total", "Bytes of NVS field data written to flash"),
+    nvs_load_us       ("clock_nvs_load_us",            "Time taken to load the NVS data structure at boot (microseconds)"),
+
+    i2c_transactions  ("clock_i2c_transactions_total", "I2C transactions performed"),
+    i2c_errors        ("clock_i2c_errors_total",       "I2C transactions that failed"),
+    i2c_transaction_us("clock_i2c_transaction_us",     "Time spent performing an I2C transaction (microseconds)",
+                        i2c_bounds, array_count(i2c_bounds)),
+    i2c_setup_us      ("clock_i2c_setup_us",           "Time spent building and freeing I2C command links (microseconds)",
+                        link_bounds, array_count(link_bounds)),
+    i2c_heap_links    ("clock_i2c_heap_links_total",   "I2C command links allocated from the heap"),
+    i2c_queue_wait_us ("clock_i2c_queue_wait_us",      "Time a request waited in the I2C bus task's queue (microseconds)",
+                        i2c_bounds, array_count(i2c_bounds)),
+    i2c_queue_depth   ("clock_i2c_queue_depth",        "Requests waiting for the I2C bus task", sample_i2c_queue),
+    i2c_recoveries    ("clock_i2c_recoveries_total",   "Times a stuck I2C bus was recovered"),
+    i2c_speed_hz      ("clock_i2c_speed_hz",           "Current I2C bus clock speed (Hz)", sample_i2c_speed),
+
+    display_updates   ("clock_display_updates_total",  "Frames sent to the display"),
+    display_bus_bytes ("clock_display_bus_bytes_total", "Bytes sent on the I2C bus to the display"),
+    anim_frames       ("clock_anim_frames_total",      "Animation frames shown"),
+    anim_dropped      ("clock_anim_dropped_total",     "Animation frame-ticks dropped because the display task was busy"),
+    anim_frame_us     ("clock_anim_frame_us",          "Time spent showing an animation frame (microseconds)",
+                        i2c_bounds, array_count(i2c_bounds)),
+
+    wifi_connects     ("clock_wifi_connects_total",    "Times an IP address was obtained from the router"),
+    wifi_disconnects  ("clock_wifi_disconnects_total", "Wi-Fi disconnect events"),
+    wifi_rssi         ("clock_wifi_rssi_dbm",          "Received signal strength of the router (dBm)", sample_rssi),
+
+    sht31_reads       ("clock_sht31_reads_total",      "SHT31 read attempts"),
+    sht31_crc_errors  ("clock_sht31_crc_errors_total", "SHT31 readings discarded due to a bad CRC"),
+    sht31_failures    ("clock_sht31_failures_total",   "SHT31 reads that failed after every retry"),
+    sht31_temp_centi_c("clock_sht31_temperature_centidegrees", "Most recent temperature (hundredths of a degree C)"),
+    sht31_humidity    ("clock_sht31_humidity_percent", "Most recent relative humidity (percent)"),
+
+    telemetry_appends ("clock_telemetry_appends_total", "Readings appended to the telemetry log"),
+    telemetry_erases  ("clock_telemetry_erases_total", "Telemetry log sectors erased"),
+
+    free_heap         ("clock_free_heap_bytes",        "Unallocated heap memory", sample_free_heap),
+    uptime_seconds    ("clock_uptime_seconds",         "Seconds since boot", sample_uptime)
+{
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// render() - Renders every registered metric in Prometheus text format
+//=========================================================================================================
+void CMetrics::render(metric_emit_t emit, void* context)
+{
+    for (CMetric* p = CMetric::first(); p; p = p->next()) p->render(emit, context);
+}
+//=========================================================================================================
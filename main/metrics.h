@@ -0,0 +1,249 @@
+//=========================================================================================================
+// metrics.h - Defines a registry of counters, gauges and histograms that can be rendered in the
+//             Prometheus text exposition format
+//
+// Every metric is a statically constructed object that links itself into a registry at startup, so
+// nothing is ever allocated at run-time.  Updates are lock-free atomics and may be made from any task.
+//=========================================================================================================
+#pragma once
+#include <atomic>
+#include "common.h"
+
+// The kinds of metric that Prometheus understands
+enum metric_type_t {METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM};
+
+// render() hands each chunk of output text to a routine with this signature
+typedef void (*metric_emit_t)(const char* text, void* context);
+
+
+//=========================================================================================================
+// CMetric - The base class of every metric.  Constructing one adds it to the registry
+//=========================================================================================================
+class CMetric
+{
+public:
+
+    // Constructor - Links this metric onto the end of the registry
+    CMetric(const char* name, const char* help, metric_type_t type);
+
+    // Outputs the "# HELP" and "# TYPE" lines, followed by the sample line(s) for this metric
+    void    render(metric_emit_t emit, void* context);
+
+    // Call this to walk the registry
+    static CMetric* first() {return s_head;}
+    CMetric*        next()  {return m_next;}
+
+protected:
+
+    // Derived classes over-ride this to output their sample line(s)
+    virtual void render_samples(metric_emit_t emit, void* context) = 0;
+
+    // The name of the metric, as Prometheus will see it
+    const char*     m_name;
+
+    // A one-line description of the metric
+    const char*     m_help;
+
+    // Counter, gauge, or histogram
+    metric_type_t   m_type;
+
+    // The next metric in the registry
+    CMetric*        m_next;
+
+    // The first and last metrics in the registry
+    static CMetric* s_head;
+    static CMetric* s_tail;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// CCounter - A value that only ever goes up
+//=========================================================================================================
+class CCounter : public CMetric
+{
+public:
+
+    CCounter(const char* name, const char* help) : CMetric(name, help, METRIC_COUNTER) {m_value = 0;}
+
+    // Call this to bump the counter
+    void    inc(U32 amount = 1) {m_value.fetch_add(amount, std::memory_order_relaxed);}
+
+    // Call this to fetch the current value of the counter
+    U32     value() {return m_value.load(std::memory_order_relaxed);}
+
+protected:
+
+    void    render_samples(metric_emit_t emit, void* context);
+
+    std::atomic<U32> m_value;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// CGauge - A value that can go up and down.  If a sampler is supplied, it is called at render time
+//          to fetch the current value and set() is never needed
+//=========================================================================================================
+class CGauge : public CMetric
+{
+public:
+
+    CGauge(const char* name, const char* help, S32 (*sampler)() = nullptr)
+    : CMetric(name, help, METRIC_GAUGE) {m_value = 0; m_sampler = sampler;}
+
+    // Call these to change the value of the gauge
+    void    set(S32 value)  {m_value.store(value, std::memory_order_relaxed);}
+    void    add(S32 amount) {m_value.fetch_add(amount, std::memory_order_relaxed);}
+
+    // Call this to fetch the current value of the gauge
+    S32     value() {return m_sampler ? m_sampler() : m_value.load(std::memory_order_relaxed);}
+
+protected:
+
+    void    render_samples(metric_emit_t emit, void* context);
+
+    std::atomic<S32> m_value;
+
+    S32     (*m_sampler)();
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// CHistogram - Counts observations into fixed buckets.  "bounds" is an ascending list of inclusive
+//              upper bounds.  There is always an implicit "+Inf" bucket after the last bound
+//=========================================================================================================
+class CHistogram : public CMetric
+{
+public:
+
+    enum {MAX_BUCKETS = 12};
+
+    CHistogram(const char* name, const char* help, const U32* bounds, int bound_count);
+
+    // Call this to record an observation
+    void    observe(U32 value);
+
+    // Call this to find the total number of observations
+    U32     count();
+
+    // Call this to find the sum of all observations
+    U32     sum() {return m_sum.load(std::memory_order_relaxed);}
+
+protected:
+
+    void    render_samples(metric_emit_t emit, void* context);
+
+    // The upper bound of each bucket
+    const U32*       m_bounds;
+
+    // The number of entries in m_bounds
+    int              m_bound_count;
+
+    // One counter per bucket, plus one for the "+Inf" bucket.   These are not cumulative
+    std::atomic<U32> m_bucket[MAX_BUCKETS + 1];
+
+    // The sum of every value ever observed
+    std::atomic<U32> m_sum;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// Samplers for the gauges whose values are fetched at render time.  They read the state of other
+// subsystems, so they're defined in metric_samplers.cpp rather than alongside the registry
+//=========================================================================================================
+S32 sample_rssi();
+S32 sample_free_heap();
+S32 sample_uptime();
+S32 sample_flash_queue();
+S32 sample_i2c_queue();
+S32 sample_i2c_speed();
+//=========================================================================================================
+
+
+//=========================================================================================================
+// CMetrics - Singleton class, holds every metric the firmware exposes
+//=========================================================================================================
+class CMetrics
+{
+public:
+
+    CMetrics();
+
+    // Renders every registered metric in Prometheus text format
+    void        render(metric_emit_t emit, void* context);
+
+    // TCP command server
+    CCounter    tcp_connections;
+    CCounter    tcp_commands;
+
+    // HTTP server
+    CCounter    http_requests;
+    CCounter    http_not_found;
+    CHistogram  http_request_us;
+    CCounter    http_idle_timeouts;
+    CCounter    http_rejected_400;
+    CCounter    http_rejected_408;
+    CCounter    http_rejected_413;
+    CCounter    http_rejected_431;
+    CCounter    index_cache_hits;
+    CCounter    index_cache_misses;
+    CGauge      index_render_us;
+    CCounter    asset_bytes;
+
+    // Flash memory I/O
+    CCounter    flash_reads;
+    CCounter    flash_writes;
+    CCounter    flash_errors;
+    CHistogram  flash_op_us;
+    CHistogram  flash_queue_wait_us;
+    CGauge      flash_queue_depth;
+    CCounter    nvs_commits;
+    CCounter    nvs_commits_avoided;
+    CCounter    nvs_writes_skipped;
+    CCounter    nvs_bytes_written;
+    CGauge      nvs_load_us;
+
+    // I2C bus
+    CCounter    i2c_transactions;
+    CCounter    i2c_errors;
+    CHistogram  i2c_transaction_us;
+    CHistogram  i2c_setup_us;
+    CCounter    i2c_heap_links;
+    CHistogram  i2c_queue_wait_us;
+    CGauge      i2c_queue_depth;
+    CCounter    i2c_recoveries;
+    CGauge      i2c_speed_hz;
+
+    // HT16K33 display
+    CCounter    display_updates;
+    CCounter    display_bus_bytes;
+    CCounter    anim_frames;
+    CCounter    anim_dropped;
+    CHistogram  anim_frame_us;
+
+    // Wi-Fi network
+    CCounter    wifi_connects;
+    CCounter    wifi_disconnects;
+    CGauge      wifi_rssi;
+
+    // SHT31 temperature/humidity sensor
+    CCounter    sht31_reads;
+    CCounter    sht31_crc_errors;
+    CCounter    sht31_failures;
+    CGauge      sht31_temp_centi_c;
+    CGauge      sht31_humidity;
+
+    // Telemetry log
+    CCounter    telemetry_appends;
+    CCounter    telemetry_erases;
+
+    // General system health
+    CGauge      free_heap;
+    CGauge      uptime_seconds;
+};
+//=========================================================================================================
+
+extern CMetrics Metrics;
@@ -149,6 +149,9 @@ void CSystem::reboot(bool force_wifi_ap)
     // Tell the world that we're rebooting
     is_rebooting = true;
 
+    // Make sure that any deferred changes to non-volatile storage make it to flash
+    NVS.sync();
+
     // If the caller wants to start in Wi-Fi AP mode, make it so
     if (force_wifi_ap) NVRAM.start_wifi_ap = true;
 
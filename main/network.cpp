@@ -201,6 +201,9 @@ void CNetwork::event_handler(esp_event_base_t event_base, int32_t event_id, void
         // We now have zero consecutive failed connection attempts
         failed_connection_attempts = 0;
 
+        // Keep track of how many times we've connected
+        Metrics.wifi_connects.inc();
+
         // Save our IP address for posterity
         got_ip_event = (ip_event_got_ip_t*) event_data;
         strcpy(System.ip_addr, ip4addr_ntoa((const ip4_addr_t*)&got_ip_event->ip_info.ip));
@@ -255,6 +258,9 @@ void CNetwork::event_handler(esp_event_base_t event_base, int32_t event_id, void
         // Log the reason that we got disconnected (potentially during our connection attempt)   
         printf(">>> SYSTEM_EVENT_STA_DISCONNECTED: %i\n", disconnect_reason);
 
+        // Keep track of how many times we've been disconnected
+        Metrics.wifi_disconnects.inc();
+
         // Stop the servers
         TCPServer.stop();
 
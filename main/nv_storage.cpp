@@ -2,34 +2,191 @@
 // nv_storage.cpp - Implements an interface to non-volatile storage in flash memory
 //=========================================================================================================
 #include <nvs_flash.h>
+#include <esp_timer.h>
 #include "esp_log.h"
 #include "nv_storage.h"
 #include "common.h"
 #include "globals.h"
 
-// This is the key-name (within the namespace) that the IDF NVS system stores our data structure under
-static const char* KEY_NAME = "data";
+// Before each field had its own key, the entire data structure was stored as a single blob under this key
+static const char* LEGACY_KEY = "data";
 
 // If this value is in the "data_present" field, we know our structure contains data
 const U32 DATA_PRESENT_MARKER = 0xDEEDBAAF;
 
+// A write_behind() is committed once "data" has gone this long without another change...
+const S64 QUIET_PERIOD_US = 2000000;
+
+// ...or once the oldest uncommitted change is this old, whichever comes first
+const S64 MAX_DELAY_US = 10000000;
+
+// Changes to "data" are tracked in chunks of this many bytes, one bit per chunk
+const int CHUNK_SIZE = sizeof(nvsdata_t) / 32;
+
 //=========================================================================================================
-// This should be incremented any time a field gets added to the nvsdata_t structure
+// This should be incremented any time the stored format of our data changes.  Every increment needs
+// a step in migration_chain[] that upgrades the prior version
 //=========================================================================================================
-const int CURRENT_STRUCT_VERSION = 1;
+const int CURRENT_STRUCT_VERSION = 2;
 //--------------------------------------------------------------------------------------------------------
 // Ver  FW_REV  Description
 //--------------------------------------------------------------------------------------------------------
-//   1   1000   Initial creation
+//   1   1000   Initial creation.  The entire nvsdata_t was stored as a single blob under LEGACY_KEY
+//   2   1000   Each field stored under its own NVS key, as described by field_table[]
 //--------------------------------------------------------------------------------------------------------
 //=========================================================================================================
 
 
+//=========================================================================================================
+// field_table[] - Every field of nvsdata_t that gets stored in flash, and the NVS key it's stored under.
+//                 NVS keys are limited to 15 characters.  String fields are stored without their unused
+//                 trailing bytes
+//=========================================================================================================
+struct nvs_field_t {const char* key; U16 offset; U16 size; bool is_string;};
+
+#define NVS_FIELD(key, member, is_string) {key, offsetof(nvsdata_t, member), sizeof(nvsdata_t::member), is_string}
+
+static constexpr nvs_field_t field_table[] =
+{
+    NVS_FIELD("version",    struct_version, false),
+    NVS_FIELD("ssid",       network_ssid,   true ),
+    NVS_FIELD("netpw",      network_pw,     true ),
+    NVS_FIELD("netuser",    network_user,   true ),
+    NVS_FIELD("timezone",   timezone,       true ),
+    NVS_FIELD("brightness", brightness,     false)
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// v1_layout[] - Where each field lives in a version 1 blob.  These values describe data that already
+//               exists on devices in the field, and must never change
+//=========================================================================================================
+struct blob_field_t {U16 offset; U16 size;};
+
+enum {V1_CRC, V1_PRESENT_FLAG, V1_STRUCT_VERSION, V1_NETWORK_SSID, V1_NETWORK_PW, V1_NETWORK_USER,
+      V1_TIMEZONE, V1_BRIGHTNESS, V1_FIELD_COUNT};
+
+static constexpr blob_field_t v1_layout[V1_FIELD_COUNT] =
+{
+    {  0,   4},     // crc
+    {  4,   4},     // present_flag
+    {  8,   2},     // struct_version
+    { 10,  32},     // network_ssid
+    { 42, 128},     // network_pw
+    {170,  64},     // network_user
+    {234,  60},     // timezone
+    {294,   1}      // brightness
+};
+
+// The size of a version 1 blob
+const int V1_BLOB_SIZE = 1024;
+//=========================================================================================================
+
+
+//=========================================================================================================
+// Compile-time checks of the tables above.  If one of these fails, the layout of nvsdata_t has changed
+// in a way that would lose or corrupt stored data
+//=========================================================================================================
+constexpr int key_length(const char* key) {return *key ? 1 + key_length(key + 1) : 0;}
+
+// These checks are written as single return statements so that they're constexpr under C++11, which is
+// what the toolchain compiles with
+
+// Fields must be in ascending order, must not overlap, and must lie within nvsdata_t
+template <class T> constexpr bool is_valid_layout(const T* table, int count, int total_size)
+{
+    return (count == 0) ? true
+         : table[0].offset + table[0].size <= total_size
+           && (count == 1 || table[1].offset >= table[0].offset + table[0].size)
+           && is_valid_layout(table + 1, count - 1, total_size);
+}
+
+// Every NVS key must fit within the NVS key-length limit
+constexpr bool are_valid_keys(const nvs_field_t* table, int count)
+{
+    return (count == 0) ? true : key_length(table[0].key) <= 15 && are_valid_keys(table + 1, count - 1);
+}
+
+static_assert(is_valid_layout(field_table, array_count(field_table), sizeof(nvsdata_t)), "field_table[] is invalid");
+static_assert(are_valid_keys(field_table, array_count(field_table)), "field_table[] has a key that is too long");
+static_assert(is_valid_layout(v1_layout, V1_FIELD_COUNT, V1_BLOB_SIZE), "v1_layout[] is invalid");
+static_assert(sizeof(nvsdata_t) == V1_BLOB_SIZE, "nvsdata_t must be 1024 bytes");
+
+// A field can grow from one version to the next, but never shrink
+#define V1_FITS(member, idx) (sizeof(nvsdata_t::member) >= v1_layout[idx].size)
+static_assert(V1_FITS(struct_version, V1_STRUCT_VERSION), "struct_version shrank since version 1");
+static_assert(V1_FITS(network_ssid,   V1_NETWORK_SSID  ), "network_ssid shrank since version 1");
+static_assert(V1_FITS(network_pw,     V1_NETWORK_PW    ), "network_pw shrank since version 1");
+static_assert(V1_FITS(network_user,   V1_NETWORK_USER  ), "network_user shrank since version 1");
+static_assert(V1_FITS(timezone,       V1_TIMEZONE      ), "timezone shrank since version 1");
+static_assert(V1_FITS(brightness,     V1_BRIGHTNESS    ), "brightness shrank since version 1");
+//=========================================================================================================
+
+
+//=========================================================================================================
+// migrate_v1_to_v2() - Copies each field out of a version 1 blob
+//=========================================================================================================
+static bool migrate_v1_to_v2(nvsdata_t* data, const U8* blob)
+{
+    U32 present_flag;
+
+    // We can't migrate a blob that doesn't exist
+    if (blob == nullptr) return false;
+
+    // Make sure the blob actually contains data
+    memcpy(&present_flag, blob + v1_layout[V1_PRESENT_FLAG].offset, sizeof present_flag);
+    if (present_flag != DATA_PRESENT_MARKER) return false;
+
+    // Copy each field from where it lived in the blob
+    #define V1_COPY(member, idx) memcpy(&data->member, blob + v1_layout[idx].offset, v1_layout[idx].size)
+    V1_COPY(network_ssid, V1_NETWORK_SSID);
+    V1_COPY(network_pw,   V1_NETWORK_PW  );
+    V1_COPY(network_user, V1_NETWORK_USER);
+    V1_COPY(timezone,     V1_TIMEZONE    );
+    V1_COPY(brightness,   V1_BRIGHTNESS  );
+    #undef V1_COPY
+
+    // The data structure now contains valid data
+    data->present_flag = DATA_PRESENT_MARKER;
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// migration_chain[] - Step 'n' upgrades data from version n+1 to version n+2.  "blob" is the legacy
+//                     blob, if one was found.  A step returns false if it can't perform the upgrade
+//=========================================================================================================
+struct migration_t {int from_version; bool (*upgrade)(nvsdata_t* data, const U8* blob);};
+
+static constexpr migration_t migration_chain[] =
+{
+    {1, migrate_v1_to_v2}
+};
+
+// There must be exactly one step for every version prior to the current one, in order
+constexpr bool is_valid_chain(int i = 0)
+{
+    return (i == array_count(migration_chain)) ? array_count(migration_chain) == CURRENT_STRUCT_VERSION - 1
+         : migration_chain[i].from_version == i + 1 && is_valid_chain(i + 1);
+}
+static_assert(is_valid_chain(), "migration_chain[] doesn't match CURRENT_STRUCT_VERSION");
+//=========================================================================================================
+
+
+// A legacy blob is read into here.  It's too big to comfortably put on the stack
+static U8 legacy_blob[V1_BLOB_SIZE];
+
+
 //=========================================================================================================
 // init() - Called once at startup to gain access too nvs in flash
 //=========================================================================================================
 void CNVS::init()
 {
+    // This mutex serializes commits and access to the write-behind state
+    m_mutex = xSemaphoreCreateMutex();
+
     // Initialize non-volatile storage in flash memory
     int status = nvs_flash_init();
     
@@ -51,17 +208,124 @@ void CNVS::init()
 
 //=========================================================================================================
 // read_from_flash() - Reads the structure that holds our NV data into RAM
+//
+// If the data in flash is from an older version, it is upgraded by the migration chain and stored in
+// the current format.  Older data is never removed until its replacement has been written successfully
 //=========================================================================================================
 void CNVS::read_from_flash()
 {
+    // Keep track of how long it takes to load our data
+    S64 start_time = esp_timer_get_time();
+
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+
     // Just for safety, clear out the existing data structure
     memset(&data, 0, sizeof data);
 
-    // Read in our NVS data structure from flash 
-    FlashIO.read(KEY_NAME, (char*)&data);
+    // If the data structure was stored as a single blob by older firmware, it's version 1
+    bool is_legacy = FlashIO.read(LEGACY_KEY, (char*)legacy_blob, sizeof legacy_blob) == ESP_OK;
+
+    // Old firmware ignored a blob that didn't contain the "data present" marker, and so do we
+    if (is_legacy)
+    {
+        U32 present_flag;
+        memcpy(&present_flag, legacy_blob + v1_layout[V1_PRESENT_FLAG].offset, sizeof present_flag);
+        is_legacy = (present_flag == DATA_PRESENT_MARKER);
+    }
+
+    int version = is_legacy ? 1 : 0;
+
+    // Otherwise, read in each field from its own key.  A brand new device will have no version
+    if (!is_legacy)
+    {
+        load_fields();
+        version = data.struct_version;
+    }
+
+    // This is what is now stored in flash (in the current format)
+    memcpy(&m_flash_image, &data, sizeof data);
+    m_flash_crc = compute_crc(&m_flash_image);
+
+    // If the data is from an older version, upgrade it
+    bool is_migrated = false;
+    if (version && version < CURRENT_STRUCT_VERSION)
+    {
+        is_migrated = migrate(version, is_legacy ? legacy_blob : nullptr);
+    }
 
     // Initialize any uninitialized fields in our data structure
     init_default_data();
+
+    // Anything we had waiting to be committed has been discarded
+    m_is_dirty = false;
+
+    // If we migrated the data, store it in the current format.  Once that has succeeded, we can get rid
+    // of the legacy blob
+    if (is_migrated)
+    {
+        commit(true);
+        if (is_legacy && !m_is_dirty) FlashIO.erase(LEGACY_KEY);
+    }
+
+    xSemaphoreGive(m_mutex);
+
+    // Tell the engineer how long that took
+    U32 elapsed_us = (U32)(esp_timer_get_time() - start_time);
+    printf("NVS data loaded in %u us\n", (unsigned)elapsed_us);
+    Metrics.nvs_load_us.set(elapsed_us);
+
+    // Anything derived from the old contents of "data" is now stale
+    ++m_generation;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// migrate() - Runs the migration chain to upgrade "data" from the specified version to the current one
+//
+// Returns: true if the data was upgraded.  If any step fails, "data" is restored to what was read from
+//          flash so that nothing half-migrated gets used or stored
+//=========================================================================================================
+bool CNVS::migrate(int version, const U8* blob)
+{
+    S64 start_time = esp_timer_get_time();
+    int from_version = version;
+
+    // Run each step of the chain, starting with the one that upgrades the version we have
+    while (version < CURRENT_STRUCT_VERSION)
+    {
+        const migration_t& step = migration_chain[version - 1];
+        if (!step.upgrade(&data, blob))
+        {
+            printf("*** NVS migration from version %i failed!!\n", version);
+            memcpy(&data, &m_flash_image, sizeof data);
+            return false;
+        }
+        ++version;
+    }
+
+    // Tell the engineer how long it took
+    U32 elapsed_us = (U32)(esp_timer_get_time() - start_time);
+    printf("NVS migrated from version %i to %i in %u us\n", from_version, version, (unsigned)elapsed_us);
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// load_fields() - Reads each field of "data" from its own NVS key.  Fields that don't exist in flash
+//                 are left as zeros
+//=========================================================================================================
+void CNVS::load_fields()
+{
+    for (int i=0; i<array_count(field_table); ++i)
+    {
+        const nvs_field_t& field = field_table[i];
+        FlashIO.read(field.key, (char*)&data + field.offset, field.size);
+    }
+
+    // "data" now contains valid data
+    data.present_flag = DATA_PRESENT_MARKER;
 }
 //=========================================================================================================
 
@@ -80,16 +344,8 @@ void CNVS::init_default_data()
     }
 
 
-    //------------------------------------------------------------------------------------------------
-    // TODO: As the data structure grows due to new fields being added, there should be a series of
-    // initializers here that look like:
-    //
-    //    if (data.struct_version < SOME_CONSTANT)
-    //    {
-    //        ... initialize fields that were first added at structure version SOME_CONSTANT
-    //    }
-    //
-    //-----------------------------------------------------------------------------------------------
+    // Fields added in a new version get their initial values from that version's step in
+    // migration_chain[]
 
     // Indicate that the data structure is of the most recent format
     data.struct_version = CURRENT_STRUCT_VERSION;
@@ -98,18 +354,228 @@ void CNVS::init_default_data()
 
 
 
+//=========================================================================================================
+// compute_crc() - Computes the CRC of an image of our data structure and stores it in the image
+//
+// Returns: The CRC
+//=========================================================================================================
+U32 CNVS::compute_crc(nvsdata_t* image)
+{
+    image->crc = 0;
+    image->crc = crc32(image, sizeof(nvsdata_t));
+    return image->crc;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// find_dirty_chunks() - Finds out which parts of "data" differ from what is stored in flash.  Caller must
+//                       hold m_mutex
+//
+// Returns: A bitmap with bit 'n' set if bytes n*CHUNK_SIZE thru (n+1)*CHUNK_SIZE-1 have changed
+//=========================================================================================================
+U32 CNVS::find_dirty_chunks()
+{
+    U8  chunk[CHUNK_SIZE];
+    U32 dirty_chunks = 0;
+
+    // The CRC field isn't part of what gets stored, so it doesn't count as a change
+    const int crc_start = offsetof(nvsdata_t, crc);
+    const int crc_end   = crc_start + sizeof(data.crc);
+
+    // Compare each chunk of "data" to what's in flash
+    for (int i=0; i<32; ++i)
+    {
+        int offset = i * CHUNK_SIZE;
+
+        // Fetch this chunk of "data", with any part of the CRC field in it taken from the flash image
+        memcpy(chunk, (char*)&data + offset, CHUNK_SIZE);
+        for (int n = crc_start; n < crc_end; ++n)
+        {
+            if (n >= offset && n < offset + CHUNK_SIZE) chunk[n - offset] = ((U8*)&m_flash_image)[n];
+        }
+
+        // And compare it to what's in flash
+        if (memcmp(chunk, (char*)&m_flash_image + offset, CHUNK_SIZE) != 0)
+        {
+            dirty_chunks |= (1 << i);
+        }
+    }
+
+    return dirty_chunks;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// dirty_chunks() - Returns a bitmap of which chunks of "data" differ from what is stored in flash
+//=========================================================================================================
+U32 CNVS::dirty_chunks()
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    U32 result = find_dirty_chunks();
+    xSemaphoreGive(m_mutex);
+    return result;
+}
+//=========================================================================================================
+
+
+
+
+//=========================================================================================================
+// commit() - Writes each field of "data" that differs from what's in flash to its own NVS key.  Caller
+//            must hold m_mutex
+//
+// If the CRC of "data" matches the CRC of what was last committed, nothing has changed and nothing
+// is written.  Otherwise, only the fields that overlap a changed chunk are compared and written.
+//
+// Passed: write_all = true to write every field, whether it has changed or not
+//=========================================================================================================
+void CNVS::commit(bool write_all)
+{
+    // If nothing has changed since the last commit, there's nothing to do
+    U32 crc = compute_crc(&data);
+    if (!write_all && crc == m_flash_crc)
+    {
+        printf("NVS data is unchanged, write skipped\n");
+        Metrics.nvs_writes_skipped.inc();
+        m_is_dirty = false;
+        return;
+    }
+
+    // This will be false if any field fails to write
+    bool is_ok = true;
+
+    // Find out which parts of the data structure have changed
+    U32 dirty_chunks = write_all ? 0xFFFFFFFF : find_dirty_chunks();
+
+    for (int i=0; i<array_count(field_table); ++i)
+    {
+        const nvs_field_t& field = field_table[i];
+        char* value = (char*)&data + field.offset;
+        char* image = (char*)&m_flash_image + field.offset;
+
+        // Build a mask of the chunks this field occupies
+        int first_chunk = field.offset / CHUNK_SIZE;
+        int last_chunk  = (field.offset + field.size - 1) / CHUNK_SIZE;
+        U32 field_mask  = (0xFFFFFFFF >> (31 - last_chunk)) & (0xFFFFFFFF << first_chunk);
+
+        // If this field hasn't changed, there's no need to write it
+        if ((dirty_chunks & field_mask) == 0) continue;
+        if (!write_all && memcmp(value, image, field.size) == 0) continue;
+
+        // Strings are stored without their unused trailing bytes
+        size_t length = field.size;
+        if (field.is_string)
+        {
+            length = strnlen(value, field.size) + 1;
+            if (length > field.size) length = field.size;
+        }
+
+        // Write this field to flash.  If that fails, we'll try again at the next commit
+        if (FlashIO.write(field.key, value, length) != ESP_OK)
+        {
+            is_ok = false;
+            continue;
+        }
+
+        // Keep track of how much we've written
+        Metrics.nvs_bytes_written.inc(length);
+
+        // And keep track of what's in flash
+        memcpy(image, value, field.size);
+    }
+
+    // If any field failed to write, flash doesn't match "data" yet
+    if (!is_ok)
+    {
+        m_is_dirty = true;
+        return;
+    }
+
+    // Remember the CRC of what's now in flash
+    m_flash_crc = crc;
+
+    // Flash now matches "data"
+    Metrics.nvs_commits.inc();
+    m_is_dirty = false;
+}
+//=========================================================================================================
+
+
 //=========================================================================================================
 // write_to_flash() - Writes the RAM structure that holds our NV data into flash memory
 //=========================================================================================================
 void CNVS::write_to_flash()
 {
-    // Compute a new CRC for the data
-    data.crc = 0;
-    data.crc = crc32(&data, sizeof data);
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    commit();
+    xSemaphoreGive(m_mutex);
 
-    // And write our NVS structure to flash memory
-    FlashIO.write(KEY_NAME, (char*)&data, sizeof data);
+    // Anything derived from the old contents of "data" is now stale
+    ++m_generation;
 }
 //=========================================================================================================
 
 
+//=========================================================================================================
+// write_behind() - Marks "data" as changed, and defers committing it to flash
+//
+// service() commits the change once "data" has been left alone for QUIET_PERIOD_US, or once the
+// oldest uncommitted change is MAX_DELAY_US old
+//=========================================================================================================
+void CNVS::write_behind()
+{
+    S64 now = esp_timer_get_time();
+
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+
+    // If there was already a change waiting to be committed, this one rides along with it
+    if (m_is_dirty)
+        Metrics.nvs_commits_avoided.inc();
+    else
+        m_first_dirty_time = now;
+
+    // Restart the quiet period
+    m_last_dirty_time = now;
+    m_is_dirty = true;
+
+    xSemaphoreGive(m_mutex);
+
+    // Anything derived from the old contents of "data" is now stale
+    ++m_generation;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// sync() - Commits any changes deferred by write_behind() right now
+//=========================================================================================================
+void CNVS::sync()
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    if (m_is_dirty) commit();
+    xSemaphoreGive(m_mutex);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// service() - Commits deferred changes whose quiet period or maximum delay has expired
+//=========================================================================================================
+void CNVS::service()
+{
+    S64 now = esp_timer_get_time();
+
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+
+    // Is it time to commit the pending changes?
+    if (m_is_dirty)
+    {
+        if (now - m_last_dirty_time  >= QUIET_PERIOD_US ||
+            now - m_first_dirty_time >= MAX_DELAY_US) commit();
+    }
+
+    xSemaphoreGive(m_mutex);
+}
+//=========================================================================================================
@@ -18,16 +18,67 @@ public:
     // Read our data structure from flash memory
     void        read_from_flash();
 
-    // Write our data structure to flash memory
+    // Write our data structure to flash memory right now
     void        write_to_flash();
 
+    // Call this after changing "data" when durability can wait.  The write is deferred until "data"
+    // has been left alone for a moment, so that a burst of changes results in a single commit
+    void        write_behind();
+
+    // Commits any changes deferred by write_behind() right now
+    void        sync();
+
+    // Returns a bitmap of which 32-byte chunks of "data" differ from what's stored in flash
+    U32         dirty_chunks();
+
+    // Called once a second.  Commits deferred changes whose quiet period or maximum delay has expired
+    void        service();
+
     // This structure contains the actual data fields that we read/write to/from NVS
     nvsdata_t   data;
 
+    // This changes every time "data" is read from or written to flash.  Anything derived from "data"
+    // (a rendered web page, for instance) is stale if this has changed since it was derived
+    U32         generation() {return m_generation;}
+
 protected:
 
+    // Bumped by read_from_flash(), write_to_flash(), and write_behind()
+    volatile U32 m_generation;
+
     // This initializes our "data" structure to default values
     void        init_default_data();
 
+    // Reads each field of "data" from its own NVS key
+    void        load_fields();
+
+    // Upgrades "data" from an older version to the current one
+    bool        migrate(int version, const U8* blob);
+
+    // Returns a bitmap of which 32-byte chunks of "data" differ from m_flash_image.  Caller must hold
+    // m_mutex
+    U32         find_dirty_chunks();
+
+    // Writes the fields of "data" that have changed to flash.  Caller must hold m_mutex
+    void        commit(bool write_all = false);
+
+    // Computes the CRC of an image of "data" and stores it in the image's "crc" field
+    U32         compute_crc(nvsdata_t* image);
+
+    // A copy of what's currently stored in flash, used to find out which fields have changed
+    nvsdata_t   m_flash_image;
+
+    // The CRC of m_flash_image.  If "data" has the same CRC, there's nothing to commit
+    U32         m_flash_crc;
+
+    // Serializes access to the write-behind state and to commits
+    SemaphoreHandle_t m_mutex;
+
+    // True when "data" has changes that haven't been committed to flash yet
+    bool        m_is_dirty;
+
+    // The times (in microseconds since boot) of the first and most recent uncommitted changes
+    S64         m_first_dirty_time, m_last_dirty_time;
+
 };
 //=========================================================================================================
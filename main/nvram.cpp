@@ -5,8 +5,9 @@
 #include <string.h>
 #include "common.h"
 
-// We will look for this string in NVRAM to determine whether we have data there
-#define MAGIC_KEY "**nvram**"
+// We will look for this string in NVRAM to determine whether we have data there.  Change it whenever
+// the layout of CNVRAM changes, so that a warm reboot into new firmware doesn't use stale data
+#define MAGIC_KEY "**nvram2**"
 
 //=========================================================================================================
 // Constructor() - Initializes our data, but only on the first boot after power-up
@@ -21,6 +22,12 @@ CNVRAM::CNVRAM()
 
     // We aren't going to force Wi-Fi to start in access-point mode
     start_wifi_ap = false;
+
+    // The I2C bus hasn't chosen a clock speed or seen any errors yet
+    i2c_speed         = 0;
+    i2c_window_count  = 0;
+    i2c_window_errors = 0;
+    i2c_recoveries    = 0;
 }
 //=========================================================================================================
 
@@ -2,6 +2,7 @@
 // nvram.h - Defines a structure in RAM that survives reboots
 //=========================================================================================================
 #pragma once
+#include "common.h"
 
 
 class CNVRAM
@@ -14,6 +15,16 @@ public:
     // This will be true if Wi-Fi should start in access-point mode
     bool    start_wifi_ap;
 
+    // The I2C bus clock speed that CI2C has settled on, or 0 if it hasn't chosen one yet
+    U32     i2c_speed;
+
+    // The I2C transactions performed and the ones that failed in the current evaluation window
+    U16     i2c_window_count;
+    U16     i2c_window_errors;
+
+    // The number of times a stuck I2C bus has been recovered since power-up
+    U32     i2c_recoveries;
+
 protected:
 
     // This will contain a "magic string" if this object has already been initialized
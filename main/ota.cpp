@@ -0,0 +1,181 @@
+//=========================================================================================================
+// ota.cpp - Implements an interface for writing a new firmware image into the inactive OTA partition
+//=========================================================================================================
+#include <esp_timer.h>
+#include <esp_idf_version.h>
+#include "ota.h"
+#include "globals.h"
+
+static const char* TAG = "ota";
+
+
+//=========================================================================================================
+// The routines below are the jobs that CFlashIO runs for us.  Every write to (and erase of) the OTA
+// partition happens in the flash task, just like writes to NVS
+//=========================================================================================================
+
+// Erases enough of the partition to hold the image
+esp_err_t COTAUpdate::begin_job(void* argument)
+{
+    COTAUpdate* p = (COTAUpdate*) argument;
+    return esp_ota_begin(p->m_partition, p->m_image_size, &p->m_handle);
+}
+
+// Writes the chunk that write() was handed
+esp_err_t COTAUpdate::write_job(void* argument)
+{
+    COTAUpdate* p = (COTAUpdate*) argument;
+    return esp_ota_write(p->m_handle, p->m_chunk, p->m_chunk_length);
+}
+
+// Validates the image
+esp_err_t COTAUpdate::end_job(void* argument)
+{
+    COTAUpdate* p = (COTAUpdate*) argument;
+    return esp_ota_end(p->m_handle);
+}
+
+// Makes the new image the boot partition
+esp_err_t COTAUpdate::set_boot_job(void* argument)
+{
+    COTAUpdate* p = (COTAUpdate*) argument;
+    return esp_ota_set_boot_partition(p->m_partition);
+}
+
+// Releases the handle of an update that is being discarded.  esp_ota_abort() first appeared in
+// ESP-IDF 4.3.  Before that, esp_ota_end() is the only way to release the handle (it also validates
+// whatever was written, and we ignore the result)
+esp_err_t COTAUpdate::abort_job(void* argument)
+{
+    COTAUpdate* p = (COTAUpdate*) argument;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
+    return esp_ota_abort(p->m_handle);
+#else
+    esp_ota_end(p->m_handle);
+    return ESP_OK;
+#endif
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// fail() - Records the reason for a failure and abandons the update
+//=========================================================================================================
+bool COTAUpdate::fail(const char* reason, esp_err_t status)
+{
+    ESP_LOGE(TAG, "%s (%s)", reason, esp_err_to_name(status));
+    m_error = reason;
+    abort();
+    return false;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// begin() - Prepares the inactive OTA partition to receive an image of the specified size
+//
+// Only the space the image needs is erased, and the flash driver yields to other tasks during the
+// erase, so the display keeps running while this happens
+//=========================================================================================================
+bool COTAUpdate::begin(size_t image_size)
+{
+    // If there's an update already in progress, throw it away
+    abort();
+
+    // Clear the statistics from any prior update
+    m_bytes_written = 0;
+    m_elapsed_ms    = 0;
+    m_image_size    = image_size;
+    m_error         = "";
+
+    // Find the OTA slot that we aren't currently running from
+    m_partition = esp_ota_get_next_update_partition(nullptr);
+    if (m_partition == nullptr) return fail("No OTA partition available", ESP_ERR_NOT_FOUND);
+
+    // Make sure the image will fit
+    if (image_size == 0 || image_size > m_partition->size) return fail("Image size invalid", ESP_ERR_INVALID_SIZE);
+
+    ESP_LOGI(TAG, "Writing %u byte image to partition \"%s\"", (unsigned)image_size, m_partition->label);
+
+    // Start the clock
+    m_start_time = esp_timer_get_time();
+
+    // Erase enough of the partition to hold the image
+    esp_err_t status = FlashIO.call("ota_begin", begin_job, this);
+    if (status != ESP_OK) return fail("esp_ota_begin() failed", status);
+
+    // We have an update in progress
+    m_is_open = true;
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// write() - Appends a chunk of the image to the OTA partition
+//=========================================================================================================
+bool COTAUpdate::write(const void* data, int length)
+{
+    // If there's no update in progress, complain
+    if (!m_is_open) return fail("No update in progress", ESP_ERR_INVALID_STATE);
+
+    // Don't allow the caller to write more than they said they would
+    if (m_bytes_written + length > m_image_size) return fail("Image larger than expected", ESP_ERR_INVALID_SIZE);
+
+    // Write this chunk to flash
+    m_chunk        = data;
+    m_chunk_length = length;
+    esp_err_t status = FlashIO.call("ota_write", write_job, this);
+    if (status != ESP_OK) return fail("esp_ota_write() failed", status);
+
+    // Keep track of how much we've written
+    m_bytes_written += length;
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// finish() - Validates the image and, if it's good, makes it the boot partition
+//=========================================================================================================
+bool COTAUpdate::finish()
+{
+    // If there's no update in progress, complain
+    if (!m_is_open) return fail("No update in progress", ESP_ERR_INVALID_STATE);
+
+    // If we didn't receive the whole image, don't bother validating it
+    if (m_bytes_written != m_image_size) return fail("Image incomplete", ESP_ERR_INVALID_SIZE);
+
+    // esp_ota_end() checks the image header, segments, and checksum/hash
+    m_is_open = false;
+    esp_err_t status = FlashIO.call("ota_end", end_job, this);
+    if (status == ESP_ERR_OTA_VALIDATE_FAILED) return fail("Image failed validation", status);
+    if (status != ESP_OK) return fail("esp_ota_end() failed", status);
+
+    // The image is good.  Boot from it next time
+    status = FlashIO.call("ota_set_boot", set_boot_job, this);
+    if (status != ESP_OK) return fail("esp_ota_set_boot_partition() failed", status);
+
+    // Stop the clock
+    m_elapsed_ms = (U32)((esp_timer_get_time() - m_start_time) / 1000);
+
+    // Tell the engineer how it went
+    ESP_LOGI(TAG, "Wrote %u bytes in %u ms (%u KB/s)",
+             (unsigned)m_bytes_written, (unsigned)m_elapsed_ms, (unsigned)kb_per_sec());
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// abort() - Discards any update that is in progress.  The boot partition is left unchanged
+//=========================================================================================================
+void COTAUpdate::abort()
+{
+    if (m_is_open)
+    {
+        FlashIO.call("ota_abort", abort_job, this);
+        m_is_open = false;
+    }
+}
+//=========================================================================================================
@@ -0,0 +1,82 @@
+//=========================================================================================================
+// ota.h - Defines an interface for writing a new firmware image into the inactive OTA partition
+//=========================================================================================================
+#pragma once
+#include <esp_ota_ops.h>
+#include "common.h"
+
+
+//=========================================================================================================
+// COTAUpdate - Streams a firmware image into the inactive OTA slot, one chunk at a time
+//
+// Usage: begin(), then write() as many times as necessary, then finish().   The boot partition is
+// switched to the new image only if every step succeeds and the image validates.
+//=========================================================================================================
+class COTAUpdate
+{
+public:
+
+    // Constructor
+    COTAUpdate() {m_is_open = false; m_error = "";}
+
+    // Call this to prepare the inactive OTA partition for an image of the specified size
+    bool        begin(size_t image_size);
+
+    // Call this to append a chunk of the image
+    bool        write(const void* data, int length);
+
+    // Call this to validate the image and make it the boot partition
+    bool        finish();
+
+    // Call this to discard an update that is in progress
+    void        abort();
+
+    // If any of the routines above returned 'false', this describes why
+    const char* error() {return m_error;}
+
+    // Statistics about the most recent update
+    U32         bytes_written() {return m_bytes_written;}
+    U32         elapsed_ms()    {return m_elapsed_ms;}
+    U32         kb_per_sec()    {return m_elapsed_ms ? m_bytes_written / m_elapsed_ms : 0;}
+
+protected:
+
+    // Records the reason for a failure, and tells the caller that we failed
+    bool        fail(const char* reason, esp_err_t status);
+
+    // The ESP-IDF OTA calls that touch flash.  These are run in the flash task by CFlashIO
+    static esp_err_t begin_job(void* argument);
+    static esp_err_t write_job(void* argument);
+    static esp_err_t end_job(void* argument);
+    static esp_err_t set_boot_job(void* argument);
+    static esp_err_t abort_job(void* argument);
+
+    // This is the handle that the ESP-IDF OTA API gives us
+    esp_ota_handle_t        m_handle;
+
+    // This is the partition the new image is being written to
+    const esp_partition_t*  m_partition;
+
+    // This will be true between begin() and finish()/abort()
+    bool        m_is_open;
+
+    // The size of the image that begin() was told to expect
+    U32         m_image_size;
+
+    // The number of bytes written so far
+    U32         m_bytes_written;
+
+    // The chunk that write() is in the middle of writing
+    const void* m_chunk;
+    int         m_chunk_length;
+
+    // The time (in microseconds since boot) that begin() was called
+    S64         m_start_time;
+
+    // The number of milliseconds between begin() and finish()
+    U32         m_elapsed_ms;
+
+    // A description of the most recent failure
+    const char* m_error;
+};
+//=========================================================================================================
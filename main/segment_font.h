@@ -0,0 +1,287 @@
+//=========================================================================================================
+// segment_font.h - Defines the 7-segment font and the layout of the HT16K33's display RAM
+//
+// Everything here is constexpr, so a constant screen such as " AP " is converted into a frame of
+// display RAM by the compiler and costs nothing at run time.  Like i2c_hal.h, this file depends on
+// nothing but the C standard library so that the simulated display can share it
+//
+// Segment layout:      a
+//                    f   b
+//                      g
+//                    e   c
+//                      d   .
+//=========================================================================================================
+#pragma once
+#include <stdint.h>
+
+// The bit in display RAM for each segment of a digit
+constexpr uint8_t SEG_A  = 0x01;    // Top
+constexpr uint8_t SEG_B  = 0x02;    // Upper right
+constexpr uint8_t SEG_C  = 0x04;    // Lower right
+constexpr uint8_t SEG_D  = 0x08;    // Bottom
+constexpr uint8_t SEG_E  = 0x10;    // Lower left
+constexpr uint8_t SEG_F  = 0x20;    // Upper left
+constexpr uint8_t SEG_G  = 0x40;    // Middle
+constexpr uint8_t SEG_DP = 0x80;    // Decimal point
+
+// The number of bytes of display RAM
+constexpr int DISPLAY_RAM_SIZE = 16;
+
+// The number of digits on the display, and the display RAM address of each one, left to right
+constexpr int DISPLAY_DIGITS = 4;
+constexpr int digit_address[DISPLAY_DIGITS] = {0, 2, 6, 8};
+
+// The display RAM address of the colon and the dots, and the bit that lights each one
+constexpr int     COLON_ADDRESS   = 4;
+constexpr uint8_t COLON_CENTER    = 0x02;
+constexpr uint8_t DOT_UPPER_LEFT  = 0x04;
+constexpr uint8_t DOT_LOWER_LEFT  = 0x08;
+constexpr uint8_t DOT_UPPER_RIGHT = 0x10;
+
+
+// Deliberately not constexpr: calling it while evaluating a constant is a compile-time error
+inline void not_a_segment_letter() {}
+
+//=========================================================================================================
+// segment_bit() - Converts a single segment letter (or '.' for the decimal point) into its segment bit.
+//                 A character that doesn't name a segment is a compile-time error
+//=========================================================================================================
+constexpr uint8_t segment_bit(char letter)
+{
+    return (letter >= 'a' && letter <= 'g') ? 1 << (letter - 'a')
+         : (letter == '.')                  ? SEG_DP
+         : (not_a_segment_letter(), 0);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// segments() - Converts a list of segment letters (plus '.' for the decimal point) into segment bits
+//
+// These functions are written as single return statements so that they're constexpr under C++11, which
+// is what the toolchain compiles with
+//=========================================================================================================
+constexpr uint8_t segments(const char* spec)
+{
+    return (*spec == 0) ? 0 : segment_bit(*spec) | segments(spec + 1);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// glyph_def_t - The definition of the glyph for one character
+//=========================================================================================================
+struct glyph_def_t {char ascii; uint8_t segments;};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// glyph_defs[] - The font.  There must be exactly one entry for each printable ASCII character, in order
+//=========================================================================================================
+constexpr glyph_def_t glyph_defs[] =
+{
+    {' '  , segments("")},
+    {'!'  , segments("bc.")},
+    {'"'  , segments("bf")},
+    {'#'  , segments("bcdefg")},
+    {'$'  , segments("acdfg")},
+    {'%'  , segments("beg.")},
+    {'&'  , segments("bcg")},
+    {'\'' , segments("f")},
+    {'('  , segments("adf")},
+    {')'  , segments("abd")},
+    {'*'  , segments("af")},
+    {'+'  , segments("efg")},
+    {','  , segments("e")},
+    {'-'  , segments("g")},
+    {'.'  , segments(".")},
+    {'/'  , segments("beg")},
+    {'0'  , segments("abcdef")},
+    {'1'  , segments("bc")},
+    {'2'  , segments("abdeg")},
+    {'3'  , segments("abcdg")},
+    {'4'  , segments("bcfg")},
+    {'5'  , segments("acdfg")},
+    {'6'  , segments("acdefg")},
+    {'7'  , segments("abc")},
+    {'8'  , segments("abcdefg")},
+    {'9'  , segments("abcdfg")},
+    {':'  , segments("ad")},
+    {';'  , segments("acd")},
+    {'<'  , segments("afg")},
+    {'='  , segments("dg")},
+    {'>'  , segments("abg")},
+    {'?'  , segments("abeg.")},
+    {'@'  , segments("abcdeg")},
+    {'A'  , segments("abcefg")},
+    {'B'  , segments("cdefg")},
+    {'C'  , segments("adef")},
+    {'D'  , segments("bcdeg")},
+    {'E'  , segments("adefg")},
+    {'F'  , segments("aefg")},
+    {'G'  , segments("acdef")},
+    {'H'  , segments("bcefg")},
+    {'I'  , segments("ef")},
+    {'J'  , segments("bcde")},
+    {'K'  , segments("acefg")},
+    {'L'  , segments("def")},
+    {'M'  , segments("ace")},
+    {'N'  , segments("abcef")},
+    {'O'  , segments("abcdef")},
+    {'P'  , segments("abefg")},
+    {'Q'  , segments("abdfg")},
+    {'R'  , segments("abef")},
+    {'S'  , segments("acdfg")},
+    {'T'  , segments("defg")},
+    {'U'  , segments("bcdef")},
+    {'V'  , segments("bcdef")},
+    {'W'  , segments("bdf")},
+    {'X'  , segments("bcefg")},
+    {'Y'  , segments("bcdfg")},
+    {'Z'  , segments("abdeg")},
+    {'['  , segments("adef")},
+    {'\\' , segments("cfg")},
+    {']'  , segments("abcd")},
+    {'^'  , segments("abf")},
+    {'_'  , segments("d")},
+    {'`'  , segments("b")},
+    {'a'  , segments("abcdeg")},
+    {'b'  , segments("cdefg")},
+    {'c'  , segments("deg")},
+    {'d'  , segments("bcdeg")},
+    {'e'  , segments("abdefg")},
+    {'f'  , segments("aefg")},
+    {'g'  , segments("abcdfg")},
+    {'h'  , segments("cefg")},
+    {'i'  , segments("e")},
+    {'j'  , segments("cd")},
+    {'k'  , segments("acefg")},
+    {'l'  , segments("ef")},
+    {'m'  , segments("ce")},
+    {'n'  , segments("ceg")},
+    {'o'  , segments("cdeg")},
+    {'p'  , segments("abefg")},
+    {'q'  , segments("abcfg")},
+    {'r'  , segments("eg")},
+    {'s'  , segments("acdfg")},
+    {'t'  , segments("defg")},
+    {'u'  , segments("cde")},
+    {'v'  , segments("cde")},
+    {'w'  , segments("ce")},
+    {'x'  , segments("bcefg")},
+    {'y'  , segments("bcdfg")},
+    {'z'  , segments("abdeg")},
+    {'{'  , segments("bcg")},
+    {'|'  , segments("ef")},
+    {'}'  , segments("efg")},
+    {'~'  , segments("a")}
+};
+//=========================================================================================================
+
+// The range of characters the font covers
+constexpr char FONT_FIRST = ' ';
+constexpr char FONT_LAST  = '~';
+
+
+//=========================================================================================================
+// glyphs_in_order() - Returns true if the entries of glyph_defs[] from "index" onward are in order
+//=========================================================================================================
+constexpr bool glyphs_in_order(int index)
+{
+    return (index > FONT_LAST - FONT_FIRST) ? true
+         : glyph_defs[index].ascii == FONT_FIRST + index && glyphs_in_order(index + 1);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// font_is_complete() - Returns true if glyph_defs[] has exactly one entry for each character from
+//                      FONT_FIRST to FONT_LAST, in order
+//=========================================================================================================
+constexpr bool font_is_complete()
+{
+    return sizeof(glyph_defs) / sizeof(glyph_defs[0]) == FONT_LAST - FONT_FIRST + 1 && glyphs_in_order(0);
+}
+//=========================================================================================================
+
+static_assert(font_is_complete(), "The font must cover every printable ASCII character, in order");
+
+
+//=========================================================================================================
+// glyph() - Returns the segment bits for a character.  Characters outside of the font (control
+//           characters, DEL, and bytes of multi-byte UTF-8 sequences) are displayed as a blank
+//=========================================================================================================
+constexpr uint8_t glyph(char c)
+{
+    return (c >= FONT_FIRST && c <= FONT_LAST) ? glyph_defs[c - FONT_FIRST].segments : 0;
+}
+//=========================================================================================================
+
+// Spot-check a few glyphs against their segment bits
+static_assert(glyph('0') == 0x3F && glyph('8') == 0x7F && glyph('A') == 0x77, "The font is wrong");
+static_assert(glyph('\n') == 0 && glyph('\x7F') == 0 && glyph((char)0xC3) == 0, "Out-of-range glyph");
+
+
+//=========================================================================================================
+// seg_frame_t - An image of the HT16K33's display RAM
+//=========================================================================================================
+struct seg_frame_t {uint8_t ram[DISPLAY_RAM_SIZE];};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// char_at() - Returns the character at "index" in a string, or 0 if the string is shorter than that
+//=========================================================================================================
+constexpr char char_at(const char* text, int index)
+{
+    return (index == 0 || *text == 0) ? *text : char_at(text + 1, index - 1);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// digit_at() - Returns the digit (0 thru 3) displayed from a display RAM address, or -1 if none is
+//=========================================================================================================
+constexpr int digit_at(int address, int digit = 0)
+{
+    return (digit == DISPLAY_DIGITS)            ? -1
+         : (digit_address[digit] == address)    ? digit
+         : digit_at(address, digit + 1);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// frame_byte() - Returns the byte of display RAM at "address" in the frame built by make_frame()
+//=========================================================================================================
+constexpr uint8_t frame_byte(const char* text, uint8_t dots, int address)
+{
+    return (address == COLON_ADDRESS) ? dots
+         : (digit_at(address) < 0)    ? 0
+         : glyph(char_at(text, digit_at(address)));
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// make_frame() - Builds the frame that displays the first 4 characters of a string (a shorter string is
+//                padded with blanks) along with the specified colon/dot bits
+//
+// Called with constant arguments in a constexpr context, the frame is built by the compiler
+//=========================================================================================================
+constexpr seg_frame_t make_frame(const char* text, uint8_t dots = 0)
+{
+    static_assert(DISPLAY_RAM_SIZE == 16, "make_frame() fills in exactly 16 bytes");
+
+    return seg_frame_t
+    {{
+        frame_byte(text, dots,  0), frame_byte(text, dots,  1), frame_byte(text, dots,  2), frame_byte(text, dots,  3),
+        frame_byte(text, dots,  4), frame_byte(text, dots,  5), frame_byte(text, dots,  6), frame_byte(text, dots,  7),
+        frame_byte(text, dots,  8), frame_byte(text, dots,  9), frame_byte(text, dots, 10), frame_byte(text, dots, 11),
+        frame_byte(text, dots, 12), frame_byte(text, dots, 13), frame_byte(text, dots, 14), frame_byte(text, dots, 15)
+    }};
+}
+//=========================================================================================================
+
+// Spot-check a frame
+static_assert(make_frame(" AP").ram[2] == 0x77 && make_frame(" AP").ram[8] == 0, "make_frame() is wrong");
@@ -0,0 +1,197 @@
+//=========================================================================================================
+// series_codec.cpp - Implements a compact block encoding for time series of temperature/humidity samples
+//=========================================================================================================
+#include "series_codec.h"
+
+// The format version stored in byte 0 of every block
+const uint8_t FORMAT_VERSION = 1;
+
+
+//=========================================================================================================
+// begin() - Starts a new block in the specified buffer
+//=========================================================================================================
+void CSeriesEncoder::begin(uint8_t* buffer, int capacity)
+{
+    m_buffer   = buffer;
+    m_capacity = capacity;
+    m_count    = 0;
+
+    // Write the header.  The sample count gets filled in as samples are added
+    m_buffer[0] = FORMAT_VERSION;
+    m_buffer[1] = 0;
+    m_buffer[2] = 0;
+    m_length    = HEADER_BYTES;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// put_varint() - Appends an unsigned varint to the block
+//=========================================================================================================
+void CSeriesEncoder::put_varint(uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        m_buffer[m_length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    m_buffer[m_length++] = (uint8_t)value;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// put_zigzag() - Appends a signed value to the block as a zigzag varint
+//=========================================================================================================
+void CSeriesEncoder::put_zigzag(int32_t value)
+{
+    put_varint(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// add() - Appends a sample to the block
+//
+// Returns: false if the block is full, in which case the sample wasn't added
+//=========================================================================================================
+bool CSeriesEncoder::add(const sensor_sample_t& sample)
+{
+    // If there might not be room for this sample, or the sample count is maxed out, the block is full
+    if (m_length + MAX_SAMPLE_BYTES > m_capacity || m_count == 0xFFFF) return false;
+
+    // The first sample is stored as-is
+    if (m_count == 0)
+    {
+        put_varint(sample.timestamp);
+        put_varint(sample.raw_temp);
+        put_varint(sample.raw_rh);
+        m_prior_delta = 0;
+    }
+
+    // Every other sample is stored as differences from the prior one
+    else
+    {
+        // The timestamp is stored as the change in the difference between timestamps.  The arithmetic is
+        // done modulo 2^32, and the decoder undoes it the same way
+        uint32_t delta = sample.timestamp - m_prior.timestamp;
+        put_zigzag((int32_t)(delta - m_prior_delta));
+        put_zigzag((int32_t)sample.raw_temp - (int32_t)m_prior.raw_temp);
+        put_zigzag((int32_t)sample.raw_rh   - (int32_t)m_prior.raw_rh  );
+        m_prior_delta = delta;
+    }
+
+    // This sample is the basis for the next one
+    m_prior = sample;
+
+    // Update the sample count in the header
+    ++m_count;
+    m_buffer[1] = (uint8_t)(m_count);
+    m_buffer[2] = (uint8_t)(m_count >> 8);
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// begin() - Starts decoding a block
+//
+// Returns: false if the block is too short or is of a format we don't understand
+//=========================================================================================================
+bool CSeriesDecoder::begin(const uint8_t* block, int length)
+{
+    m_block   = block;
+    m_length  = length;
+    m_count   = 0;
+    m_decoded = 0;
+
+    // Validate the header
+    if (length < CSeriesEncoder::HEADER_BYTES || block[0] != FORMAT_VERSION) return false;
+
+    // Fetch the sample count
+    m_count  = block[1] | (block[2] << 8);
+    m_offset = CSeriesEncoder::HEADER_BYTES;
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// get_varint() - Fetches an unsigned varint from the block
+//=========================================================================================================
+bool CSeriesDecoder::get_varint(uint32_t* p_value)
+{
+    uint32_t value = 0;
+
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        // If we've run off the end of the block, it's corrupt
+        if (m_offset >= m_length) return false;
+
+        // Fold in the next 7 bits
+        uint8_t c = m_block[m_offset++];
+        value |= (uint32_t)(c & 0x7F) << shift;
+
+        // If this is the last byte of the varint, we're done
+        if ((c & 0x80) == 0)
+        {
+            *p_value = value;
+            return true;
+        }
+    }
+
+    // A varint longer than 5 bytes means the block is corrupt
+    return false;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// get_zigzag() - Fetches a zigzag varint from the block
+//=========================================================================================================
+bool CSeriesDecoder::get_zigzag(int32_t* p_value)
+{
+    uint32_t value;
+    if (!get_varint(&value)) return false;
+    *p_value = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// next() - Fetches the next sample from the block
+//=========================================================================================================
+bool CSeriesDecoder::next(sensor_sample_t* p_sample)
+{
+    // If we've already decoded every sample, there are no more
+    if (m_decoded >= m_count) return false;
+
+    // The first sample is stored as-is
+    if (m_decoded == 0)
+    {
+        uint32_t timestamp, raw_temp, raw_rh;
+        if (!get_varint(&timestamp) || !get_varint(&raw_temp) || !get_varint(&raw_rh)) return false;
+        m_prior.timestamp = timestamp;
+        m_prior.raw_temp  = (uint16_t)raw_temp;
+        m_prior.raw_rh    = (uint16_t)raw_rh;
+        m_prior_delta     = 0;
+    }
+
+    // Every other sample is stored as differences from the prior one
+    else
+    {
+        int32_t dod, delta_temp, delta_rh;
+        if (!get_zigzag(&dod) || !get_zigzag(&delta_temp) || !get_zigzag(&delta_rh)) return false;
+        m_prior_delta     += (uint32_t)dod;
+        m_prior.timestamp += m_prior_delta;
+        m_prior.raw_temp  += delta_temp;
+        m_prior.raw_rh    += delta_rh;
+    }
+
+    // Hand the caller the sample
+    *p_sample = m_prior;
+    ++m_decoded;
+    return true;
+}
+//=========================================================================================================
@@ -0,0 +1,126 @@
+//=========================================================================================================
+// series_codec.h - Defines a compact block encoding for time series of temperature/humidity samples
+//
+// Block format:
+//
+//   Byte 0     : Format version
+//   Bytes 1-2  : Number of samples in the block (little-endian)
+//   Sample 0   : timestamp, raw temperature, raw humidity, each as an unsigned varint
+//   Sample 1   : timestamp delta, temperature delta, humidity delta, each as a zigzag varint
+//   Sample 2.. : timestamp delta-of-delta, temperature delta, humidity delta, each as a zigzag varint
+//
+// A varint stores 7 bits per byte, low bits first, with the high bit set on every byte but the last.
+// Zigzag maps signed values to unsigned ones (0, -1, 1, -2, ... => 0, 1, 2, 3, ...) so that small
+// negative deltas stay small.  With samples at a steady rate the delta-of-delta is almost always 0,
+// and a slowly changing reading has deltas that fit in a single byte, so a typical sample takes
+// three bytes.  Every block starts from scratch, so any block can be decoded on its own.
+//
+// Like i2c_hal.h, this file depends on nothing but the C standard library, so that the codec can be
+// tested on a Linux host
+//=========================================================================================================
+#pragma once
+#include <stdint.h>
+
+
+//=========================================================================================================
+// sensor_sample_t - A single reading in the SHT31's raw 16-bit units
+//=========================================================================================================
+struct sensor_sample_t
+{
+    uint32_t    timestamp;
+    uint16_t    raw_temp;
+    uint16_t    raw_rh;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// CSeriesEncoder - Encodes samples into a caller-supplied block buffer
+//=========================================================================================================
+class CSeriesEncoder
+{
+public:
+
+    // The largest number of bytes a single sample can occupy
+    enum {MAX_SAMPLE_BYTES = 5 + 3 + 3};
+
+    // The size of the block header
+    enum {HEADER_BYTES = 3};
+
+    // Call this to start a new block in the specified buffer
+    void    begin(uint8_t* buffer, int capacity);
+
+    // Call this to append a sample.  Returns false if the block is full
+    bool    add(const sensor_sample_t& sample);
+
+    // Returns the number of bytes in the block so far
+    int     length() {return m_length;}
+
+    // Returns the number of samples in the block so far
+    int     count() {return m_count;}
+
+protected:
+
+    // Appends an unsigned varint to the block
+    void    put_varint(uint32_t value);
+
+    // Appends a signed value to the block as a zigzag varint
+    void    put_zigzag(int32_t value);
+
+    // The buffer being encoded into, and its size
+    uint8_t* m_buffer;
+    int     m_capacity;
+
+    // The number of bytes and samples in the block
+    int     m_length;
+    int     m_count;
+
+    // The previous sample, and the difference between the previous two timestamps.  Differences are
+    // kept modulo 2^32, so that even the largest clock steps can't overflow
+    sensor_sample_t m_prior;
+    uint32_t m_prior_delta;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// CSeriesDecoder - Decodes the samples in a block
+//=========================================================================================================
+class CSeriesDecoder
+{
+public:
+
+    // Call this to start decoding a block.  Returns false if the block is malformed
+    bool    begin(const uint8_t* block, int length);
+
+    // Call this to fetch the next sample.  Returns false when there are no more (or the block is corrupt)
+    bool    next(sensor_sample_t* p_sample);
+
+    // Returns the number of samples in the block
+    int     count() {return m_count;}
+
+protected:
+
+    // Fetches an unsigned varint from the block
+    bool    get_varint(uint32_t* p_value);
+
+    // Fetches a zigzag varint from the block
+    bool    get_zigzag(int32_t* p_value);
+
+    // The block being decoded, and its length
+    const uint8_t* m_block;
+    int     m_length;
+
+    // The offset of the next byte to decode
+    int     m_offset;
+
+    // The number of samples in the block, and the number decoded so far
+    int     m_count;
+    int     m_decoded;
+
+    // The previous sample, and the difference between the previous two timestamps.  Differences are
+    // kept modulo 2^32, so that even the largest clock steps can't overflow
+    sensor_sample_t m_prior;
+    uint32_t m_prior_delta;
+};
+//=========================================================================================================
@@ -1,7 +1,9 @@
 //=========================================================================================================
 // sht31.cpp - Implements an efficient class for reading the SHT31 temperature/humidity sensor
 //=========================================================================================================
-#include "globals.h"
+#include "sht31.h"
+#include "i2c_bus.h"
+#include "metrics.h"
 
 
 //=========================================================================================================
@@ -58,10 +60,15 @@ static uint8_t fast_crc8(const uint8_t* in, uint8_t count)
 // 100ths of a degree C = (17500 * raw) >> 16 - 4500
 //
 //=========================================================================================================
+static int16_t raw_to_hundreths_c(uint32_t raw_temp)
+{
+    return ((17500 * raw_temp) >> 16) - 4500;
+}
+
 static float raw_to_c(uint32_t raw_temp)
 {
     // Compute the temperature in 100ths of a degree C
-    int16_t hundreths = ((17500 * raw_temp) >> 16) - 4500;
+    int16_t hundreths = raw_to_hundreths_c(raw_temp);
 
     // Return the temperature in degrees C
     return hundreths * .01F;
@@ -139,25 +146,43 @@ bool CSHT31::read_raw(uint16_t* p_raw_temp, uint16_t* p_raw_rh)
     // We're going to make 3 attempts to read the device
     uint8_t attempts = 3;
 
+    // These are the two I2C transactions that make up a reading
+    i2c_request_t command, response;
+
     // So long as we haven't exhausted all attempts...
     while (attempts--)
     {
-        // Send the command to the device, and read the result
-        I2C.lock();
-        bool ok = I2C.write(m_i2c_address, m_command, 2); 
-        if (ok) ok = I2C.read(m_i2c_address, &msg, MSG_LENGTH);
-        I2C.unlock();
+        // Send the command to the device, and read the result.  Sensor reads are background work,
+        // so they're low priority and display refreshes will be performed ahead of them
+        I2C.prepare(&command,  I2C_WRITE, m_i2c_address, m_command, 2, nullptr, 0, I2C_PRIO_LOW);
+        I2C.prepare(&response, I2C_READ,  m_i2c_address, 0, 0, &msg, MSG_LENGTH, I2C_PRIO_LOW);
+        bool ok = I2C.perform(&command);
+        if (ok) ok = I2C.perform(&response);
+
+        // Keep track of how many times we've tried to read the device
+        Metrics.sht31_reads.inc();
+
+        // If the read itself failed, try again
+        if (!ok) continue;
 
         //  If both fields had the correct CRC...
-        if (ok && msg.t_crc == fast_crc8(&msg.t_msb, 2) && msg.h_crc == fast_crc8(&msg.h_msb, 2))
+        if (msg.t_crc == fast_crc8(&msg.t_msb, 2) && msg.h_crc == fast_crc8(&msg.h_msb, 2))
         {
             *p_raw_temp = msg.t_msb << 8 | msg.t_lsb;
             *p_raw_rh   = msg.h_msb << 8 | msg.h_lsb;
+
+            // Publish the reading to our metrics
+            Metrics.sht31_temp_centi_c.set(raw_to_hundreths_c(*p_raw_temp));
+            Metrics.sht31_humidity.set(raw_to_rh(*p_raw_rh));
             return true;
         }
+
+        // If we get here, the message arrived but was corrupted
+        Metrics.sht31_crc_errors.inc();
     }
 
     // If we get here, we simply couldn't read the device
+    Metrics.sht31_failures.inc();
     return false;
 }
 //=========================================================================================================
@@ -0,0 +1,285 @@
+//=========================================================================================================
+// sim_i2c.cpp - Implements a simulated I2C bus with virtual HT16K33 and SHT31 devices
+//=========================================================================================================
+#include <string.h>
+#include "sim_i2c.h"
+#include "segment_font.h"
+
+// When several characters of the font share a segment pattern (such as '5', 'S' and '$'), render()
+// shows the first of these that has it
+static const char preferred[] = "0123456789 -ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+
+//=========================================================================================================
+// on_transaction() - Called by the bus when a transaction is addressed to this device
+//
+// Returns: false if the device NAKs the transaction
+//=========================================================================================================
+bool CSimI2CDevice::on_transaction(bool is_read, const uint8_t* reg, int reg_length, uint8_t* data, int length)
+{
+    // If we've been told to NAK this transaction, do so
+    if (m_nak_count > 0)
+    {
+        --m_nak_count;
+        return false;
+    }
+
+    // A read writes the register bytes (if any), then reads the data after a repeated start
+    if (is_read)
+    {
+        if (reg_length && !on_write(reg, reg_length)) return false;
+        return length == 0 || on_read(data, length);
+    }
+
+    // On the wire, a write is the register bytes followed directly by the data, and that's how the
+    // device has to see it.  The HT16K33, for instance, takes the first byte as the RAM address
+    if (reg_length == 0) return length == 0 || on_write(data, length);
+    if (length == 0) return on_write(reg, reg_length);
+    if (reg_length + length > MAX_WRITE) return false;
+    uint8_t message[MAX_WRITE];
+    memcpy(message, reg, reg_length);
+    memcpy(message + reg_length, data, length);
+    return on_write(message, reg_length + length);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// Constructor - An empty bus running at 100 kHz
+//=========================================================================================================
+CSimI2CBus::CSimI2CBus()
+{
+    m_device_count = 0;
+    m_speed        = 100000;
+    reset_counters();
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// attach() - Attaches a device to the bus
+//=========================================================================================================
+bool CSimI2CBus::attach(CSimI2CDevice* device)
+{
+    if (m_device_count == MAX_DEVICES) return false;
+    m_device[m_device_count++] = device;
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// transact() - Performs a transaction on the simulated bus
+//=========================================================================================================
+i2c_result_t CSimI2CBus::transact(int address, bool is_read, const uint8_t* reg, int reg_length,
+                                  uint8_t* data, int length)
+{
+    // Every byte takes 9 bit-times (8 bits and an ACK).  The start and stop take one bit-time each,
+    // and a read that follows a register address has a repeated start and a second address byte
+    int bits = 2 + 9 * (1 + reg_length + length);
+    if (is_read && reg_length) bits += 1 + 9;
+
+    // Count the transaction and the time it would have taken
+    ++m_transactions;
+    m_elapsed_ns += (uint64_t)bits * 1000000000 / m_speed;
+
+    // Find the device at this address
+    for (int i=0; i<m_device_count; ++i)
+    {
+        if (m_device[i]->address() != address) continue;
+        if (!m_device[i]->on_transaction(is_read, reg, reg_length, data, length)) return I2C_RESULT_NAK;
+        m_bytes += reg_length + length;
+        return I2C_RESULT_OK;
+    }
+
+    // If we get here, nothing responded to the address
+    return I2C_RESULT_NAK;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// Constructor - The HT16K33 powers up in standby with the display off and the RAM cleared
+//=========================================================================================================
+CSimHT16K33::CSimHT16K33(int address) : CSimI2CDevice(address)
+{
+    memset(m_ram, 0, sizeof m_ram);
+    m_is_oscillator_on = false;
+    m_is_display_on    = false;
+    m_blink            = 0;
+    m_brightness       = 15;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// on_write() - Handles a write to the HT16K33.  The first byte is a command.  A command with a high
+//              nibble of 0 is a display RAM address, and the rest of the bytes are written there
+//=========================================================================================================
+bool CSimHT16K33::on_write(const uint8_t* data, int length)
+{
+    uint8_t command = data[0];
+
+    switch (command & 0xF0)
+    {
+        // Write data into display RAM, starting at the address in the low nibble
+        case 0x00:
+            for (int i=1; i<length; ++i) m_ram[(command + i - 1) & 0x0F] = data[i];
+            return true;
+
+        // System setup: bit 0 turns the oscillator on
+        case 0x20:
+            m_is_oscillator_on = command & 1;
+            return true;
+
+        // Display setup: bit 0 turns the display on, bits 1-2 select the blink rate
+        case 0x80:
+            m_is_display_on = command & 1;
+            m_blink         = (command >> 1) & 3;
+            return true;
+
+        // ROW/INT set
+        case 0xA0:
+            return true;
+
+        // Dimming set
+        case 0xE0:
+            m_brightness = command & 0x0F;
+            return true;
+    }
+
+    // Anything else isn't a command the HT16K33 knows
+    return false;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// on_read() - Handles a read from the HT16K33.  We don't simulate the key-scan RAM
+//=========================================================================================================
+bool CSimHT16K33::on_read(uint8_t* data, int length)
+{
+    memset(data, 0, length);
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// segments() - Returns the segment bits of a digit
+//=========================================================================================================
+uint8_t CSimHT16K33::segments(int digit)
+{
+    return (digit >= 0 && digit < DISPLAY_DIGITS) ? m_ram[digit_address[digit]] : 0;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// render() - Renders the 4 digits as ASCII into a buffer of at least 5 characters
+//=========================================================================================================
+void CSimHT16K33::render(char* out)
+{
+    for (int digit = 0; digit < DISPLAY_DIGITS; ++digit)
+    {
+        // The decimal point isn't part of the glyph
+        uint8_t pattern = segments(digit) & ~SEG_DP;
+
+        // Look for the pattern among the preferred characters first, then in the rest of the font
+        out[digit] = '?';
+        for (const char* p = preferred; *p && out[digit] == '?'; ++p)
+        {
+            if ((glyph(*p) & ~SEG_DP) == pattern) out[digit] = *p;
+        }
+        for (char c = FONT_FIRST; c <= FONT_LAST && out[digit] == '?'; ++c)
+        {
+            if ((glyph(c) & ~SEG_DP) == pattern) out[digit] = c;
+        }
+    }
+    out[DISPLAY_DIGITS] = 0;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// Constructor - The sensor reads 25.0 C and 50% until told otherwise
+//=========================================================================================================
+CSimSHT31::CSimSHT31(int address) : CSimI2CDevice(address)
+{
+    m_raw_temp        = 26214;
+    m_raw_rh          = 32768;
+    m_is_measuring    = false;
+    m_measurements    = 0;
+    m_crc_error_count = 0;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// crc8() - Computes the SHT31's CRC: polynomial 0x31, initial value 0xFF.  This is computed bit by bit
+//          so that it's independent of the table that CSHT31 uses
+//=========================================================================================================
+uint8_t CSimSHT31::crc8(const uint8_t* data, int length)
+{
+    uint8_t crc = 0xFF;
+    while (length--)
+    {
+        crc ^= *data++;
+        for (int bit=0; bit<8; ++bit) crc = (crc & 0x80) ? (crc << 1) ^ 0x31 : (crc << 1);
+    }
+    return crc;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// on_write() - Handles a command.  Any of the single-shot measurement commands starts a measurement
+//=========================================================================================================
+bool CSimSHT31::on_write(const uint8_t* data, int length)
+{
+    // Every SHT31 command is two bytes
+    if (length != 2) return false;
+
+    // 0x2C is single-shot with clock stretching, 0x24 is single-shot without
+    if (data[0] == 0x2C || data[0] == 0x24)
+    {
+        m_is_measuring = true;
+        ++m_measurements;
+    }
+
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// on_read() - Returns a measurement: temperature MSB, LSB, CRC, then humidity MSB, LSB, CRC
+//=========================================================================================================
+bool CSimSHT31::on_read(uint8_t* data, int length)
+{
+    uint8_t msg[6];
+
+    // If no measurement was started, the sensor NAKs the read
+    if (!m_is_measuring) return false;
+    m_is_measuring = false;
+
+    // Build the message
+    msg[0] = m_raw_temp >> 8;
+    msg[1] = m_raw_temp;
+    msg[2] = crc8(msg, 2);
+    msg[3] = m_raw_rh >> 8;
+    msg[4] = m_raw_rh;
+    msg[5] = crc8(msg + 3, 2);
+
+    // If we've been told to corrupt this measurement, do so
+    if (m_crc_error_count > 0)
+    {
+        --m_crc_error_count;
+        msg[2] ^= 0xFF;
+    }
+
+    // Hand the caller as much of the message as they asked for
+    memcpy(data, msg, length < 6 ? length : 6);
+    return true;
+}
+//=========================================================================================================
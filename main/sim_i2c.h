@@ -0,0 +1,184 @@
+//=========================================================================================================
+// sim_i2c.h - Defines a simulated I2C bus with virtual HT16K33 and SHT31 devices
+//
+// Attach CSimI2CBus to CI2C (with I2C_SIMULATED in i2c_bus.h) to run the firmware without the display
+// and sensor, or use these classes directly on a Linux host to exercise display and sensor logic.
+// Like i2c_hal.h, this depends on nothing but the C standard library.
+//
+// The bus keeps a model of the time each transaction would have taken at the configured clock speed
+// (9 bit-times per byte, plus start and stop), so that timing can be checked without hardware
+//=========================================================================================================
+#pragma once
+#include "i2c_hal.h"
+
+
+//=========================================================================================================
+// CSimI2CDevice - The base class for a simulated device
+//=========================================================================================================
+class CSimI2CDevice
+{
+public:
+
+    // Constructor
+    CSimI2CDevice(int address) {m_address = address; m_nak_count = 0;}
+
+    // Returns the 7-bit address of the device
+    int     address() {return m_address;}
+
+    // Call this to make the device NAK its next "count" transactions
+    void    inject_naks(int count) {m_nak_count = count;}
+
+    // The longest write (register bytes plus data) a device accepts.  Longer writes are NAKed
+    enum {MAX_WRITE = 64};
+
+    // Called by the bus when a transaction is addressed to this device.  Returns false to NAK it
+    bool    on_transaction(bool is_read, const uint8_t* reg, int reg_length, uint8_t* data, int length);
+
+protected:
+
+    // Derived classes handle the bytes written to them...
+    virtual bool on_write(const uint8_t* data, int length) = 0;
+
+    // ...and supply the bytes read from them
+    virtual bool on_read(uint8_t* data, int length) = 0;
+
+    // The 7-bit address of the device
+    int     m_address;
+
+    // The number of upcoming transactions to NAK
+    int     m_nak_count;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// CSimI2CBus - A simulated I2C bus.  Transactions to addresses with no device attached are NAKed
+//=========================================================================================================
+class CSimI2CBus : public CI2CHal
+{
+public:
+
+    // Constructor
+    CSimI2CBus();
+
+    // Call this to attach a device to the bus
+    bool    attach(CSimI2CDevice* device);
+
+    // Sets the clock speed (in Hz) that transaction times are modeled at
+    void    set_speed(uint32_t hz) {m_speed = hz;}
+
+    // Performs a transaction on the simulated bus
+    i2c_result_t transact(int address, bool is_read, const uint8_t* reg, int reg_length,
+                          uint8_t* data, int length);
+
+    // Returns the number of transactions, the bytes transferred, and the modeled bus time so far
+    uint32_t transactions() {return m_transactions;}
+    uint32_t bytes()        {return m_bytes;}
+    uint32_t elapsed_us()   {return (uint32_t)(m_elapsed_ns / 1000);}
+
+    // Resets the counters
+    void    reset_counters() {m_transactions = m_bytes = 0; m_elapsed_ns = 0;}
+
+protected:
+
+    // The devices attached to the bus
+    enum {MAX_DEVICES = 8};
+    CSimI2CDevice* m_device[MAX_DEVICES];
+    int         m_device_count;
+
+    // The clock speed transaction times are modeled at
+    uint32_t    m_speed;
+
+    // The counters
+    uint32_t    m_transactions;
+    uint32_t    m_bytes;
+    uint64_t    m_elapsed_ns;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// CSimHT16K33 - A simulated HT16K33 driving a 4-digit 7-segment display with a center colon
+//=========================================================================================================
+class CSimHT16K33 : public CSimI2CDevice
+{
+public:
+
+    // Constructor
+    CSimHT16K33(int address);
+
+    // Returns the segment bits of a digit (0 thru 3).  Bit 0 = segment A ... bit 6 = G, bit 7 = DP
+    uint8_t segments(int digit);
+
+    // Returns true if the center colon is lit
+    bool    colon() {return (m_ram[4] & 2) != 0;}
+
+    // Renders the 4 digits as ASCII using the font in segment_font.h.  A pattern that isn't in the font
+    // becomes '?'
+    void    render(char* out);
+
+    // Returns the state set by the HT16K33's command bytes
+    bool    is_oscillator_on() {return m_is_oscillator_on;}
+    bool    is_display_on()    {return m_is_display_on;}
+    int     blink()            {return m_blink;}
+    int     brightness()       {return m_brightness;}
+
+    // Returns the raw display RAM
+    const uint8_t* ram() {return m_ram;}
+
+protected:
+
+    bool    on_write(const uint8_t* data, int length);
+    bool    on_read(uint8_t* data, int length);
+
+    // The 16 bytes of display RAM
+    uint8_t m_ram[16];
+
+    // The state set by command bytes
+    bool    m_is_oscillator_on;
+    bool    m_is_display_on;
+    int     m_blink;
+    int     m_brightness;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// CSimSHT31 - A simulated SHT31 temperature/humidity sensor that returns programmable raw values
+//=========================================================================================================
+class CSimSHT31 : public CSimI2CDevice
+{
+public:
+
+    // Constructor
+    CSimSHT31(int address);
+
+    // Sets the raw values the next measurements will return
+    void    set_raw(uint16_t raw_temp, uint16_t raw_rh) {m_raw_temp = raw_temp; m_raw_rh = raw_rh;}
+
+    // Call this to corrupt the CRC of the next "count" measurements
+    void    inject_crc_errors(int count) {m_crc_error_count = count;}
+
+    // Returns the number of measurements that have been started
+    int     measurements() {return m_measurements;}
+
+    // Computes the CRC the SHT31 appends to each 16-bit value
+    static uint8_t crc8(const uint8_t* data, int length);
+
+protected:
+
+    bool    on_write(const uint8_t* data, int length);
+    bool    on_read(uint8_t* data, int length);
+
+    // The raw values to be returned
+    uint16_t m_raw_temp;
+    uint16_t m_raw_rh;
+
+    // True when a measurement has been started and not yet read
+    bool    m_is_measuring;
+
+    // The number of measurements started, and the number of upcoming ones to corrupt
+    int     m_measurements;
+    int     m_crc_error_count;
+};
+//=========================================================================================================
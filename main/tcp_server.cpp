@@ -136,6 +136,13 @@ bool CTCPServer::handle_nvget()
         return pass("%i 0x%08X 0x%08X", ok, old_crc, new_crc);
     }
 
+    // Is the user asking which parts of NVS have changed since the last commit?
+    if token_is("dirty")
+    {
+        // Tell the client which 32-byte chunks are dirty and how many commits have been skipped
+        return pass("0x%08X %u", (unsigned)NVS.dirty_chunks(), (unsigned)Metrics.nvs_writes_skipped.value());
+    }
+
     // Is the user asking for the network SSID?
     if  token_is("ssid")
     {
@@ -239,6 +246,166 @@ bool CTCPServer::handle_temp()
 
 
 
+//========================================================================================================= 
+// handle_history() - Reports the most recent entries in the telemetry log
+//
+// Syntax:  history [count]
+//          history size
+//
+// "history size" exports the whole log the way "HTTP GET /history" does, and reports how its size
+// compares to the fixed-size records stored in flash
+//========================================================================================================= 
+bool CTCPServer::handle_history()
+{
+    const char*     token;
+    telemetry_rec_t record;
+    char            when[32];
+    U8              buffer[2 + TELEMETRY_EXPORT_BLOCK];
+
+    // If there's no telemetry log, tell the client
+    if (!TelemetryLog.is_ready()) return fail_unsupp();
+
+    // Fetch the next token
+    get_next_token(&token);
+
+    // The number of records in the log
+    int total = TelemetryLog.count();
+
+    // If the client wants to know how compact the exported log is, measure it
+    if (strcmp(token, "size") == 0)
+    {
+        int index = 0, length;
+        U32 exported = 0;
+        while ((length = TelemetryLog.export_block(&index, buffer, sizeof buffer)) != 0) exported += length;
+        U32 stored = total * sizeof(telemetry_rec_t);
+        return pass("%i records, %u bytes stored, %u bytes exported", total, (unsigned)stored, (unsigned)exported);
+    }
+
+    // Find out how many records the client wants to see
+    int wanted = token[0] ? atoi(token) : 10;
+
+    // Find the first record we're going to report
+    int first = (wanted < total) ? total - wanted : 0;
+
+    // Report each record
+    for (int index = first; index < total; ++index)
+    {
+        if (!TelemetryLog.read(index, &record)) continue;
+        time_t timestamp = record.timestamp;
+        struct tm timeinfo;
+        localtime_r(&timestamp, &timeinfo);
+        strftime(when, sizeof when, "%Y-%m-%d %H:%M:%S", &timeinfo);
+        replyf(" %s %6.2fC %3i%%", when, record.temp_centi_c / 100.0, record.humidity);
+    }
+
+    // And tell the client how many records there are in total
+    return pass("%i", total);
+}
+//========================================================================================================= 
+
+
+//========================================================================================================= 
+// handle_i2c() - Reports on the devices attached to the I2C bus
+//
+// Syntax:  i2c scan
+//          i2c stats
+//========================================================================================================= 
+bool CTCPServer::handle_i2c()
+{
+    const char* token;
+    U8          found[128];
+    char        histogram[200];
+
+    // Fetch the next token
+    get_next_token(&token);
+
+    // "scan" reports the address of every device that responds
+    if token_is("scan")
+    {
+        int count = I2C.scan(found, sizeof found);
+        for (int i=0; i<count; ++i) replyf(" 0x%02X", found[i]);
+        return pass("%i", count);
+    }
+
+    // "stats" reports the statistics for every device we've talked to
+    if token_is("stats")
+    {
+        // Report the state of the bus as a whole
+        replyf(" speed:%ukHz recoveries:%u", (unsigned)(I2C.speed() / 1000), (unsigned)NVRAM.i2c_recoveries);
+
+        int count = I2C.device_count();
+        for (int i=0; i<count; ++i)
+        {
+            const i2c_device_stats_t& stats = I2C.device_stats(i);
+
+            // Report the counters
+            U32 average = stats.transactions ? stats.total_us / stats.transactions : 0;
+            replyf(" 0x%02X xact:%u bytes:%u nak:%u timeout:%u other:%u avg_us:%u", stats.address,
+                    (unsigned)stats.transactions, (unsigned)stats.bytes, (unsigned)stats.naks,
+                    (unsigned)stats.timeouts, (unsigned)stats.other_errors, (unsigned)average);
+
+            // Report the latency histogram
+            char* p = histogram;
+            for (int bucket = 0; bucket < I2C_LATENCY_BUCKETS; ++bucket)
+            {
+                U32 bound = I2C.latency_bound(bucket);
+                if (bound)
+                    p += sprintf(p, " <=%u:%u", (unsigned)bound, (unsigned)stats.latency[bucket]);
+                else
+                    p += sprintf(p, " >%u:%u", (unsigned)I2C.latency_bound(bucket - 1), (unsigned)stats.latency[bucket]);
+            }
+            replyf("      us%s", histogram);
+        }
+        return pass("%i", count);
+    }
+
+    // If we get here, there was a syntax error
+    return fail_syntax();
+}
+//========================================================================================================= 
+
+
+//========================================================================================================= 
+// handle_i2ctrace() - Dumps the most recent I2C transactions, oldest first
+//
+// Syntax:  i2ctrace [count]
+//
+// Each line is:  sequence timestamp_us bus_us address R|W reg_length length result first_bytes
+// tools/i2ctrace.py renders this as a timeline
+//========================================================================================================= 
+bool CTCPServer::handle_i2ctrace()
+{
+    static const char* result_name[] = {"OK", "NAK", "TIMEOUT", "ERR"};
+    const char*        token;
+    i2c_trace_t        record;
+
+    // If the trace was compiled out, tell the client
+    if (!I2C_TRACE) return fail_unsupp();
+
+    // Find out how many records the client wants to see
+    get_next_token(&token);
+    U32 wanted = token[0] ? atoi(token) : I2C_TRACE_SIZE;
+
+    // Find the first record we're going to report
+    U32 head  = I2C.trace_head();
+    U32 first = (wanted < head) ? head - wanted : 0;
+
+    // Report each record that's still in the ring
+    for (U32 sequence = first; sequence < head; ++sequence)
+    {
+        if (!I2C.read_trace(sequence, &record)) continue;
+        replyf(" %u %u %u %02X %c %u %u %s %02X%02X%02X%02X", (unsigned)sequence, (unsigned)record.timestamp,
+                record.bus_us, record.address, record.op == I2C_READ ? 'R' : 'W', record.reg_length,
+                record.length, result_name[record.result & 3],
+                record.first[0], record.first[1], record.first[2], record.first[3]);
+    }
+
+    // And tell the client how many transactions there have been in total
+    return pass("%u", (unsigned)head);
+}
+//========================================================================================================= 
+
+
 //========================================================================================================= 
 // handle_wifi() - Handles Wi-Fi management commands
 //========================================================================================================= 
@@ -276,6 +443,57 @@ bool CTCPServer::handle_stack()
 }
 //========================================================================================================= 
 
+//========================================================================================================= 
+// handle_anim() - Reports the cost of the most recent display animation, sets the animation frame
+//                 rate, or displays a string
+//
+// Syntax:  anim
+//          anim fps <frames_per_second>
+//          anim text "<string>"
+//========================================================================================================= 
+bool CTCPServer::handle_anim()
+{
+    const char* token;
+
+    // Fetch the next token
+    get_next_token(&token);
+
+    // With no parameters, report on the most recent animation
+    if token_is("")
+    {
+        const anim_report_t& report = Animator.report();
+        U32 duration_ms = report.duration_ms ? report.duration_ms : 1;
+        return pass("fps:%i last:%s ms:%u frames:%u dropped:%u us:%u us_per_s:%u bytes:%u bytes_per_s:%u",
+                    Animator.frame_rate(), report.name ? report.name : "none",
+                    (unsigned)report.duration_ms, (unsigned)report.frames, (unsigned)report.dropped,
+                    (unsigned)report.cpu_us, (unsigned)((U64)report.cpu_us * 1000 / duration_ms),
+                    (unsigned)report.bus_bytes, (unsigned)((U64)report.bus_bytes * 1000 / duration_ms));
+    }
+
+    // "fps" sets the frame rate of subsequent animations
+    if token_is("fps")
+    {
+        get_next_token(&token);
+        int fps = atoi(token);
+        if (!CAnimator::is_valid_frame_rate(fps)) return fail_syntax();
+        if (!DisplayMgr.set_frame_rate(fps)) return fail("BUSY");
+        return pass("%i", fps);
+    }
+
+    // "text" displays a string, scrolling it if it's too long to fit
+    if token_is("text")
+    {
+        if (!get_next_token(&token)) return fail_syntax();
+        DisplayMgr.display_text(token);
+        return pass();
+    }
+
+    // If we get here, there was a syntax error
+    return fail_syntax();
+}
+//========================================================================================================= 
+
+
 //========================================================================================================= 
 // handle_button() - Simulates pressing the user-interface button
 //========================================================================================================= 
@@ -306,6 +524,10 @@ void CTCPServer::on_command(const char* token)
     else if token_is("stack")    handle_stack();
     else if token_is("button")   handle_button();
     else if token_is("temp")     handle_temp();
+    else if token_is("history")  handle_history();
+    else if token_is("i2c")      handle_i2c();
+    else if token_is("i2ctrace") handle_i2ctrace();
+    else if token_is("anim")     handle_anim();
 
     else fail_syntax();
 }
@@ -29,6 +29,10 @@ protected:
     bool    handle_stack();
     bool    handle_button();
     bool    handle_temp();
+    bool    handle_history();
+    bool    handle_i2c();
+    bool    handle_i2ctrace();
+    bool    handle_anim();
     // ------------------------------------------------------------------
 
 
@@ -193,6 +193,7 @@ void CTCPServerBase::handle_new_message()
 
     // Call the top level command handler
     on_command(first_token);
+    Metrics.tcp_commands.inc();
 
     // Keep track of the high-water mark on the stack for this thread
     StackMgr.record_hwm(TASK_IDX_TCP_SERVER);
@@ -437,6 +438,7 @@ bool CTCPServerBase::wait_for_connection()
 
     // We now have a client connected
     m_has_client = true;
+    Metrics.tcp_connections.inc();
 
     // Tell the caller that all is well
     return true;
@@ -0,0 +1,412 @@
+//=========================================================================================================
+// telemetry_log.cpp - Implements an append-only ring log of temperature/humidity readings
+//=========================================================================================================
+#include <stdio.h>
+#include <stddef.h>
+#include "telemetry_log.h"
+
+// The size of a flash sector, the smallest unit that can be erased
+const int SECTOR_SIZE = CLogStore::SECTOR_SIZE;
+
+// This marks a sector that has a valid header
+const uint32_t SECTOR_MAGIC = 0x544C4F47;
+
+// The timestamp of a record that has never been written
+const uint32_t ERASED_TIMESTAMP = 0xFFFFFFFF;
+
+// The "ordered" field of a sector header starts out erased.  It's cleared to zero (which needs no
+// erase) when a record is written that's older than the record before it
+const uint32_t ORDERED   = 0xFFFFFFFF;
+const uint32_t UNORDERED = 0;
+
+//=========================================================================================================
+// sector_hdr_t - Sits at the start of every sector that holds records
+//=========================================================================================================
+struct sector_hdr_t
+{
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t ordered;
+};
+//=========================================================================================================
+
+// This is how many records fit in a sector after its header
+const int SLOTS_PER_SECTOR = (SECTOR_SIZE - sizeof(sector_hdr_t)) / sizeof(telemetry_rec_t);
+
+
+//=========================================================================================================
+// compute_check() - Computes the check-byte of a record
+//=========================================================================================================
+static uint8_t compute_check(const telemetry_rec_t& record)
+{
+    const uint8_t* p = (const uint8_t*)&record;
+    uint8_t check = 0x5A;
+    for (unsigned i=0; i<sizeof(record)-1; ++i) check ^= p[i];
+    return check;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// to_sample() - Converts a record to the SHT31's raw units, which is what the series codec stores
+//
+// CSHT31 converts a raw temperature to hundredths of a degree C as ((17500 * raw) >> 16) - 4500, and a
+// raw humidity to percent as (100 * raw) >> 16.  We pick the smallest raw values that convert to the
+// record's values, so that decoding with those same formulas gives back exactly what was logged
+//=========================================================================================================
+static sensor_sample_t to_sample(const telemetry_rec_t& record)
+{
+    sensor_sample_t sample;
+
+    int64_t raw_temp = ((record.temp_centi_c + 4500) * (int64_t)65536 + 17499) / 17500;
+    int64_t raw_rh   = (record.humidity * (int64_t)65536 + 99) / 100;
+
+    // A value the sensor can't produce is clamped to its range
+    sample.timestamp = record.timestamp;
+    sample.raw_temp  = (raw_temp < 0) ? 0 : (raw_temp > 0xFFFF) ? 0xFFFF : raw_temp;
+    sample.raw_rh    = (raw_rh   > 0xFFFF) ? 0xFFFF : raw_rh;
+    return sample;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// begin() - Finds the oldest sector, the newest sector, and the first free slot in the newest sector
+//=========================================================================================================
+bool CTelemetryLog::begin(CLogStore* store)
+{
+    sector_hdr_t    hdr;
+    telemetry_rec_t newest;
+    uint32_t        oldest_sequence = 0;
+    bool            found = false;
+
+    // Find out how many sectors the store holds.  A ring needs at least two
+    m_store = store;
+    m_sector_count = m_store->size() / SECTOR_SIZE;
+    if (m_sector_count < 2) return false;
+
+    // Read every sector header to find the newest and oldest sectors, and count the sectors that have
+    // a step backwards in time
+    m_unordered_sectors = 0;
+    for (int sector = 0; sector < m_sector_count; ++sector)
+    {
+        if (!m_store->read(sector * SECTOR_SIZE, &hdr, sizeof hdr)) continue;
+        if (hdr.magic != SECTOR_MAGIC) continue;
+
+        if (hdr.ordered != ORDERED) ++m_unordered_sectors;
+
+        if (!found || hdr.sequence > m_head_sequence)
+        {
+            m_head_sector       = sector;
+            m_head_sequence     = hdr.sequence;
+            m_is_head_unordered = (hdr.ordered != ORDERED);
+        }
+
+        if (!found || hdr.sequence < oldest_sequence)
+        {
+            m_tail_sector   = sector;
+            oldest_sequence = hdr.sequence;
+        }
+
+        found = true;
+    }
+
+    // If the log is empty, start it in the first sector
+    if (!found)
+    {
+        m_tail_sector = 0;
+        if (!start_sector(0, 1)) return false;
+    }
+
+    // Otherwise, find out where the next record goes
+    else m_head_slot = find_free_slot(m_head_sector);
+
+    // The log is ready for use
+    m_is_ready = true;
+
+    // Fetch the newest record, so that append() can tell if the clock has stepped backwards since then
+    m_has_newest = read_locked(count() - 1, &newest);
+    if (m_has_newest) m_newest_timestamp = newest.timestamp;
+
+    // Tell the engineer what we found
+    printf("Telemetry log has %i records in %i sectors\n", count(), used_sectors());
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// slot_offset() - Returns the byte offset within the store of a slot in a sector
+//=========================================================================================================
+uint32_t CTelemetryLog::slot_offset(int sector, int slot)
+{
+    return sector * SECTOR_SIZE + sizeof(sector_hdr_t) + slot * sizeof(telemetry_rec_t);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// read_slot() - Reads the record at the specified slot of a sector
+//=========================================================================================================
+bool CTelemetryLog::read_slot(int sector, int slot, telemetry_rec_t* p_record)
+{
+    return m_store->read(slot_offset(sector, slot), p_record, sizeof(telemetry_rec_t));
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// find_free_slot() - Returns the number of the first unwritten slot in a sector
+//
+// Records are written in order, so every written slot comes before every unwritten slot, and we can
+// binary search for the boundary
+//=========================================================================================================
+int CTelemetryLog::find_free_slot(int sector)
+{
+    telemetry_rec_t record;
+    int lo = 0, hi = SLOTS_PER_SECTOR;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (read_slot(sector, mid, &record) && record.timestamp == ERASED_TIMESTAMP)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return lo;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// start_sector() - Erases a sector and writes a fresh header into it, making it the newest sector
+//=========================================================================================================
+bool CTelemetryLog::start_sector(int sector, uint32_t sequence)
+{
+    sector_hdr_t hdr = {SECTOR_MAGIC, sequence, ORDERED};
+    sector_hdr_t old_hdr;
+
+    // If we're about to overwrite the oldest sector, the next one becomes the oldest.  If the oldest
+    // sector had a step backwards in time, that step is leaving the log
+    if (m_is_ready && sector == m_tail_sector)
+    {
+        m_tail_sector = (sector + 1) % m_sector_count;
+        if (m_store->read(sector * SECTOR_SIZE, &old_hdr, sizeof old_hdr) && old_hdr.ordered != ORDERED)
+        {
+            --m_unordered_sectors;
+        }
+    }
+
+    // Erase the sector and write the header
+    if (!m_store->erase(sector * SECTOR_SIZE, SECTOR_SIZE)) return false;
+    if (!m_store->write(sector * SECTOR_SIZE, &hdr, sizeof hdr)) return false;
+
+    // This is now the newest sector
+    m_head_sector       = sector;
+    m_head_sequence     = sequence;
+    m_head_slot         = 0;
+    m_is_head_unordered = false;
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// mark_head_unordered() - Records in the header of the newest sector that a record in it is older than
+//                         the record before it
+//=========================================================================================================
+bool CTelemetryLog::mark_head_unordered()
+{
+    const uint32_t unordered = UNORDERED;
+
+    // Clearing the bits of the "ordered" field doesn't need an erase
+    uint32_t offset = m_head_sector * SECTOR_SIZE + offsetof(sector_hdr_t, ordered);
+    if (!m_store->write(offset, &unordered, sizeof unordered)) return false;
+
+    // find() can no longer use a binary search
+    m_is_head_unordered = true;
+    ++m_unordered_sectors;
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// append() - Adds a reading to the end of the log
+//=========================================================================================================
+bool CTelemetryLog::append(uint32_t timestamp, int16_t temp_centi_c, uint8_t humidity)
+{
+    telemetry_rec_t record = {timestamp, temp_centi_c, humidity, 0};
+    bool ok = true;
+
+    // If begin() failed, there's nowhere to log to
+    if (!m_is_ready) return false;
+
+    // Fill in the check-byte
+    record.check = compute_check(record);
+
+    m_store->lock();
+
+    // If the newest sector is full, move on to the next sector in the ring
+    if (m_head_slot == SLOTS_PER_SECTOR)
+    {
+        ok = start_sector((m_head_sector + 1) % m_sector_count, m_head_sequence + 1);
+    }
+
+    // If the clock has stepped backwards, the newest sector is no longer in timestamp order
+    if (ok && m_has_newest && timestamp < m_newest_timestamp && !m_is_head_unordered)
+    {
+        ok = mark_head_unordered();
+    }
+
+    // Write the record
+    if (ok) ok = m_store->write(slot_offset(m_head_sector, m_head_slot), &record, sizeof record);
+
+    // Whether or not the write succeeded, that slot has been used
+    if (m_head_slot < SLOTS_PER_SECTOR) ++m_head_slot;
+
+    // Keep track of the newest record
+    if (ok)
+    {
+        m_newest_timestamp = timestamp;
+        m_has_newest       = true;
+    }
+
+    m_store->unlock();
+    return ok;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// used_sectors() - Returns the number of sectors between the oldest and newest sectors, inclusive
+//=========================================================================================================
+int CTelemetryLog::used_sectors()
+{
+    return (m_head_sector - m_tail_sector + m_sector_count) % m_sector_count + 1;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// count() - Returns the number of records in the log.  Every sector but the newest is full
+//=========================================================================================================
+int CTelemetryLog::count()
+{
+    if (!m_is_ready) return 0;
+    return (used_sectors() - 1) * SLOTS_PER_SECTOR + m_head_slot;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// read() - Fetches a record.  Index 0 is the oldest record in the log
+//
+// Returns: false if the index is out of range or the record is corrupt
+//=========================================================================================================
+bool CTelemetryLog::read(int index, telemetry_rec_t* p_record)
+{
+    // If begin() failed, there's nothing to read
+    if (!m_is_ready) return false;
+
+    m_store->lock();
+    bool ok = read_locked(index, p_record);
+    m_store->unlock();
+    return ok;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// read_locked() - Fetches a record.  Caller must hold the store's lock
+//=========================================================================================================
+bool CTelemetryLog::read_locked(int index, telemetry_rec_t* p_record)
+{
+    // Make sure the index is in range
+    if (index < 0 || index >= count()) return false;
+
+    // Find the sector and slot the record lives in
+    int sector = (m_tail_sector + index / SLOTS_PER_SECTOR) % m_sector_count;
+    int slot   = index % SLOTS_PER_SECTOR;
+
+    // Fetch the record and make sure it's intact
+    return read_slot(sector, slot, p_record) && p_record->check == compute_check(*p_record);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// find() - Returns the index of the first record with a timestamp >= "timestamp", or count() if
+//          there is no such record
+//=========================================================================================================
+int CTelemetryLog::find(uint32_t timestamp)
+{
+    telemetry_rec_t record;
+    int lo = 0, hi = count();
+
+    // If begin() failed, there's nothing to find
+    if (!m_is_ready) return 0;
+
+    m_store->lock();
+
+    // When the records are in timestamp order, a binary search finds it in a handful of flash reads
+    if (is_ordered())
+    {
+        while (lo < hi)
+        {
+            int mid = (lo + hi) / 2;
+            if (read_locked(mid, &record) && record.timestamp < timestamp)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+
+    // Otherwise the clock has stepped backwards somewhere in the log, and we have to look at every record
+    else
+    {
+        while (lo < hi && !(read_locked(lo, &record) && record.timestamp >= timestamp)) ++lo;
+    }
+
+    m_store->unlock();
+    return lo;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// export_block() - Exports records as a 2-byte length followed by a block of the series codec
+//
+// Records that are corrupt are skipped
+//=========================================================================================================
+int CTelemetryLog::export_block(int* p_index, uint8_t* buffer, int capacity)
+{
+    CSeriesEncoder  encoder;
+    telemetry_rec_t record;
+
+    // If begin() failed, there's nothing to export
+    if (!m_is_ready) return 0;
+
+    // The block goes after its length, and can't be longer than the length can express
+    capacity -= 2;
+    if (capacity > TELEMETRY_EXPORT_BLOCK) capacity = TELEMETRY_EXPORT_BLOCK;
+    encoder.begin(buffer + 2, capacity);
+
+    // Add records to the block until it's full or we run out of them
+    for (; *p_index < count(); ++*p_index)
+    {
+        if (!read(*p_index, &record)) continue;
+        if (!encoder.add(to_sample(record))) break;
+    }
+
+    // If there was nothing to export, tell the caller
+    if (encoder.count() == 0) return 0;
+
+    // Fill in the length of the block
+    buffer[0] = (uint8_t)(encoder.length());
+    buffer[1] = (uint8_t)(encoder.length() >> 8);
+    return 2 + encoder.length();
+}
+//=========================================================================================================
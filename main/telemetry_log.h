@@ -0,0 +1,128 @@
+//=========================================================================================================
+// telemetry_log.h - Defines an append-only ring log of temperature/humidity readings, stored in a
+//                   dedicated flash partition
+//
+// The log reaches flash through the CLogStore seam, so like i2c_hal.h this file depends on nothing but
+// the C standard library, and the log can be tested on a Linux host with a file standing in for flash
+//=========================================================================================================
+#pragma once
+#include <stdint.h>
+#include "log_store.h"
+#include "series_codec.h"
+
+// The largest block (not counting its 2-byte length) that export_block() produces
+#define TELEMETRY_EXPORT_BLOCK 256
+
+
+//=========================================================================================================
+// telemetry_rec_t - A single reading.  In erased flash every byte is 0xFF, so a record whose timestamp
+//                   is 0xFFFFFFFF has never been written
+//=========================================================================================================
+struct telemetry_rec_t
+{
+    uint32_t    timestamp;      // UNIX time (seconds since 1970, UTC)
+    int16_t     temp_centi_c;   // Temperature in hundredths of a degree C
+    uint8_t     humidity;       // Relative humidity in percent
+    uint8_t     check;          // Guards against a record that was only partially written
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// CTelemetryLog - Singleton class, manages the telemetry log
+//
+// The store is treated as a ring of 4K sectors.  Each sector begins with a header containing a
+// sequence number, followed by fixed-size records that are written in order.  When the newest sector
+// fills up, the next sector in the ring is erased and becomes the newest, so every sector gets erased
+// equally often.
+//
+// Records are normally in timestamp order from the oldest sector to the newest, which lets us find any
+// point in time with a binary search.  But the clock can be stepped backwards (by NTP, for instance), so
+// a sector's header also records whether any record in it is older than the record before it.  While
+// any sector in the log has such a step, find() falls back to a linear scan
+//=========================================================================================================
+class CTelemetryLog
+{
+public:
+
+    // Constructor
+    CTelemetryLog() {m_is_ready = false; m_store = nullptr;}
+
+    // Call this once at startup.  Returns false if the store can't hold a log
+    bool    begin(CLogStore* store);
+
+    // Call this to add a reading to the end of the log
+    bool    append(uint32_t timestamp, int16_t temp_centi_c, uint8_t humidity);
+
+    // Returns the number of records in the log
+    int     count();
+
+    // Fetches a record.  Index 0 is the oldest record in the log
+    bool    read(int index, telemetry_rec_t* p_record);
+
+    // Returns the index of the first record with a timestamp >= "timestamp"
+    int     find(uint32_t timestamp);
+
+    // Exports records, starting at *p_index, as a 2-byte little-endian length followed by a block in the
+    // format described in series_codec.h.  Advances *p_index past the records that were exported, and
+    // returns the number of bytes placed in "buffer", or 0 once there's nothing left to export
+    int     export_block(int* p_index, uint8_t* buffer, int capacity);
+
+    // Returns true if timestamps never step backwards in the log, so find() can use a binary search
+    bool    is_ordered() {return m_unordered_sectors == 0;}
+
+    // True if begin() succeeded and the log is usable
+    bool    is_ready() {return m_is_ready;}
+
+protected:
+
+    // Erases a sector and writes a fresh header into it, making it the newest sector
+    bool    start_sector(int sector, uint32_t sequence);
+
+    // Records in the header of the newest sector that a record in it is out of timestamp order
+    bool    mark_head_unordered();
+
+    // Returns the number of the first unwritten slot in a sector
+    int     find_free_slot(int sector);
+
+    // Reads the record at the specified slot of a sector
+    bool    read_slot(int sector, int slot, telemetry_rec_t* p_record);
+
+    // Reads a record without taking the lock
+    bool    read_locked(int index, telemetry_rec_t* p_record);
+
+    // Returns the byte offset within the store of a slot in a sector
+    uint32_t slot_offset(int sector, int slot);
+
+    // Returns the number of sectors that contain data
+    int     used_sectors();
+
+    // The flash that holds the log
+    CLogStore* m_store;
+
+    // The number of 4K sectors in the store
+    int     m_sector_count;
+
+    // The sector holding the oldest records
+    int     m_tail_sector;
+
+    // The sector that new records are being appended to, and its sequence number
+    int     m_head_sector;
+    uint32_t m_head_sequence;
+
+    // The next slot in the head sector that a record will be written to
+    int     m_head_slot;
+
+    // The number of sectors in the log with a record that's older than the record before it, and
+    // whether the head sector is one of them
+    int     m_unordered_sectors;
+    bool    m_is_head_unordered;
+
+    // The timestamp of the newest record, if there is one
+    uint32_t m_newest_timestamp;
+    bool    m_has_newest;
+
+    // True once begin() has succeeded
+    bool    m_is_ready;
+};
+//=========================================================================================================
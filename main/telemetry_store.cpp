@@ -0,0 +1,82 @@
+//=========================================================================================================
+// telemetry_store.cpp - Implements the flash partition that holds the telemetry log
+//=========================================================================================================
+#include "globals.h"
+
+// This is the partition the log lives in.  See large_flash_partitions.csv
+static const char* PARTITION_LABEL = "telemetry";
+const esp_partition_subtype_t PARTITION_SUBTYPE = (esp_partition_subtype_t)0x40;
+
+
+//=========================================================================================================
+// The routines below are the jobs that CFlashIO runs for us
+//=========================================================================================================
+
+// Writes data into the partition
+esp_err_t CTelemetryStore::write_job(void* argument)
+{
+    job_t* p = (job_t*) argument;
+    return esp_partition_write(p->partition, p->offset, p->data, p->length);
+}
+
+// Erases sectors of the partition
+esp_err_t CTelemetryStore::erase_job(void* argument)
+{
+    job_t* p = (job_t*) argument;
+    return esp_partition_erase_range(p->partition, p->offset, p->length);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// begin() - Finds the partition
+//=========================================================================================================
+bool CTelemetryStore::begin()
+{
+    // Find our partition.  Smaller flash layouts don't have one
+    m_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, PARTITION_SUBTYPE, PARTITION_LABEL);
+    if (m_partition == nullptr)
+    {
+        printf("No telemetry partition, telemetry logging disabled\n");
+        return false;
+    }
+
+    // This serializes access to the log
+    m_mutex = xSemaphoreCreateMutex();
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// read() - Reads bytes from the partition
+//=========================================================================================================
+bool CTelemetryStore::read(uint32_t offset, void* buffer, int length)
+{
+    return esp_partition_read(m_partition, offset, buffer, length) == ESP_OK;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// write() - Has the flash task write bytes into the partition
+//=========================================================================================================
+bool CTelemetryStore::write(uint32_t offset, const void* data, int length)
+{
+    job_t job = {m_partition, offset, data, length};
+    return FlashIO.call("telemetry write", write_job, &job) == ESP_OK;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// erase() - Has the flash task erase sectors of the partition
+//=========================================================================================================
+bool CTelemetryStore::erase(uint32_t offset, int length)
+{
+    job_t job = {m_partition, offset, nullptr, length};
+    if (FlashIO.call("telemetry erase", erase_job, &job) != ESP_OK) return false;
+    Metrics.telemetry_erases.inc();
+    return true;
+}
+//=========================================================================================================
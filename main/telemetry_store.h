@@ -0,0 +1,49 @@
+//=========================================================================================================
+// telemetry_store.h - Defines the flash partition that holds the telemetry log
+//=========================================================================================================
+#pragma once
+#include <esp_partition.h>
+#include "common.h"
+#include "log_store.h"
+
+
+//=========================================================================================================
+// CTelemetryStore - Singleton class, gives CTelemetryLog access to its flash partition
+//
+// Reads go straight to the partition.  Writes and erases are run in the flash task by CFlashIO, like
+// every other write to flash
+//=========================================================================================================
+class CTelemetryStore : public CLogStore
+{
+public:
+
+    // Constructor
+    CTelemetryStore() {m_partition = nullptr; m_mutex = nullptr;}
+
+    // Call this once at startup.  Returns false if there's no telemetry partition
+    bool    begin();
+
+    // These implement CLogStore
+    uint32_t size() {return m_partition ? m_partition->size : 0;}
+    bool    read(uint32_t offset, void* buffer, int length);
+    bool    write(uint32_t offset, const void* data, int length);
+    bool    erase(uint32_t offset, int length);
+    void    lock()   {xSemaphoreTake(m_mutex, portMAX_DELAY);}
+    void    unlock() {xSemaphoreGive(m_mutex);}
+
+protected:
+
+    // These are the jobs that CFlashIO runs for us
+    static esp_err_t write_job(void* argument);
+    static esp_err_t erase_job(void* argument);
+
+    // Describes the write or erase that a job performs
+    struct job_t {const esp_partition_t* partition; uint32_t offset; const void* data; int length;};
+
+    // The flash partition that holds the log
+    const esp_partition_t* m_partition;
+
+    // Serializes access to the log
+    SemaphoreHandle_t m_mutex;
+};
+//=========================================================================================================
@@ -25,6 +25,9 @@ public:
     // Call this to get a reference to the text of the webpage
     char* text() {return m_page;}
 
+    // Call this to find the length of the text of the webpage
+    int   length() {return m_ptr - m_page;}
+
 
 private:
 
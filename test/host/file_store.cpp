@@ -0,0 +1,103 @@
+//=========================================================================================================
+// file_store.cpp - Implements a CLogStore kept in a file
+//=========================================================================================================
+#include <string.h>
+#include "file_store.h"
+
+
+//=========================================================================================================
+// open() - Opens the file, creating it (fully erased) if it doesn't exist
+//=========================================================================================================
+bool CFileStore::open(const char* path, uint32_t size)
+{
+    close();
+    m_size = size;
+
+    // If the file already exists, we're done
+    m_file = fopen(path, "r+b");
+    if (m_file) return true;
+
+    // Otherwise, create it and erase it
+    m_file = fopen(path, "w+b");
+    if (m_file == nullptr) return false;
+    for (uint32_t offset = 0; offset < m_size; offset += SECTOR_SIZE)
+    {
+        if (!erase(offset, SECTOR_SIZE)) return false;
+    }
+    m_erases = 0;
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// close() - Closes the file
+//=========================================================================================================
+void CFileStore::close()
+{
+    if (m_file) fclose(m_file);
+    m_file = nullptr;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// read() - Reads bytes from the file
+//=========================================================================================================
+bool CFileStore::read(uint32_t offset, void* buffer, int length)
+{
+    if (offset + length > m_size) return false;
+    if (fseek(m_file, offset, SEEK_SET) != 0) return false;
+    return fread(buffer, 1, length, m_file) == (size_t)length;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// write() - Writes bytes to the file.  Like NOR flash, a write can only clear bits
+//=========================================================================================================
+bool CFileStore::write(uint32_t offset, const void* data, int length)
+{
+    uint8_t buffer[SECTOR_SIZE];
+    const uint8_t* p = (const uint8_t*)data;
+
+    // Write the data a piece at a time, ANDing it into what's already there
+    while (length > 0)
+    {
+        int piece = length < SECTOR_SIZE ? length : SECTOR_SIZE;
+        if (!read(offset, buffer, piece)) return false;
+        for (int i=0; i<piece; ++i) buffer[i] &= p[i];
+        if (fseek(m_file, offset, SEEK_SET) != 0) return false;
+        if (fwrite(buffer, 1, piece, m_file) != (size_t)piece) return false;
+        offset += piece;
+        p      += piece;
+        length -= piece;
+    }
+
+    ++m_writes;
+    return fflush(m_file) == 0;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// erase() - Sets every byte of one or more whole sectors to 0xFF
+//=========================================================================================================
+bool CFileStore::erase(uint32_t offset, int length)
+{
+    uint8_t erased[SECTOR_SIZE];
+
+    // Like flash, an erase has to cover whole, aligned sectors
+    if (offset % SECTOR_SIZE || length % SECTOR_SIZE || offset + length > m_size) return false;
+
+    memset(erased, 0xFF, sizeof erased);
+    for (; length > 0; offset += SECTOR_SIZE, length -= SECTOR_SIZE)
+    {
+        if (fseek(m_file, offset, SEEK_SET) != 0) return false;
+        if (fwrite(erased, 1, SECTOR_SIZE, m_file) != SECTOR_SIZE) return false;
+        ++m_erases;
+    }
+
+    return fflush(m_file) == 0;
+}
+//=========================================================================================================
@@ -0,0 +1,48 @@
+//=========================================================================================================
+// file_store.h - Defines a CLogStore kept in a file, which stands in for a flash partition on a host
+//=========================================================================================================
+#pragma once
+#include <stdio.h>
+#include "log_store.h"
+
+
+//=========================================================================================================
+// CFileStore - A flash partition kept in a file.  Writes and erases behave the way NOR flash does
+//=========================================================================================================
+class CFileStore : public CLogStore
+{
+public:
+
+    // Constructor
+    CFileStore() {m_file = nullptr; m_size = 0; m_erases = m_writes = 0;}
+
+    // Destructor
+    ~CFileStore() {close();}
+
+    // Opens the file, creating it (fully erased) if it doesn't exist.  "size" is in bytes
+    bool    open(const char* path, uint32_t size);
+
+    // Closes the file
+    void    close();
+
+    // These implement CLogStore
+    uint32_t size() {return m_size;}
+    bool    read(uint32_t offset, void* buffer, int length);
+    bool    write(uint32_t offset, const void* data, int length);
+    bool    erase(uint32_t offset, int length);
+
+    // Returns the number of sectors that have been erased, and the number of writes
+    int     erases() {return m_erases;}
+    int     writes() {return m_writes;}
+
+protected:
+
+    // The file, and the size of the partition it holds
+    FILE*   m_file;
+    uint32_t m_size;
+
+    // The counters
+    int     m_erases;
+    int     m_writes;
+};
+//=========================================================================================================
@@ -0,0 +1,25 @@
+//=========================================================================================================
+// host_test.h - A minimal harness for the host tests
+//
+// Each test program calls CHECK() for every condition it tests, and returns test_result() from main().
+// A failed check reports its file, line and expression, and the program goes on to run the rest
+//=========================================================================================================
+#pragma once
+#include <stdio.h>
+
+// The number of checks that have failed
+static int test_failures = 0;
+
+// Checks a condition, and reports it if it's false
+#define CHECK(condition) \
+    do { if (!(condition)) {printf("%s:%i: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); ++test_failures;} } while (0)
+
+//=========================================================================================================
+// test_result() - Reports the outcome, and returns the exit code for main()
+//=========================================================================================================
+static int test_result()
+{
+    printf("%s\n", test_failures ? "FAILED" : "PASSED");
+    return test_failures ? 1 : 0;
+}
+//=========================================================================================================
@@ -0,0 +1,27 @@
+//=========================================================================================================
+// driver/gpio.h - Host stand-in for the ESP-IDF GPIO driver
+//
+// A host has no pins.  Every pin reads high, which is what an idle I2C bus looks like
+//=========================================================================================================
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+
+// The pins the firmware uses
+typedef enum {GPIO_NUM_5 = 5, GPIO_NUM_17 = 17, GPIO_NUM_34 = 34} gpio_num_t;
+
+typedef enum {GPIO_MODE_INPUT = 1, GPIO_MODE_OUTPUT = 2, GPIO_MODE_INPUT_OUTPUT_OD = 7} gpio_mode_t;
+typedef enum {GPIO_PULLUP_DISABLE, GPIO_PULLUP_ENABLE} gpio_pullup_t;
+
+struct gpio_config_t
+{
+    uint64_t        pin_bit_mask;
+    gpio_mode_t     mode;
+    gpio_pullup_t   pull_up_en;
+    int             pull_down_en;
+    int             intr_type;
+};
+
+inline esp_err_t gpio_config(const gpio_config_t*)        {return ESP_OK;}
+inline esp_err_t gpio_set_level(gpio_num_t, uint32_t)     {return ESP_OK;}
+inline int       gpio_get_level(gpio_num_t)               {return 1;}
@@ -0,0 +1,54 @@
+//=========================================================================================================
+// driver/i2c.h - Host stand-in for the ESP-IDF I2C driver
+//
+// A host has no I2C controller, so every transaction fails.  The host tests attach a CI2CHal to CI2C
+// instead, and CI2C never calls into the driver when one is attached
+//=========================================================================================================
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+
+typedef enum {I2C_NUM_0, I2C_NUM_1} i2c_port_t;
+typedef enum {I2C_MODE_SLAVE, I2C_MODE_MASTER} i2c_mode_t;
+typedef enum {I2C_MASTER_ACK, I2C_MASTER_NACK, I2C_MASTER_LAST_NACK} i2c_ack_type_t;
+
+#define I2C_MASTER_WRITE 0
+#define I2C_MASTER_READ  1
+
+struct i2c_config_t
+{
+    i2c_mode_t      mode;
+    int             sda_io_num;
+    int             scl_io_num;
+    bool            sda_pullup_en;
+    bool            scl_pullup_en;
+    struct {uint32_t clk_speed;} master;
+    uint32_t        clk_flags;
+};
+
+typedef void* i2c_cmd_handle_t;
+
+// The size of a buffer that holds a static command link of "transactions" transactions
+#define I2C_INTERNAL_STRUCT_SIZE 24
+#define I2C_LINK_RECOMMENDED_SIZE(transactions) \
+    (2 * I2C_INTERNAL_STRUCT_SIZE + I2C_INTERNAL_STRUCT_SIZE * (5 * (transactions)))
+
+inline esp_err_t i2c_param_config(i2c_port_t, const i2c_config_t*)                    {return ESP_FAIL;}
+inline esp_err_t i2c_driver_install(i2c_port_t, i2c_mode_t, size_t, size_t, int)      {return ESP_FAIL;}
+inline esp_err_t i2c_driver_delete(i2c_port_t)                                        {return ESP_FAIL;}
+
+inline i2c_cmd_handle_t i2c_cmd_link_create()                                         {return nullptr;}
+inline i2c_cmd_handle_t i2c_cmd_link_create_static(uint8_t*, uint32_t)                {return nullptr;}
+inline void      i2c_cmd_link_delete(i2c_cmd_handle_t)                                {}
+inline void      i2c_cmd_link_delete_static(i2c_cmd_handle_t)                         {}
+
+inline esp_err_t i2c_master_start(i2c_cmd_handle_t)                                   {return ESP_FAIL;}
+inline esp_err_t i2c_master_stop(i2c_cmd_handle_t)                                    {return ESP_FAIL;}
+inline esp_err_t i2c_master_write_byte(i2c_cmd_handle_t, uint8_t, bool)               {return ESP_FAIL;}
+inline esp_err_t i2c_master_write(i2c_cmd_handle_t, const uint8_t*, size_t, bool)     {return ESP_FAIL;}
+inline esp_err_t i2c_master_read(i2c_cmd_handle_t, uint8_t*, size_t, i2c_ack_type_t)  {return ESP_FAIL;}
+inline esp_err_t i2c_master_read_byte(i2c_cmd_handle_t, uint8_t*, i2c_ack_type_t)     {return ESP_FAIL;}
+inline esp_err_t i2c_master_cmd_begin(i2c_port_t, i2c_cmd_handle_t, TickType_t)      {return ESP_FAIL;}
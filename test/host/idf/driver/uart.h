@@ -0,0 +1,4 @@
+//=========================================================================================================
+// driver/uart.h - Host stand-in.  common.h includes this, but nothing built on the host uses it
+//=========================================================================================================
+#pragma once
@@ -0,0 +1,9 @@
+//=========================================================================================================
+// esp_attr.h - Host stand-in for the ESP-IDF memory placement attributes.  A host has only one kind of
+//              memory, so they do nothing
+//=========================================================================================================
+#pragma once
+
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
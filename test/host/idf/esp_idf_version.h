@@ -0,0 +1,12 @@
+//=========================================================================================================
+// esp_idf_version.h - Host stand-in for the ESP-IDF version.  This claims 4.4, so the code built on the
+//                     host takes the same paths as the firmware built with a current ESP-IDF
+//=========================================================================================================
+#pragma once
+
+#define ESP_IDF_VERSION_MAJOR 4
+#define ESP_IDF_VERSION_MINOR 4
+#define ESP_IDF_VERSION_PATCH 0
+
+#define ESP_IDF_VERSION_VAL(major, minor, patch) (((major) << 16) | ((minor) << 8) | (patch))
+#define ESP_IDF_VERSION ESP_IDF_VERSION_VAL(ESP_IDF_VERSION_MAJOR, ESP_IDF_VERSION_MINOR, ESP_IDF_VERSION_PATCH)
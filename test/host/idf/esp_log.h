@@ -0,0 +1,9 @@
+//=========================================================================================================
+// esp_log.h - Host stand-in for the ESP-IDF logging macros.  Like the real one, this brings in stdio
+//=========================================================================================================
+#pragma once
+#include <stdio.h>
+
+#define ESP_LOGE(tag, format, ...) printf(format "\n", ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) printf(format "\n", ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) printf(format "\n", ##__VA_ARGS__)
@@ -0,0 +1,8 @@
+//=========================================================================================================
+// esp_rom_sys.h - Host stand-in for the ESP32 ROM's busy-wait delay
+//=========================================================================================================
+#pragma once
+#include <stdint.h>
+
+// Waits for the specified number of microseconds
+void esp_rom_delay_us(uint32_t us);
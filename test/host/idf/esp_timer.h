@@ -0,0 +1,8 @@
+//=========================================================================================================
+// esp_timer.h - Host stand-in for the ESP-IDF high resolution timer
+//=========================================================================================================
+#pragma once
+#include <stdint.h>
+
+// Returns the number of microseconds since the program started
+int64_t esp_timer_get_time();
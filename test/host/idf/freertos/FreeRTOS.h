@@ -0,0 +1,24 @@
+//=========================================================================================================
+// freertos/FreeRTOS.h - Host stand-in for the FreeRTOS base types.  The kernel objects themselves are
+//                       implemented with C++ standard library threads in host_idf.cpp
+//=========================================================================================================
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_attr.h"
+
+typedef uint32_t TickType_t;
+typedef int      BaseType_t;
+typedef unsigned UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdFAIL  0
+#define pdPASS  1
+
+// A tick is a millisecond
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms)  ((TickType_t)(ms))
+
+// Waiting this many ticks means waiting forever
+#define portMAX_DELAY 0xFFFFFFFF
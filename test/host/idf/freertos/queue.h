@@ -0,0 +1,19 @@
+//=========================================================================================================
+// freertos/queue.h - Host stand-in for FreeRTOS queues
+//=========================================================================================================
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_queue* QueueHandle_t;
+
+// Creates a queue of "length" items, each "item_size" bytes long
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+
+// Copies an item onto the back of a queue, waiting up to "ticks" for room
+BaseType_t  xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks);
+
+// Copies the item at the front of a queue out and removes it, waiting up to "ticks" for one to arrive
+BaseType_t  xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks);
+
+// Returns the number of items in a queue
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
@@ -0,0 +1,23 @@
+//=========================================================================================================
+// freertos/semphr.h - Host stand-in for FreeRTOS semaphores.  As in FreeRTOS, a semaphore is a queue of
+//                     items with no data, and its count is the number of items in the queue
+//=========================================================================================================
+#pragma once
+#include "freertos/queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+// Creates a counting semaphore
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+
+// Creates a mutex, which starts out available.  Unlike a FreeRTOS mutex, this has no priority inheritance
+SemaphoreHandle_t xSemaphoreCreateMutex();
+
+// Takes a semaphore, waiting up to "ticks" for it to become available
+BaseType_t  xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+
+// Gives a semaphore back
+BaseType_t  xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+// Returns the count of a semaphore
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore);
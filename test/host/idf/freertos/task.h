@@ -0,0 +1,27 @@
+//=========================================================================================================
+// freertos/task.h - Host stand-in for FreeRTOS tasks and task notifications.  Each task is a thread.
+//                   Priorities and cores are ignored: the host's scheduler decides what runs
+//=========================================================================================================
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_task* TaskHandle_t;
+typedef void (*TaskFunction_t)(void* parameters);
+
+// Starts a task running "function"
+BaseType_t  xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stack_depth,
+                                    void* parameters, UBaseType_t priority, TaskHandle_t* p_handle,
+                                    BaseType_t core);
+
+// Returns the handle of the calling task (or thread)
+TaskHandle_t xTaskGetCurrentTaskHandle();
+
+// Increments a task's notification value
+BaseType_t  xTaskNotifyGive(TaskHandle_t task);
+
+// Waits up to "ticks" for the calling task's notification value to become non-zero, then returns it
+// and either clears it or decrements it
+uint32_t    ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+
+// Sleeps for the specified number of ticks
+void        vTaskDelay(TickType_t ticks);
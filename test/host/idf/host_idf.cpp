@@ -0,0 +1,215 @@
+//=========================================================================================================
+// host_idf.cpp - Implements the FreeRTOS and ESP-IDF stand-ins on top of C++ standard library threads
+//=========================================================================================================
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+
+
+//=========================================================================================================
+// host_queue - A FreeRTOS queue.  One condition variable is signalled whenever an item is added or
+//              removed, which wakes both senders waiting for room and receivers waiting for an item
+//=========================================================================================================
+struct host_queue
+{
+    std::mutex                          mutex;
+    std::condition_variable             changed;
+    UBaseType_t                         length;
+    UBaseType_t                         item_size;
+    std::deque<std::vector<uint8_t>>    items;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// host_task - A FreeRTOS task's notification value
+//=========================================================================================================
+struct host_task
+{
+    std::mutex              mutex;
+    std::condition_variable notified;
+    uint32_t                value = 0;
+};
+//=========================================================================================================
+
+
+// The task that the calling thread is running, or null if it hasn't asked for its handle yet
+static thread_local host_task* current_task = nullptr;
+
+
+//=========================================================================================================
+// wait() - Waits up to "ticks" for "is_ready" to become true.  Returns false on a timeout
+//=========================================================================================================
+template <class Predicate>
+static bool wait(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TickType_t ticks,
+                 Predicate is_ready)
+{
+    if (ticks != portMAX_DELAY)
+        return cv.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), is_ready);
+
+    cv.wait(lock, is_ready);
+    return true;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// Queues
+//=========================================================================================================
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    host_queue* queue = new host_queue;
+    queue->length    = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+
+    // Wait for room in the queue
+    if (!wait(queue->changed, lock, ticks, [queue] {return queue->items.size() < queue->length;}))
+        return pdFAIL;
+
+    // Copy the item onto the back of the queue, and wake anyone waiting for it
+    const uint8_t* p = (const uint8_t*)item;
+    queue->items.push_back(std::vector<uint8_t>(p, p + queue->item_size));
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+
+    // Wait for an item to arrive
+    if (!wait(queue->changed, lock, ticks, [queue] {return !queue->items.empty();})) return pdFALSE;
+
+    // Copy the item out of the queue, and wake anyone waiting for room
+    if (queue->item_size) memcpy(item, queue->items.front().data(), queue->item_size);
+    queue->items.pop_front();
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    return queue->items.size();
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// Semaphores
+//=========================================================================================================
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    SemaphoreHandle_t semaphore = xQueueCreate(max_count, 0);
+    while (initial_count--) xSemaphoreGive(semaphore);
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    return xQueueReceive(semaphore, nullptr, ticks);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return xQueueSend(semaphore, nullptr, 0);
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore)
+{
+    return uxQueueMessagesWaiting(semaphore);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// Tasks and task notifications
+//=========================================================================================================
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char*, uint32_t, void* parameters,
+                                   UBaseType_t, TaskHandle_t* p_handle, BaseType_t)
+{
+    host_task* task = new host_task;
+
+    // The thread runs for the life of the program, just as a firmware task does
+    std::thread([function, parameters, task] {current_task = task; function(parameters);}).detach();
+
+    if (p_handle) *p_handle = task;
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    if (current_task == nullptr) current_task = new host_task;
+    return current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    std::unique_lock<std::mutex> lock(task->mutex);
+    ++task->value;
+    task->notified.notify_all();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    host_task* task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->mutex);
+
+    // Wait for a notification.  On a timeout, the value is left alone
+    if (!wait(task->notified, lock, ticks, [task] {return task->value != 0;})) return 0;
+
+    // Hand back the value, and clear or decrement it
+    uint32_t value = task->value;
+    task->value = clear_on_exit ? 0 : value - 1;
+    return value;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// esp_timer_get_time() - Returns the number of microseconds since the program started
+//=========================================================================================================
+int64_t esp_timer_get_time()
+{
+    static const auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// esp_rom_delay_us() - Waits for the specified number of microseconds
+//=========================================================================================================
+void esp_rom_delay_us(uint32_t us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+//=========================================================================================================
@@ -0,0 +1,155 @@
+//=========================================================================================================
+// test_crc32.cpp - Checks the slicing-by-8 CRC-32 against a bit-at-a-time reference, and measures both
+//=========================================================================================================
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "host_test.h"
+#include "crc32.h"
+
+
+//=========================================================================================================
+// reference_crc() - The textbook CRC-32, computed one bit at a time
+//=========================================================================================================
+static uint32_t reference_crc(const void* buffer, size_t length)
+{
+    const uint8_t* p = (const uint8_t*)buffer;
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (length--)
+    {
+        crc ^= *p++;
+        for (int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+    }
+
+    return ~crc;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// fill() - Fills a buffer with the same pseudo-random bytes on every run
+//=========================================================================================================
+static void fill(uint8_t* buffer, size_t length)
+{
+    uint32_t state = 12345;
+    for (size_t i=0; i<length; ++i)
+    {
+        state = state * 1103515245 + 12345;
+        buffer[i] = (uint8_t)(state >> 16);
+    }
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_check_value() - Checks the standard CRC-32 check value, and the CRC of nothing
+//=========================================================================================================
+static void test_check_value()
+{
+    CHECK(crc32_update(0, "123456789", 9) == 0xCBF43926);
+    CHECK(reference_crc("123456789", 9)   == 0xCBF43926);
+    CHECK(crc32_update(0, "", 0) == 0);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_alignment() - Checks every length from 0 thru 299 at every alignment from 0 thru 7, which covers
+//                    every combination of leading bytes, 8-byte steps, and trailing bytes
+//=========================================================================================================
+static void test_alignment()
+{
+    uint8_t data[8 + 300];
+    fill(data, sizeof data);
+
+    int mismatches = 0;
+    for (int alignment = 0; alignment < 8; ++alignment)
+    {
+        for (int length = 0; length < 300; ++length)
+        {
+            mismatches += crc32_update(0, data + alignment, length) != reference_crc(data + alignment, length);
+        }
+    }
+    CHECK(mismatches == 0);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_streaming() - Checks that a CRC computed in two pieces, split at every point, matches the CRC
+//                    computed in one piece, both with crc32_update() and with CCRC32
+//=========================================================================================================
+static void test_streaming()
+{
+    uint8_t data[300];
+    fill(data, sizeof data);
+    uint32_t expected = reference_crc(data, sizeof data);
+
+    int mismatches = 0;
+    for (size_t split = 0; split <= sizeof data; ++split)
+    {
+        uint32_t crc = crc32_update(0, data, split);
+        mismatches += crc32_update(crc, data + split, sizeof data - split) != expected;
+
+        CCRC32 streamed;
+        streamed.update(data, split);
+        streamed.update(data + split, sizeof data - split);
+        mismatches += streamed.value() != expected;
+    }
+    CHECK(mismatches == 0);
+
+    // reset() starts over
+    CCRC32 streamed;
+    streamed.update(data, 10);
+    streamed.reset();
+    streamed.update("123456789", 9);
+    CHECK(streamed.value() == 0xCBF43926);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_speed() - Measures how fast each method runs over a 1 MB buffer
+//=========================================================================================================
+static void test_speed()
+{
+    const size_t    SIZE = 1024 * 1024;
+    const int       PASSES = 20;
+    static uint8_t  data[SIZE];
+    fill(data, SIZE);
+
+    // The slicing-by-8 tables
+    uint32_t crc = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < PASSES; ++pass) crc = crc32_update(crc, data, SIZE);
+    double fast_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // The bit-at-a-time reference, which is much slower, so it gets a single pass
+    start = std::chrono::steady_clock::now();
+    uint32_t reference = reference_crc(data, SIZE);
+    double reference_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CHECK(crc32_update(0, data, SIZE) == reference);
+
+    // Keep the compiler from discarding the timed passes
+    if (crc == 0) printf("(crc 0)\n");
+
+    double mb = SIZE / 1e6;
+    printf("slicing-by-8: %.0f MB/s, bit-at-a-time reference: %.0f MB/s\n",
+           mb * PASSES / fast_seconds, mb / reference_seconds);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// main() - Runs the tests
+//=========================================================================================================
+int main()
+{
+    test_check_value();
+    test_alignment();
+    test_streaming();
+    test_speed();
+    return test_result();
+}
+//=========================================================================================================
@@ -0,0 +1,502 @@
+//=========================================================================================================
+// test_i2c_drivers.cpp - Runs the real CI2C, CHT16K33 and CSHT31 against the simulated bus and devices
+//
+// The drivers are the firmware's own sources.  CI2C's bus task runs on a host thread (see idf/), and
+// performs every transaction on a CSimI2CBus attached as its HAL.  So these tests check what the
+// drivers actually put on the bus: the frame diffs the display sends, the retries the sensor makes,
+// and what each of them costs in transactions, bytes and bus time
+//=========================================================================================================
+#include <math.h>
+#include <string.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "host_test.h"
+#include "i2c_bus.h"
+#include "ht16k33.h"
+#include "sht31.h"
+#include "metrics.h"
+#include "sim_i2c.h"
+
+// The I2C addresses the firmware uses for the two devices
+const int HT16K33_ADDRESS = 0x70;
+const int SHT31_ADDRESS   = 0x44;
+
+// The objects the drivers expect to find.  NVRAM comes from nvram.cpp
+CI2C     I2C;
+CMetrics Metrics;
+
+// The gauges that sample the rest of the firmware have nothing to sample on a host
+S32 sample_rssi()        {return 0;}
+S32 sample_free_heap()   {return 0;}
+S32 sample_uptime()      {return 0;}
+S32 sample_flash_queue() {return 0;}
+S32 sample_i2c_queue()   {return I2C.queue_depth();}
+S32 sample_i2c_speed()   {return (S32)NVRAM.i2c_speed;}
+
+
+//=========================================================================================================
+// CGatedBus - Passes transactions through to the simulated bus.  While the gate is closed, the bus task
+//             is held inside its transaction, so that requests pile up in CI2C's queues
+//=========================================================================================================
+class CGatedBus : public CI2CHal
+{
+public:
+
+    CGatedBus(CI2CHal* bus) {m_bus = bus; m_is_closed = false; m_is_holding = false;}
+
+    // Closes and opens the gate
+    void    close() {std::unique_lock<std::mutex> lock(m_mutex); m_is_closed = true;}
+    void    open()  {std::unique_lock<std::mutex> lock(m_mutex); m_is_closed = false; m_changed.notify_all();}
+
+    // Waits until the bus task is being held at the gate
+    void    wait_for_hold()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this] {return m_is_holding;});
+    }
+
+    // Implements CI2CHal
+    i2c_result_t transact(int address, bool is_read, const uint8_t* reg, int reg_length,
+                          uint8_t* data, int length)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_is_holding = m_is_closed;
+        m_changed.notify_all();
+        m_changed.wait(lock, [this] {return !m_is_closed;});
+        m_is_holding = false;
+        lock.unlock();
+        return m_bus->transact(address, is_read, reg, reg_length, data, length);
+    }
+
+protected:
+
+    CI2CHal*                m_bus;
+    std::mutex              m_mutex;
+    std::condition_variable m_changed;
+    bool                    m_is_closed;
+    bool                    m_is_holding;
+};
+//=========================================================================================================
+
+
+// The simulated bus and devices, and the gate that CI2C reaches them through
+static CSimI2CBus  bus;
+static CSimHT16K33 sim_display(HT16K33_ADDRESS);
+static CSimSHT31   sim_sensor(SHT31_ADDRESS);
+static CGatedBus   gate(&bus);
+
+
+//=========================================================================================================
+// stats_for() - Returns CI2C's statistics for a device address
+//=========================================================================================================
+static i2c_device_stats_t stats_for(int address)
+{
+    for (int i=0; i<I2C.device_count(); ++i)
+    {
+        if (I2C.device_stats(i).address == address) return I2C.device_stats(i);
+    }
+
+    i2c_device_stats_t none;
+    memset(&none, 0, sizeof none);
+    return none;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// CBusCounts - Snapshots the counters, so a test can check what a single operation did
+//=========================================================================================================
+struct CBusCounts
+{
+    CBusCounts()
+    {
+        bus.reset_counters();
+        i2c_transactions  = Metrics.i2c_transactions.value();
+        i2c_errors        = Metrics.i2c_errors.value();
+        display_bus_bytes = Metrics.display_bus_bytes.value();
+        display_updates   = Metrics.display_updates.value();
+        sht31_reads       = Metrics.sht31_reads.value();
+        sht31_crc_errors  = Metrics.sht31_crc_errors.value();
+        sht31_failures    = Metrics.sht31_failures.value();
+    }
+
+    U32 i2c_transactions, i2c_errors, display_bus_bytes, display_updates;
+    U32 sht31_reads, sht31_crc_errors, sht31_failures;
+};
+//=========================================================================================================
+
+
+//=========================================================================================================
+// is_shadow_correct() - Returns true if CHT16K33's copy of display RAM matches the device
+//=========================================================================================================
+static bool is_shadow_correct(CHT16K33& display)
+{
+    U8 frame[CHT16K33::FRAME_SIZE];
+    display.get_frame(frame);
+    return memcmp(frame, sim_display.ram(), sizeof frame) == 0;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_display_init() - Checks the start-up sequence
+//=========================================================================================================
+static void test_display_init(CHT16K33& display)
+{
+    // Leave some junk in display RAM, the way a warm reboot would
+    const seg_frame_t junk = make_frame("8888", COLON_CENTER);
+    U8 reg = 0;
+    bus.transact(HT16K33_ADDRESS, false, &reg, 1, (U8*)junk.ram, DISPLAY_RAM_SIZE);
+
+    CBusCounts before;
+    display.init(HT16K33_ADDRESS);
+
+    // The oscillator is on, the display is on and not blinking, and it's at full brightness
+    CHECK(sim_display.is_oscillator_on() && sim_display.is_display_on());
+    CHECK(sim_display.blink() == 0 && sim_display.brightness() == 15);
+    CHECK(display.brightness() == 15);
+
+    // Display RAM was cleared, and the driver knows it
+    const seg_frame_t blank = make_frame("");
+    CHECK(memcmp(sim_display.ram(), blank.ram, DISPLAY_RAM_SIZE) == 0);
+    CHECK(is_shadow_correct(display));
+
+    // Oscillator on (twice: once to see if the device is there), row driver, all of RAM in a single
+    // write, display on, and brightness
+    CHECK(bus.transactions() == 6);
+    CHECK(bus.bytes() == 5 + 1 + DISPLAY_RAM_SIZE);
+
+    // The display's byte count includes the address byte of each transaction
+    CHECK(Metrics.display_bus_bytes.value() - before.display_bus_bytes == bus.bytes() + bus.transactions());
+    CHECK(Metrics.i2c_transactions.value() - before.i2c_transactions == bus.transactions());
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_display_diffs() - Checks that each update sends only the bytes of display RAM that changed
+//=========================================================================================================
+static void test_display_diffs(CHT16K33& display)
+{
+    char text[DISPLAY_DIGITS + 1];
+
+    // From a blank display, "12:34" changes RAM addresses 0, 2, 4, 6 and 8.  The gaps between them are
+    // small enough that they all go out as one write of addresses 0 thru 8
+    {
+        CBusCounts before;
+        display.show_time(12, 34);
+        sim_display.render(text);
+        CHECK(strcmp(text, "1234") == 0 && sim_display.colon());
+        CHECK(is_shadow_correct(display));
+        CHECK(bus.transactions() == 1 && bus.bytes() == 1 + 9);
+        CHECK(Metrics.display_bus_bytes.value() - before.display_bus_bytes == 2 + 9);
+    }
+
+    // A minute later only the last digit changes: one byte of RAM, 2 + 9 * 3 = 29 bits on the bus
+    {
+        CBusCounts before;
+        display.show_time(12, 35);
+        sim_display.render(text);
+        CHECK(strcmp(text, "1235") == 0);
+        CHECK(bus.transactions() == 1 && bus.bytes() == 2);
+        CHECK(bus.elapsed_us() == 29 * 1000000 / I2C.speed());
+        CHECK(Metrics.display_bus_bytes.value() - before.display_bus_bytes == 3);
+    }
+
+    // Showing the same time again is counted as an update, but nothing goes out on the bus
+    {
+        CBusCounts before;
+        display.show_time(12, 35);
+        CHECK(bus.transactions() == 0);
+        CHECK(Metrics.display_updates.value() - before.display_updates == 1);
+        CHECK(Metrics.display_bus_bytes.value() == before.display_bus_bytes);
+    }
+
+    // " 9:05" changes addresses 0, 2 and 6.  Addresses 0 and 2 are merged, but the gap from 2 to 6 is
+    // too wide, so 6 goes out in a write of its own
+    {
+        CBusCounts before;
+        display.show_time(9, 5);
+        sim_display.render(text);
+        CHECK(strcmp(text, " 905") == 0);
+        CHECK(is_shadow_correct(display));
+        CHECK(bus.transactions() == 2 && bus.bytes() == (1 + 3) + (1 + 1));
+    }
+
+    // The same digits without the colon only change the colon's byte
+    {
+        CBusCounts before;
+        display.show_string(" 905");
+        CHECK(!sim_display.colon());
+        CHECK(bus.transactions() == 1 && bus.bytes() == 2);
+    }
+
+    // A number is a frame like any other, and showing it twice costs nothing the second time
+    {
+        CBusCounts before;
+        display.show_number(42);
+        sim_display.render(text);
+        CHECK(strcmp(text, "  42") == 0);
+        CHECK(is_shadow_correct(display));
+        U32 transactions = bus.transactions();
+        display.show_number(42);
+        CHECK(bus.transactions() == transactions);
+    }
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_display_settings() - Checks that brightness and blink commands are only sent when they change
+//=========================================================================================================
+static void test_display_settings(CHT16K33& display)
+{
+    // The display is already at full brightness
+    {
+        CBusCounts before;
+        display.set_brightness(15);
+        CHECK(bus.transactions() == 0);
+    }
+
+    // A new brightness is a single command byte
+    {
+        CBusCounts before;
+        display.set_brightness(7);
+        CHECK(bus.transactions() == 1 && bus.bytes() == 1);
+        CHECK(sim_display.brightness() == 7 && display.brightness() == 7);
+    }
+
+    // Out of range levels are clamped
+    display.set_brightness(99);
+    CHECK(sim_display.brightness() == 15);
+    display.set_brightness(-1);
+    CHECK(sim_display.brightness() == 0);
+
+    // Waiting for NTP blinks the colon at 2 Hz.  Asking again sends nothing
+    {
+        CBusCounts before;
+        display.show_wait_for_ntp();
+        CHECK(sim_display.blink() == 1 && sim_display.colon());
+        CHECK(is_shadow_correct(display));
+        U32 transactions = bus.transactions();
+        display.show_wait_for_ntp();
+        CHECK(bus.transactions() == transactions);
+    }
+
+    // Showing the time turns blinking back off
+    display.show_time(10, 0);
+    CHECK(sim_display.blink() == 0 && sim_display.is_display_on());
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_display_naks() - Checks that a write the display NAKs is retried by the next update
+//=========================================================================================================
+static void test_display_naks(CHT16K33& display)
+{
+    char text[DISPLAY_DIGITS + 1];
+    U32  naks = stats_for(HT16K33_ADDRESS).naks;
+
+    // The write is NAKed, so the device still shows the old time, and the driver knows that
+    {
+        CBusCounts before;
+        sim_display.inject_naks(1);
+        display.show_time(10, 1);
+        sim_display.render(text);
+        CHECK(strcmp(text, "1000") == 0);
+        CHECK(is_shadow_correct(display));
+        CHECK(bus.transactions() == 1 && bus.bytes() == 0);
+        CHECK(Metrics.i2c_errors.value() - before.i2c_errors == 1);
+        CHECK(stats_for(HT16K33_ADDRESS).naks == naks + 1);
+    }
+
+    // The next update of the same frame sends the byte that didn't make it
+    {
+        CBusCounts before;
+        display.show_time(10, 1);
+        sim_display.render(text);
+        CHECK(strcmp(text, "1001") == 0);
+        CHECK(is_shadow_correct(display));
+        CHECK(bus.transactions() == 1 && bus.bytes() == 2);
+    }
+
+    // A NAKed brightness command leaves the brightness unchanged, so it's sent again next time
+    int level = display.brightness();
+    sim_display.inject_naks(1);
+    display.set_brightness(level + 1);
+    CHECK(sim_display.brightness() == level && display.brightness() == level);
+    display.set_brightness(level + 1);
+    CHECK(sim_display.brightness() == level + 1 && display.brightness() == level + 1);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_sht31() - Checks readings, and the handling of CRC errors and NAKs
+//=========================================================================================================
+static void test_sht31()
+{
+    CSHT31 sensor(SHT31_ADDRESS);
+    float  temp = 0;
+    int    rh = 0;
+
+    // 0x6666 is 24.99 C, and 0x8000 is 50% relative humidity
+    sim_sensor.set_raw(0x6666, 0x8000);
+
+    // A clean reading is two transactions: the 2-byte command, then 6 bytes of response
+    {
+        CBusCounts before;
+        int measurements = sim_sensor.measurements();
+        CHECK(sensor.read_c(&temp, &rh));
+        CHECK(fabs(temp - 24.99F) < 0.005F && rh == 50);
+        CHECK(bus.transactions() == 2 && bus.bytes() == 2 + 6);
+        CHECK(sim_sensor.measurements() == measurements + 1);
+        CHECK(Metrics.sht31_reads.value() - before.sht31_reads == 1);
+        CHECK(Metrics.sht31_temp_centi_c.value() == 2499 && Metrics.sht31_humidity.value() == 50);
+    }
+
+    // Fahrenheit comes from the same reading
+    CHECK(sensor.read_f(&temp));
+    CHECK(fabs(temp - 76.99F) < 0.005F);
+
+    // A corrupted CRC is counted, and the reading is retried
+    {
+        CBusCounts before;
+        sim_sensor.inject_crc_errors(1);
+        CHECK(sensor.read_c(&temp, &rh));
+        CHECK(fabs(temp - 24.99F) < 0.005F);
+        CHECK(bus.transactions() == 4);
+        CHECK(Metrics.sht31_reads.value()      - before.sht31_reads      == 2);
+        CHECK(Metrics.sht31_crc_errors.value() - before.sht31_crc_errors == 1);
+        CHECK(Metrics.sht31_failures.value()  == before.sht31_failures);
+    }
+
+    // Three corrupted readings in a row is a failure
+    {
+        CBusCounts before;
+        sim_sensor.inject_crc_errors(3);
+        CHECK(!sensor.read_c(&temp, &rh));
+        CHECK(bus.transactions() == 6);
+        CHECK(Metrics.sht31_crc_errors.value() - before.sht31_crc_errors == 3);
+        CHECK(Metrics.sht31_failures.value()   - before.sht31_failures   == 1);
+        sim_sensor.inject_crc_errors(0);
+    }
+
+    // A NAKed command isn't followed by the read.  The retry succeeds
+    {
+        CBusCounts before;
+        sim_sensor.inject_naks(1);
+        CHECK(sensor.read_c(&temp, &rh));
+        CHECK(bus.transactions() == 1 + 2 && bus.bytes() == 2 + 6);
+        CHECK(Metrics.i2c_errors.value()  - before.i2c_errors  == 1);
+        CHECK(Metrics.sht31_reads.value() - before.sht31_reads == 2);
+        CHECK(Metrics.sht31_crc_errors.value() == before.sht31_crc_errors);
+    }
+
+    // A sensor that NAKs every attempt is a failure, and is given exactly three tries
+    {
+        CBusCounts before;
+        sim_sensor.inject_naks(3);
+        CHECK(!sensor.read_c(&temp, &rh));
+        CHECK(bus.transactions() == 3 && bus.bytes() == 0);
+        CHECK(Metrics.sht31_failures.value() - before.sht31_failures == 1);
+        CHECK(Metrics.i2c_errors.value()     - before.i2c_errors     == 3);
+    }
+
+    // A simulated temperature doesn't touch the bus, unless humidity is wanted too
+    {
+        CBusCounts before;
+        sensor.simulate_temp(30);
+        CHECK(sensor.read_c(&temp) && temp == 30);
+        CHECK(bus.transactions() == 0);
+        CHECK(sensor.read_c(&temp, &rh) && temp == 30 && rh == 50);
+        CHECK(bus.transactions() == 2);
+        sensor.simulate_temp(CSHT31::SIM_TEMP_OFF);
+    }
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// record_order() - A completion callback that appends the request's label to a string
+//=========================================================================================================
+static void record_order(i2c_request_t* request)
+{
+    static std::mutex mutex;
+    std::unique_lock<std::mutex> lock(mutex);
+    std::string* p_order = (std::string*)request->context;
+    p_order->push_back((char)request->reg[0]);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_priority() - Checks that a display refresh is performed ahead of background requests that were
+//                   queued before it
+//=========================================================================================================
+static void test_priority()
+{
+    i2c_request_t request[4];
+    std::string   order;
+
+    // 'A' occupies the bus task.  While it's held, 'B' and 'C' are queued at low priority, then 'D' at
+    // high priority.  The labels are register bytes the simulated display NAKs, which doesn't matter
+    const char*          labels     = "ABCD";
+    const i2c_priority_t priority[] = {I2C_PRIO_LOW, I2C_PRIO_LOW, I2C_PRIO_LOW, I2C_PRIO_HIGH};
+
+    gate.close();
+    for (int i=0; i<4; ++i)
+    {
+        I2C.prepare(&request[i], I2C_WRITE, HT16K33_ADDRESS, labels[i], 1, nullptr, 0, priority[i]);
+        request[i].callback = record_order;
+        request[i].context  = &order;
+        I2C.submit(&request[i]);
+        if (i == 0) gate.wait_for_hold();
+    }
+
+    // The three behind 'A' are waiting
+    CHECK(I2C.queue_depth() == 3);
+    CHECK(Metrics.i2c_queue_depth.value() == 3);
+
+    // Let them through, and wait for them all to finish
+    gate.open();
+    for (int i=0; i<4; ++i)
+    {
+        while (!request[i].is_complete) std::this_thread::yield();
+    }
+
+    // 'D' jumped the queue, and the rest went in the order they were queued
+    CHECK(order == "ADBC");
+    CHECK(I2C.queue_depth() == 0);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// main() - Starts the bus task on the simulated bus, and runs the tests
+//=========================================================================================================
+int main()
+{
+    CHT16K33 display;
+
+    // Put both devices on the simulated bus, and have CI2C reach it through the gate
+    bus.attach(&sim_display);
+    bus.attach(&sim_sensor);
+    I2C.attach_hal(&gate);
+    I2C.init(I2C_NUM_0, PIN_I2C_SDA, PIN_I2C_SCL);
+
+    // Model bus time at the speed CI2C chose
+    bus.set_speed(I2C.speed());
+
+    test_display_init(display);
+    test_display_diffs(display);
+    test_display_settings(display);
+    test_display_naks(display);
+    test_sht31();
+    test_priority();
+    return test_result();
+}
+//=========================================================================================================
@@ -0,0 +1,285 @@
+//=========================================================================================================
+// test_series_codec.cpp - Tests the series codec, and the export of the telemetry log that uses it
+//=========================================================================================================
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include "host_test.h"
+#include "series_codec.h"
+#include "file_store.h"
+#include "telemetry_log.h"
+
+// The file that stands in for the telemetry partition
+static const char* STORE_FILE = "codec_test.bin";
+
+
+//=========================================================================================================
+// random_next() - A small pseudo-random generator, so that every run sees the same data
+//=========================================================================================================
+static uint32_t random_state = 12345;
+static int random_next(int range)
+{
+    random_state = random_state * 1103515245 + 12345;
+    return (random_state >> 16) % range;
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_round_trip() - Checks that samples decode exactly as they were encoded, including large and
+//                     negative jumps, and that a full block refuses more samples
+//=========================================================================================================
+static void test_round_trip()
+{
+    const int COUNT = 500;
+    sensor_sample_t input[COUNT], output;
+    uint8_t         block[1024];
+    CSeriesEncoder  encoder;
+    CSeriesDecoder  decoder;
+
+    // Samples at a steady rate with small changes, plus gaps, clock steps, and extreme values
+    uint32_t timestamp = 1700000000;
+    for (int i=0; i<COUNT; ++i)
+    {
+        timestamp += (i % 97 == 0) ? 3600 : (i % 131 == 0) ? -7200 : 60;
+        input[i].timestamp = timestamp;
+        input[i].raw_temp  = (i % 50 == 0) ? 0xFFFF * (i % 100 == 0) : 26000 + random_next(40);
+        input[i].raw_rh    = 30000 + random_next(2000);
+    }
+
+    // Encode and decode them a block at a time
+    int decoded = 0;
+    for (int first = 0; first < COUNT; )
+    {
+        encoder.begin(block, sizeof block);
+        while (first < COUNT && encoder.add(input[first])) ++first;
+        CHECK(encoder.count() > 0 && encoder.length() <= (int)sizeof block);
+
+        CHECK(decoder.begin(block, encoder.length()));
+        CHECK(decoder.count() == encoder.count());
+        while (decoder.next(&output))
+        {
+            CHECK(output.timestamp == input[decoded].timestamp);
+            CHECK(output.raw_temp  == input[decoded].raw_temp);
+            CHECK(output.raw_rh    == input[decoded].raw_rh);
+            ++decoded;
+        }
+    }
+    CHECK(decoded == COUNT);
+
+    // A block too small for even one more sample refuses it
+    encoder.begin(block, CSeriesEncoder::HEADER_BYTES + CSeriesEncoder::MAX_SAMPLE_BYTES);
+    CHECK(encoder.add(input[0]));
+    CHECK(!encoder.add(input[1]));
+    CHECK(encoder.count() == 1);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_clock_steps() - Checks that the largest steps a clock can take, such as a first sync from 1970
+//                      followed by a reset back to 1970, round-trip exactly
+//=========================================================================================================
+static void test_clock_steps()
+{
+    const uint32_t  times[] = {0, 1780000000, 0, 1780000000, 1780000060, 0xFFFFFFFF, 0, 5};
+    const int       COUNT   = sizeof times / sizeof times[0];
+    sensor_sample_t sample = {0, 26000, 30000};
+    uint8_t         block[256];
+    CSeriesEncoder  encoder;
+    CSeriesDecoder  decoder;
+
+    encoder.begin(block, sizeof block);
+    for (int i=0; i<COUNT; ++i)
+    {
+        sample.timestamp = times[i];
+        CHECK(encoder.add(sample));
+    }
+
+    int decoded = 0;
+    CHECK(decoder.begin(block, encoder.length()));
+    while (decoder.next(&sample)) CHECK(decoded < COUNT && sample.timestamp == times[decoded++]);
+    CHECK(decoded == COUNT);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_corrupt() - Checks that a block of the wrong format or a truncated block is rejected
+//=========================================================================================================
+static void test_corrupt()
+{
+    uint8_t         block[256];
+    sensor_sample_t sample = {1700000000, 26000, 30000};
+    CSeriesEncoder  encoder;
+    CSeriesDecoder  decoder;
+
+    encoder.begin(block, sizeof block);
+    for (int i=0; i<10; ++i)
+    {
+        sample.timestamp += 60;
+        encoder.add(sample);
+    }
+
+    // A truncated block runs out before the last sample
+    int decoded = 0;
+    CHECK(decoder.begin(block, encoder.length() - 2));
+    while (decoder.next(&sample)) ++decoded;
+    CHECK(decoded < 10);
+
+    // An unknown format version is rejected, as is a block shorter than its header
+    block[0] = 99;
+    CHECK(!decoder.begin(block, encoder.length()));
+    CHECK(!decoder.begin(block, 2));
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_export() - Exports a day of readings from the telemetry log, checks that every reading comes back
+//                 exactly, and measures the size of the export against the records stored in flash
+//=========================================================================================================
+static void test_export()
+{
+    CFileStore      store;
+    CTelemetryLog   log;
+    CSeriesDecoder  decoder;
+    telemetry_rec_t record;
+    sensor_sample_t sample;
+    uint8_t         buffer[2 + TELEMETRY_EXPORT_BLOCK];
+
+    remove(STORE_FILE);
+    CHECK(store.open(STORE_FILE, 8 * CLogStore::SECTOR_SIZE));
+    CHECK(log.begin(&store));
+
+    // A day of readings, one a minute as main.cpp logs them: a slow daily swing plus sensor noise
+    const int READINGS = 24 * 60;
+    for (int i=0; i<READINGS; ++i)
+    {
+        double  hours = i / 60.0;
+        int16_t temp  = (int16_t)(2100 + 300 * sin(hours * M_PI / 12) + random_next(7) - 3);
+        uint8_t rh    = (uint8_t)(45 - 10 * sin(hours * M_PI / 12) + random_next(2));
+        CHECK(log.append(1700000000 + i * 60, temp, rh));
+    }
+    CHECK(log.count() == READINGS);
+
+    // Export the log, decoding as we go.  Each sample must convert back to its record with the formulas
+    // CSHT31 uses
+    int index = 0, length, exported = 0, decoded = 0, blocks = 0;
+    while ((length = log.export_block(&index, buffer, sizeof buffer)) != 0)
+    {
+        int block_length = buffer[0] | (buffer[1] << 8);
+        CHECK(block_length + 2 == length && block_length <= TELEMETRY_EXPORT_BLOCK);
+        exported += length;
+        ++blocks;
+
+        CHECK(decoder.begin(buffer + 2, block_length));
+        while (decoder.next(&sample))
+        {
+            CHECK(log.read(decoded, &record));
+            CHECK(sample.timestamp == record.timestamp);
+            CHECK(((17500 * (uint32_t)sample.raw_temp) >> 16) - 4500 == (uint32_t)(int32_t)record.temp_centi_c);
+            CHECK(((100 * (uint32_t)sample.raw_rh) >> 16) == record.humidity);
+            ++decoded;
+        }
+    }
+    CHECK(decoded == READINGS && index == READINGS);
+
+    // The export is far smaller than the records it came from
+    int stored = READINGS * sizeof(telemetry_rec_t);
+    printf("%i readings: %i bytes stored, %i bytes exported in %i blocks (%.2f bytes per reading, %.2fx)\n",
+           READINGS, stored, exported, blocks, (double)exported / READINGS, (double)stored / exported);
+    CHECK(exported * 2 < stored);
+
+    // The extremes of the sensor's range survive the conversion
+    CHECK(log.append(1700100000, -4500, 0));
+    CHECK(log.append(1700100060, 12999, 99));
+    CHECK(log.export_block(&index, buffer, sizeof buffer) > 0);
+    CHECK(decoder.begin(buffer + 2, buffer[0] | (buffer[1] << 8)));
+    CHECK(decoder.next(&sample) && sample.raw_temp == 0 && sample.raw_rh == 0);
+    CHECK(decoder.next(&sample) && ((17500 * (uint32_t)sample.raw_temp) >> 16) == 12999 + 4500);
+    CHECK(((100 * (uint32_t)sample.raw_rh) >> 16) == 99);
+
+    // Once everything has been exported, there's nothing more
+    CHECK(log.export_block(&index, buffer, sizeof buffer) == 0);
+
+    store.close();
+    remove(STORE_FILE);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_speed() - Encodes and decodes a synthetic day of 1 Hz readings, and reports the compression ratio
+//                and how fast the codec runs.  Throughput is measured in bytes of sensor_sample_t
+//=========================================================================================================
+static void test_speed()
+{
+    const int               COUNT = 24 * 60 * 60;
+    static sensor_sample_t  input[COUNT];
+    static uint8_t          encoded[COUNT * CSeriesEncoder::MAX_SAMPLE_BYTES];
+    static int              block_length[COUNT];
+    CSeriesEncoder          encoder;
+    CSeriesDecoder          decoder;
+    sensor_sample_t         sample;
+
+    // A slow daily swing in temperature and humidity, plus sensor noise
+    for (int i=0; i<COUNT; ++i)
+    {
+        double hours = i / 3600.0;
+        input[i].timestamp = 1700000000 + i;
+        input[i].raw_temp  = (uint16_t)(26000 + 1200 * sin(hours * M_PI / 12) + random_next(9));
+        input[i].raw_rh    = (uint16_t)(30000 - 6000 * sin(hours * M_PI / 12) + random_next(17));
+    }
+
+    // Encode the day in export-sized blocks
+    int blocks = 0, length = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int first = 0; first < COUNT; ++blocks)
+    {
+        encoder.begin(encoded + length, TELEMETRY_EXPORT_BLOCK);
+        while (first < COUNT && encoder.add(input[first])) ++first;
+        block_length[blocks] = encoder.length();
+        length += encoder.length();
+    }
+    double encode_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // And decode it again
+    int decoded = 0, offset = 0;
+    bool is_exact = true;
+    start = std::chrono::steady_clock::now();
+    for (int block = 0; block < blocks; ++block)
+    {
+        CHECK(decoder.begin(encoded + offset, block_length[block]));
+        while (decoder.next(&sample))
+        {
+            is_exact = is_exact && decoded < COUNT && sample.timestamp == input[decoded].timestamp
+                       && sample.raw_temp == input[decoded].raw_temp && sample.raw_rh == input[decoded].raw_rh;
+            ++decoded;
+        }
+        offset += block_length[block];
+    }
+    double decode_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CHECK(is_exact && decoded == COUNT);
+
+    double raw_mb = (double)COUNT * sizeof(sensor_sample_t) / 1e6;
+    printf("%i samples at 1 Hz: %i bytes raw, %i bytes encoded (%.2fx), encode %.0f MB/s, decode %.0f MB/s\n",
+           COUNT, (int)(COUNT * sizeof(sensor_sample_t)), length, (double)COUNT * sizeof(sensor_sample_t) / length,
+           raw_mb / encode_seconds, raw_mb / decode_seconds);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// main() - Runs the tests
+//=========================================================================================================
+int main()
+{
+    test_round_trip();
+    test_clock_steps();
+    test_corrupt();
+    test_export();
+    test_speed();
+    return test_result();
+}
+//=========================================================================================================
@@ -0,0 +1,264 @@
+//=========================================================================================================
+// test_sim_i2c.cpp - Tests the simulated I2C bus and devices, and the 7-segment font they display
+//
+// These drive the simulation with raw transactions, to check the device models themselves.  The
+// firmware's own drivers are run against the simulation in test_i2c_drivers.cpp
+//=========================================================================================================
+#include <string.h>
+#include "host_test.h"
+#include "sim_i2c.h"
+#include "segment_font.h"
+
+// The I2C addresses the firmware uses for the two devices
+const int HT16K33_ADDRESS = 0x70;
+const int SHT31_ADDRESS   = 0x44;
+
+
+//=========================================================================================================
+// send_command() - Sends a single command byte to the display
+//=========================================================================================================
+static i2c_result_t send_command(CSimI2CBus& bus, uint8_t command)
+{
+    return bus.transact(HT16K33_ADDRESS, false, &command, 1, nullptr, 0);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// send_ram() - Writes bytes into display RAM, starting at "address"
+//=========================================================================================================
+static i2c_result_t send_ram(CSimI2CBus& bus, uint8_t address, const uint8_t* data, int length)
+{
+    return bus.transact(HT16K33_ADDRESS, false, &address, 1, (uint8_t*)data, length);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_ht16k33() - Checks the command decoding and the rendering of display RAM
+//=========================================================================================================
+static void test_ht16k33()
+{
+    CSimI2CBus  bus;
+    CSimHT16K33 display(HT16K33_ADDRESS);
+    char        text[DISPLAY_DIGITS + 1];
+    uint8_t     pattern;
+
+    bus.attach(&display);
+
+    // The device powers up in standby
+    CHECK(!display.is_oscillator_on() && !display.is_display_on());
+
+    // Oscillator on, row driver, clear display RAM, display on, full brightness
+    const seg_frame_t blank = make_frame("");
+    CHECK(send_command(bus, 0x21) == I2C_RESULT_OK);
+    CHECK(send_command(bus, 0xA0) == I2C_RESULT_OK);
+    CHECK(send_ram(bus, 0, blank.ram, DISPLAY_RAM_SIZE) == I2C_RESULT_OK);
+    CHECK(send_command(bus, 0x81) == I2C_RESULT_OK);
+    CHECK(send_command(bus, 0xEF) == I2C_RESULT_OK);
+    CHECK(display.is_oscillator_on() && display.is_display_on());
+    CHECK(display.blink() == 0 && display.brightness() == 15);
+
+    // A full frame renders as its text, with the colon lit
+    const seg_frame_t clock = make_frame("1234", COLON_CENTER);
+    CHECK(send_ram(bus, 0, clock.ram, DISPLAY_RAM_SIZE) == I2C_RESULT_OK);
+    display.render(text);
+    CHECK(strcmp(text, "1234") == 0);
+    CHECK(display.colon());
+    CHECK(memcmp(display.ram(), clock.ram, DISPLAY_RAM_SIZE) == 0);
+
+    // A short string is padded with blanks
+    const seg_frame_t ap = make_frame(" AP");
+    CHECK(send_ram(bus, 0, ap.ram, DISPLAY_RAM_SIZE) == I2C_RESULT_OK);
+    display.render(text);
+    CHECK(strcmp(text, " AP ") == 0);
+    CHECK(!display.colon());
+
+    // A write of a single byte lands at its RAM address, which is digit 2
+    pattern = glyph('9');
+    CHECK(send_ram(bus, digit_address[2], &pattern, 1) == I2C_RESULT_OK);
+    display.render(text);
+    CHECK(strcmp(text, " A9 ") == 0);
+
+    // The decimal point isn't part of the glyph
+    pattern = glyph('7') | SEG_DP;
+    CHECK(send_ram(bus, digit_address[3], &pattern, 1) == I2C_RESULT_OK);
+    CHECK(display.segments(3) == (glyph('7') | SEG_DP));
+    display.render(text);
+    CHECK(strcmp(text, " A97") == 0);
+
+    // Every glyph in the font renders as a character with the same segments, and digits and capital
+    // letters render as themselves when no digit shares their pattern
+    for (char c = FONT_FIRST; c <= FONT_LAST; ++c)
+    {
+        pattern = glyph(c);
+        CHECK(send_ram(bus, digit_address[0], &pattern, 1) == I2C_RESULT_OK);
+        display.render(text);
+        CHECK((glyph(text[0]) & ~SEG_DP) == (glyph(c) & ~SEG_DP));
+        if (c >= '0' && c <= '9') CHECK(text[0] == c);
+    }
+    const char* letters = "ACEFHLPU";
+    for (const char* p = letters; *p; ++p)
+    {
+        pattern = glyph(*p);
+        send_ram(bus, digit_address[0], &pattern, 1);
+        display.render(text);
+        CHECK(text[0] == *p);
+    }
+
+    // Patterns shared by a digit and letters render as the digit
+    pattern = glyph('S');
+    send_ram(bus, digit_address[0], &pattern, 1);
+    display.render(text);
+    CHECK(text[0] == '5');
+
+    // A pattern that isn't in the font renders as '?'
+    pattern = SEG_A | SEG_D | SEG_E;
+    send_ram(bus, digit_address[0], &pattern, 1);
+    display.render(text);
+    CHECK(text[0] == '?');
+
+    // The display-setup command sets the blink rate, and the dimming command sets the brightness
+    CHECK(send_command(bus, 0x85) == I2C_RESULT_OK);
+    CHECK(display.blink() == 2 && display.is_display_on());
+    CHECK(send_command(bus, 0xE7) == I2C_RESULT_OK);
+    CHECK(display.brightness() == 7);
+
+    // Display off
+    CHECK(send_command(bus, 0x80) == I2C_RESULT_OK);
+    CHECK(!display.is_display_on());
+
+    // A command the HT16K33 doesn't know is NAKed
+    CHECK(send_command(bus, 0x40) == I2C_RESULT_NAK);
+
+    // RAM addresses wrap around within the 16 bytes
+    uint8_t wrap[2] = {0x11, 0x22};
+    CHECK(send_ram(bus, 15, wrap, 2) == I2C_RESULT_OK);
+    CHECK(display.ram()[15] == 0x11 && display.ram()[0] == 0x22);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// measure() - Starts a high-repeatability measurement and reads the result
+//=========================================================================================================
+static i2c_result_t measure(CSimI2CBus& bus, uint8_t* msg)
+{
+    const uint8_t command[2] = {0x2C, 0x06};
+
+    i2c_result_t result = bus.transact(SHT31_ADDRESS, false, command, 2, nullptr, 0);
+    if (result != I2C_RESULT_OK) return result;
+    return bus.transact(SHT31_ADDRESS, true, nullptr, 0, msg, 6);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_sht31() - Checks the measurement messages, the CRC, and NAK and CRC-error injection
+//=========================================================================================================
+static void test_sht31()
+{
+    CSimI2CBus bus;
+    CSimSHT31  sensor(SHT31_ADDRESS);
+    uint8_t    msg[6];
+
+    bus.attach(&sensor);
+
+    // The example in the datasheet: the CRC of 0xBEEF is 0x92
+    const uint8_t beef[2] = {0xBE, 0xEF};
+    CHECK(CSimSHT31::crc8(beef, 2) == 0x92);
+
+    // A measurement returns the raw values, each followed by its CRC
+    sensor.set_raw(0x6666, 0x8000);
+    CHECK(measure(bus, msg) == I2C_RESULT_OK);
+    CHECK(msg[0] == 0x66 && msg[1] == 0x66 && msg[2] == CSimSHT31::crc8(msg, 2));
+    CHECK(msg[3] == 0x80 && msg[4] == 0x00 && msg[5] == CSimSHT31::crc8(msg + 3, 2));
+    CHECK(sensor.measurements() == 1);
+
+    // Reading without starting a measurement is NAKed
+    CHECK(bus.transact(SHT31_ADDRESS, true, nullptr, 0, msg, 6) == I2C_RESULT_NAK);
+
+    // A command that isn't two bytes long is NAKed
+    const uint8_t short_command = 0x2C;
+    CHECK(bus.transact(SHT31_ADDRESS, false, &short_command, 1, nullptr, 0) == I2C_RESULT_NAK);
+
+    // Injected NAKs apply to that many transactions, and then the sensor answers normally
+    sensor.inject_naks(2);
+    CHECK(measure(bus, msg) == I2C_RESULT_NAK);
+    CHECK(measure(bus, msg) == I2C_RESULT_NAK);
+    CHECK(measure(bus, msg) == I2C_RESULT_OK);
+    CHECK(sensor.measurements() == 2);
+
+    // An injected CRC error corrupts the temperature CRC of that many measurements
+    sensor.inject_crc_errors(1);
+    CHECK(measure(bus, msg) == I2C_RESULT_OK);
+    CHECK(msg[2] != CSimSHT31::crc8(msg, 2));
+    CHECK(msg[5] == CSimSHT31::crc8(msg + 3, 2));
+    CHECK(measure(bus, msg) == I2C_RESULT_OK);
+    CHECK(msg[2] == CSimSHT31::crc8(msg, 2));
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_bus_time() - Checks the transaction counts and the model of the time each transaction takes
+//
+// Each byte is 9 bit-times, plus one each for the start and the stop.  A read that follows a register
+// address adds a repeated start and a second address byte
+//=========================================================================================================
+static void test_bus_time()
+{
+    CSimI2CBus  bus;
+    CSimHT16K33 display(HT16K33_ADDRESS);
+    CSimSHT31   sensor(SHT31_ADDRESS);
+    uint8_t     ram[DISPLAY_RAM_SIZE] = {0};
+    uint8_t     reg = 0;
+
+    bus.attach(&display);
+    bus.attach(&sensor);
+
+    // A full frame: address + RAM address + 16 bytes = 2 + 9 * 18 = 164 bits, 1640 us at 100 kHz
+    CHECK(send_ram(bus, 0, ram, DISPLAY_RAM_SIZE) == I2C_RESULT_OK);
+    CHECK(bus.transactions() == 1 && bus.bytes() == 17 && bus.elapsed_us() == 1640);
+
+    // The same frame at 400 kHz takes a quarter as long
+    bus.reset_counters();
+    bus.set_speed(400000);
+    CHECK(send_ram(bus, 0, ram, DISPLAY_RAM_SIZE) == I2C_RESULT_OK);
+    CHECK(bus.transactions() == 1 && bus.elapsed_us() == 410);
+
+    // A single command byte: 2 + 9 * 2 = 20 bits, 50 us at 400 kHz
+    bus.reset_counters();
+    CHECK(send_command(bus, 0x81) == I2C_RESULT_OK);
+    CHECK(bus.bytes() == 1 && bus.elapsed_us() == 50);
+
+    // A register read of 6 bytes: 2 + 9 * 8 + 10 = 84 bits, 840 us at 100 kHz
+    bus.reset_counters();
+    bus.set_speed(100000);
+    CHECK(bus.transact(HT16K33_ADDRESS, true, &reg, 1, ram, 6) == I2C_RESULT_OK);
+    CHECK(bus.bytes() == 7 && bus.elapsed_us() == 840);
+
+    // A whole SHT31 reading is two transactions: 2 + 9 * 3 = 29 bits, then 2 + 9 * 7 = 65 bits
+    bus.reset_counters();
+    CHECK(measure(bus, ram) == I2C_RESULT_OK);
+    CHECK(bus.transactions() == 2 && bus.bytes() == 8 && bus.elapsed_us() == 940);
+
+    // A NAKed transaction still takes bus time, but transfers nothing
+    bus.reset_counters();
+    CHECK(bus.transact(0x20, false, &reg, 1, nullptr, 0) == I2C_RESULT_NAK);
+    CHECK(bus.transactions() == 1 && bus.bytes() == 0 && bus.elapsed_us() == 200);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// main() - Runs the tests
+//=========================================================================================================
+int main()
+{
+    test_ht16k33();
+    test_sht31();
+    test_bus_time();
+    return test_result();
+}
+//=========================================================================================================
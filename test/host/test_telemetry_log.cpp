@@ -0,0 +1,318 @@
+//=========================================================================================================
+// test_telemetry_log.cpp - Tests the telemetry log, stored in a file that stands in for its partition
+//=========================================================================================================
+#include <stdio.h>
+#include <chrono>
+#include "host_test.h"
+#include "file_store.h"
+#include "telemetry_log.h"
+
+// The file that stands in for the partition, and the size of the partition: a ring of 4 sectors
+static const char* STORE_FILE = "telemetry_test.bin";
+const uint32_t STORE_SIZE = 4 * CLogStore::SECTOR_SIZE;
+
+// A sector holds a 12-byte header, then 8-byte records
+const int SLOTS_PER_SECTOR = (CLogStore::SECTOR_SIZE - 12) / 8;
+
+
+//=========================================================================================================
+// open_fresh() - Opens an empty store
+//=========================================================================================================
+static bool open_fresh(CFileStore& store)
+{
+    remove(STORE_FILE);
+    return store.open(STORE_FILE, STORE_SIZE);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// append_run() - Appends "count" records, "interval" seconds apart, starting at "timestamp"
+//=========================================================================================================
+static void append_run(CTelemetryLog& log, uint32_t timestamp, int count, int interval = 60)
+{
+    for (int i=0; i<count; ++i)
+    {
+        CHECK(log.append(timestamp + i * interval, 2000 + i % 500, 40 + i % 10));
+    }
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_append_and_read() - Checks that records read back as written, and that find() finds them
+//=========================================================================================================
+static void test_append_and_read()
+{
+    CFileStore      store;
+    CTelemetryLog   log;
+    telemetry_rec_t record;
+
+    CHECK(open_fresh(store));
+    CHECK(log.begin(&store));
+    CHECK(log.is_ready() && log.count() == 0 && log.is_ordered());
+
+    append_run(log, 1000, 100);
+    CHECK(log.count() == 100);
+
+    // Every record reads back as it was written
+    for (int i=0; i<100; ++i)
+    {
+        CHECK(log.read(i, &record));
+        CHECK(record.timestamp == 1000u + i * 60 && record.temp_centi_c == 2000 + i && record.humidity == 40 + i % 10);
+    }
+
+    // Out of range indices fail
+    CHECK(!log.read(-1, &record) && !log.read(100, &record));
+
+    // find() returns the first record at or after the time
+    CHECK(log.is_ordered());
+    CHECK(log.find(0)           == 0);
+    CHECK(log.find(1000)        == 0);
+    CHECK(log.find(1000 + 3000) == 50);
+    CHECK(log.find(1000 + 2999) == 50);
+    CHECK(log.find(1000 + 3001) == 51);
+    CHECK(log.find(99999)       == 100);
+
+    // A log too small to be a ring is refused
+    CFileStore    tiny;
+    CTelemetryLog tiny_log;
+    remove("tiny_test.bin");
+    CHECK(tiny.open("tiny_test.bin", CLogStore::SECTOR_SIZE));
+    CHECK(!tiny_log.begin(&tiny) && !tiny_log.is_ready() && !tiny_log.append(1, 2, 3));
+    tiny.close();
+    remove("tiny_test.bin");
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_reopen() - Checks that the log is found again after a reboot, and that appends carry on
+//=========================================================================================================
+static void test_reopen()
+{
+    CFileStore      store;
+    telemetry_rec_t record;
+
+    CHECK(open_fresh(store));
+    {
+        CTelemetryLog log;
+        CHECK(log.begin(&store));
+        append_run(log, 1000, SLOTS_PER_SECTOR + 20);
+    }
+
+    // Re-open the file, as a reboot would
+    store.close();
+    CHECK(store.open(STORE_FILE, STORE_SIZE));
+
+    CTelemetryLog log;
+    CHECK(log.begin(&store));
+    CHECK(log.count() == SLOTS_PER_SECTOR + 20);
+    CHECK(log.read(SLOTS_PER_SECTOR + 19, &record) && record.timestamp == 1000u + (SLOTS_PER_SECTOR + 19) * 60);
+
+    // The next record goes after the last one
+    CHECK(log.append(900000, 1234, 56));
+    CHECK(log.count() == SLOTS_PER_SECTOR + 21);
+    CHECK(log.read(SLOTS_PER_SECTOR + 20, &record) && record.timestamp == 900000 && record.temp_centi_c == 1234);
+    CHECK(log.is_ordered());
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_wrap() - Checks that the oldest sector is recycled once the ring is full, and that every sector
+//               gets erased in turn
+//=========================================================================================================
+static void test_wrap()
+{
+    CFileStore      store;
+    CTelemetryLog   log;
+    telemetry_rec_t record;
+
+    CHECK(open_fresh(store));
+    CHECK(log.begin(&store));
+
+    // Fill all 4 sectors, then 300 records more
+    const int total = 4 * SLOTS_PER_SECTOR + 300;
+    append_run(log, 1000, total);
+
+    // The first sector was recycled, so it holds the newest 300 records and the oldest are gone
+    CHECK(log.count() == 3 * SLOTS_PER_SECTOR + 300);
+    int dropped = total - log.count();
+    CHECK(log.read(0, &record) && record.timestamp == 1000u + dropped * 60);
+    CHECK(log.read(log.count() - 1, &record) && record.timestamp == 1000u + (total - 1) * 60);
+
+    // Each of the 4 sectors was erased once, and the first one twice
+    CHECK(store.erases() == 5);
+
+    // Binary search still works across the wrap
+    CHECK(log.find(1000 + (dropped + 700) * 60) == 700);
+    CHECK(log.find(0) == 0);
+
+    // And the log is found intact after a reboot
+    store.close();
+    CHECK(store.open(STORE_FILE, STORE_SIZE));
+    CTelemetryLog reopened;
+    CHECK(reopened.begin(&store));
+    CHECK(reopened.count() == log.count());
+    CHECK(reopened.read(0, &record) && record.timestamp == 1000u + dropped * 60);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_clock_step() - Checks that find() still works when the clock steps backwards, and that the log
+//                     goes back to binary searches once the step has been recycled out of it
+//=========================================================================================================
+static void test_clock_step()
+{
+    CFileStore      store;
+    telemetry_rec_t record;
+
+    CHECK(open_fresh(store));
+    {
+        CTelemetryLog log;
+        CHECK(log.begin(&store));
+        append_run(log, 100000, 10);
+    }
+
+    // After a reboot, the clock comes back earlier than the newest record
+    store.close();
+    CHECK(store.open(STORE_FILE, STORE_SIZE));
+    CTelemetryLog log;
+    CHECK(log.begin(&store));
+    CHECK(log.is_ordered());
+    append_run(log, 50000, 90);
+    CHECK(!log.is_ordered());
+
+    // Records 0-9 are at 100000+, and records 10-99 are at 50000 thru 55340.  A binary search for 52000
+    // would land in the second run, but the first record at or after 52000 is record 0
+    CHECK(log.find(52000) == 0);
+    CHECK(log.find(100000 + 9 * 60) == 9);
+    CHECK(log.find(100000 + 9 * 60 + 1) == 100);
+
+    // The step is remembered across a reboot
+    store.close();
+    CHECK(store.open(STORE_FILE, STORE_SIZE));
+    CTelemetryLog reopened;
+    CHECK(reopened.begin(&store));
+    CHECK(!reopened.is_ordered());
+    CHECK(reopened.find(52000) == 0);
+
+    // Fill the ring, then 10 more records to recycle the sector with the step.  Then binary searches
+    // are back
+    const int more = 4 * SLOTS_PER_SECTOR - 100 + 10;
+    append_run(reopened, 60000, more);
+    CHECK(reopened.is_ordered());
+    CHECK(reopened.count() == 3 * SLOTS_PER_SECTOR + 10);
+    CHECK(reopened.read(0, &record) && reopened.find(record.timestamp) == 0);
+    CHECK(reopened.find(60000 + (more - 10) * 60) == reopened.count() - 10);
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_torn_record() - Checks that a record that was only partially written isn't returned
+//=========================================================================================================
+static void test_torn_record()
+{
+    CFileStore      store;
+    CTelemetryLog   log;
+    telemetry_rec_t record;
+
+    CHECK(open_fresh(store));
+    CHECK(log.begin(&store));
+    append_run(log, 1000, 3);
+
+    // Clear some bits of record 1's temperature, as a write interrupted by a power cut might
+    const uint8_t torn = 0x0F;
+    CHECK(store.write(12 + 8 * 1 + 4, &torn, 1));
+
+    CHECK(log.read(0, &record));
+    CHECK(!log.read(1, &record));
+    CHECK(log.read(2, &record));
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// seconds_since() - Returns the number of seconds since "start"
+//=========================================================================================================
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// test_timing() - Measures how fast records are appended to a file-backed log, and how fast find() is
+//                 with a binary search and with the linear scan that a clock step forces
+//=========================================================================================================
+static void test_timing()
+{
+    const uint32_t SIZE    = 64 * CLogStore::SECTOR_SIZE;
+    const int      APPENDS = 60 * SLOTS_PER_SECTOR;
+    const int      FINDS   = 2000;
+    const int      SCANS   = 50;
+    CFileStore     store;
+    CTelemetryLog  log;
+
+    remove(STORE_FILE);
+    CHECK(store.open(STORE_FILE, SIZE));
+    CHECK(log.begin(&store));
+
+    // Append readings a minute apart
+    auto start = std::chrono::steady_clock::now();
+    append_run(log, 1000, APPENDS);
+    double append_seconds = seconds_since(start);
+    CHECK(log.count() == APPENDS);
+
+    // Look up times spread across the whole log with binary searches
+    CHECK(log.is_ordered());
+    int found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i=0; i<FINDS; ++i)
+    {
+        int index = (int)((long long)i * APPENDS / FINDS);
+        found += (log.find(1000 + index * 60) == index);
+    }
+    double binary_seconds = seconds_since(start);
+    CHECK(found == FINDS);
+
+    // Step the clock back, so find() must scan the log, and look up the same times again
+    append_run(log, 500, 1);
+    CHECK(!log.is_ordered());
+    // A scan reads every record, so fewer of them are timed
+    found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i=0; i<SCANS; ++i)
+    {
+        int index = (int)((long long)i * APPENDS / SCANS);
+        found += (log.find(1000 + index * 60) == index);
+    }
+    double linear_seconds = seconds_since(start);
+    CHECK(found == SCANS);
+
+    printf("%i records: %.0f appends/s, %.0f finds/s with a binary search, %.0f finds/s with a linear scan\n",
+           APPENDS, APPENDS / append_seconds, FINDS / binary_seconds, SCANS / linear_seconds);
+    store.close();
+}
+//=========================================================================================================
+
+
+//=========================================================================================================
+// main() - Runs the tests
+//=========================================================================================================
+int main()
+{
+    test_append_and_read();
+    test_reopen();
+    test_wrap();
+    test_clock_step();
+    test_torn_record();
+    test_timing();
+    remove(STORE_FILE);
+    return test_result();
+}
+//=========================================================================================================
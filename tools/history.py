@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+#==========================================================================================================
+# history.py - Fetches the clock's temperature/humidity history and prints it
+#
+# Usage:  history.py <host>
+#         history.py --file <dump_file>
+#
+# The history is fetched with "HTTP GET /history".  --file decodes a copy that was saved earlier.  The
+# history is a series of blocks, each preceded by its length as a 2-byte little-endian number.  The
+# format of a block is described in main/series_codec.h
+#==========================================================================================================
+import sys
+import time
+import urllib.request
+
+FORMAT_VERSION = 1
+
+
+#==========================================================================================================
+# fetch() - Fetches the history from the clock
+#==========================================================================================================
+def fetch(host):
+    with urllib.request.urlopen("http://%s/history" % host, timeout=60) as reply:
+        return reply.read()
+
+
+#==========================================================================================================
+# varints() - Yields the varints in a block, starting at "offset"
+#==========================================================================================================
+def varints(block, offset):
+    value, shift = 0, 0
+    for c in block[offset:]:
+        value |= (c & 0x7F) << shift
+        shift += 7
+        if c & 0x80 == 0:
+            yield value
+            value, shift = 0, 0
+
+
+#==========================================================================================================
+# unzigzag() - Maps a zigzag varint back to a signed value
+#==========================================================================================================
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+#==========================================================================================================
+# decode_block() - Yields the (timestamp, raw_temp, raw_rh) samples in a block
+#==========================================================================================================
+def decode_block(block):
+    if len(block) < 3 or block[0] != FORMAT_VERSION:
+        raise ValueError("Unknown block format")
+    count  = block[1] | block[2] << 8
+    values = varints(block, 3)
+
+    timestamp, raw_temp, raw_rh, delta = 0, 0, 0, 0
+    for n in range(count):
+        if n == 0:
+            timestamp, raw_temp, raw_rh = next(values), next(values), next(values)
+        else:
+            delta     += unzigzag(next(values))
+            timestamp += delta
+            raw_temp  += unzigzag(next(values))
+            raw_rh    += unzigzag(next(values))
+        yield timestamp, raw_temp, raw_rh
+
+
+#==========================================================================================================
+# decode() - Yields the samples in the history, converted the same way the firmware converts readings
+#            from the SHT31: hundredths of a degree C, and percent relative humidity
+#==========================================================================================================
+def decode(history):
+    offset = 0
+    while offset + 2 <= len(history):
+        length = history[offset] | history[offset + 1] << 8
+        block  = history[offset + 2 : offset + 2 + length]
+        offset += 2 + length
+        for timestamp, raw_temp, raw_rh in decode_block(block):
+            yield timestamp, ((17500 * raw_temp) >> 16) - 4500, (100 * raw_rh) >> 16
+
+
+#==========================================================================================================
+# main
+#==========================================================================================================
+if __name__ == "__main__":
+    if len(sys.argv) == 3 and sys.argv[1] == "--file":
+        history = open(sys.argv[2], "rb").read()
+    elif len(sys.argv) == 2:
+        history = fetch(sys.argv[1])
+    else:
+        print("Usage: history.py <host> | --file <dump_file>")
+        sys.exit(1)
+
+    count = 0
+    for timestamp, centi_c, rh in decode(history):
+        when = time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(timestamp))
+        print("%s %6.2fC %3i%%" % (when, centi_c / 100.0, rh))
+        count += 1
+
+    if count:
+        print("%i readings in %i bytes (%.2f bytes per reading)" % (count, len(history), len(history) / count))
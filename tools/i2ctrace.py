@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+#==========================================================================================================
+# i2ctrace.py - Fetches the clock's I2C transaction trace and renders it as a timeline
+#
+# Usage:  i2ctrace.py <host> [count]
+#         i2ctrace.py --file <dump_file>
+#
+# The trace is fetched with the "i2ctrace" command on the clock's TCP command port.  --file renders
+# a dump that was saved earlier (the raw text the command returns).  Each line of the dump is:
+#
+#   sequence timestamp_us bus_us address R|W reg_length length result first_bytes
+#==========================================================================================================
+import socket
+import sys
+
+TCP_PORT    = 1000
+BAR_SCALE   = 50                # Microseconds of bus time per character of the bar
+MAX_BAR     = 40
+
+DEVICE_NAMES = {
+    0x70 : "HT16K33",
+    0x44 : "SHT31",
+}
+
+
+#==========================================================================================================
+# fetch() - Sends the "i2ctrace" command to the clock and returns the lines of its reply
+#==========================================================================================================
+def fetch(host, count):
+    command = "i2ctrace %s\r\n" % count if count else "i2ctrace\r\n"
+    sock = socket.create_connection((host, TCP_PORT), timeout=5)
+    sock.sendall(command.encode())
+
+    # The reply ends with a line that starts with "OK" or "FAIL"
+    reply = b""
+    while True:
+        chunk = sock.recv(4096)
+        if not chunk: break
+        reply += chunk
+        lines = reply.split(b"\r\n")
+        if len(lines) > 1 and lines[-2].startswith((b"OK", b"FAIL")): break
+    sock.close()
+    return reply.decode(errors="replace").splitlines()
+
+
+#==========================================================================================================
+# parse() - Turns the lines of a dump into a list of records
+#==========================================================================================================
+def parse(lines):
+    records = []
+    for line in lines:
+        fields = line.split()
+        if len(fields) != 9 or not fields[0].isdigit(): continue
+        sequence, timestamp, bus_us, address, op, reg_length, length, result, first = fields
+        records.append({
+            "sequence"   : int(sequence),
+            "timestamp"  : int(timestamp),
+            "bus_us"     : int(bus_us),
+            "address"    : int(address, 16),
+            "op"         : op,
+            "reg_length" : int(reg_length),
+            "length"     : int(length),
+            "result"     : result,
+            "first"      : bytes.fromhex(first),
+        })
+    return records
+
+
+#==========================================================================================================
+# render() - Prints the records as a timeline
+#==========================================================================================================
+def render(records):
+    if not records:
+        print("The trace is empty")
+        return
+
+    start         = records[0]["timestamp"]
+    prior         = None
+    last_sequence = None
+
+    print("%8s %10s %8s  %-12s %-2s %5s %-7s %-11s %s" %
+          ("seq", "time_ms", "gap_ms", "device", "", "bytes", "result", "first", "bus time"))
+
+    for record in records:
+        # The timestamps are the low 32 bits of a microsecond clock, so they wrap every 71 minutes
+        elapsed = (record["timestamp"] - start) & 0xFFFFFFFF
+        gap     = "" if prior is None else "%.3f" % (((record["timestamp"] - prior) & 0xFFFFFFFF) / 1000.0)
+        prior   = record["timestamp"]
+
+        # A break in the sequence numbers means records were overwritten before we could read them
+        if last_sequence is not None and record["sequence"] != last_sequence + 1:
+            print("%8s ... %i records lost ..." % ("", record["sequence"] - last_sequence - 1))
+        last_sequence = record["sequence"]
+
+        address = record["address"]
+        device  = "%s(%02X)" % (DEVICE_NAMES.get(address, ""), address)
+        shown   = min(len(record["first"]), record["reg_length"] + record["length"])
+        first   = record["first"][:shown].hex(" ")
+        bar     = "#" * min(MAX_BAR, max(1, record["bus_us"] // BAR_SCALE))
+
+        print("%8i %10.3f %8s  %-12s %-2s %5i %-7s %-11s %s %ius" %
+              (record["sequence"], elapsed / 1000.0, gap, device, record["op"],
+               record["reg_length"] + record["length"], record["result"], first, bar, record["bus_us"]))
+
+
+#==========================================================================================================
+# Execution begins here
+#==========================================================================================================
+if __name__ == "__main__":
+    args = sys.argv[1:]
+
+    if len(args) == 2 and args[0] == "--file":
+        with open(args[1]) as f: render(parse(f.read().splitlines()))
+    elif len(args) in (1, 2) and not args[0].startswith("-"):
+        render(parse(fetch(args[0], args[1] if len(args) == 2 else None)))
+    else:
+        sys.exit("usage: i2ctrace.py <host> [count]\n"
+                 "       i2ctrace.py --file <dump_file>")
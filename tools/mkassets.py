@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+#==========================================================================================================
+# mkassets.py - Builds the image for the read-only asset partition from a directory of files
+#
+# Usage:  mkassets.py <asset_dir> <image_file> [--max-size N]
+#         mkassets.py --verify <image_file> <asset_dir>
+#
+# Every file under <asset_dir> becomes an asset whose resource name is its path relative to <asset_dir>
+# with a leading "/".  The image layout must match asset_header_t and asset_entry_t in main/assets.h
+#
+# --verify reads an image back and compares every asset's bytes, length and CRC with its source file
+#==========================================================================================================
+import os
+import struct
+import sys
+import zlib
+
+MAGIC       = 0x54455341        # "ASET"
+HEADER_FMT  = "<II"             # magic, count
+ENTRY_FMT   = "<48s32sIII"      # name, content_type, offset, length, crc
+NAME_LEN    = 48
+TYPE_LEN    = 32
+
+CONTENT_TYPES = {
+    ".html" : "text/html",
+    ".htm"  : "text/html",
+    ".css"  : "text/css",
+    ".js"   : "application/javascript",
+    ".json" : "application/json",
+    ".txt"  : "text/plain",
+    ".svg"  : "image/svg+xml",
+    ".png"  : "image/png",
+    ".jpg"  : "image/jpeg",
+    ".ico"  : "image/x-icon",
+    ".bin"  : "application/octet-stream",
+}
+
+
+#==========================================================================================================
+# collect() - Returns a sorted list of (resource_name, path) for every file in the asset directory
+#==========================================================================================================
+def collect(asset_dir):
+    assets = []
+    for root, dirs, files in os.walk(asset_dir):
+        dirs.sort()
+        for name in sorted(files):
+            path = os.path.join(root, name)
+            resource = "/" + os.path.relpath(path, asset_dir).replace(os.sep, "/")
+            if len(resource) >= NAME_LEN:
+                sys.exit("mkassets: resource name too long: " + resource)
+            assets.append((resource, path))
+    return assets
+
+
+#==========================================================================================================
+# build() - Writes the image file
+#==========================================================================================================
+def build(asset_dir, image_file, max_size):
+    assets  = collect(asset_dir)
+    index   = b""
+    data    = b""
+    offset  = struct.calcsize(HEADER_FMT) + len(assets) * struct.calcsize(ENTRY_FMT)
+
+    for resource, path in assets:
+        with open(path, "rb") as f:
+            content = f.read()
+        content_type = CONTENT_TYPES.get(os.path.splitext(path)[1].lower(), "application/octet-stream")
+        index  += struct.pack(ENTRY_FMT, resource.encode(), content_type.encode(), offset + len(data),
+                              len(content), zlib.crc32(content) & 0xFFFFFFFF)
+        data   += content
+
+        # Keep each asset 4-byte aligned
+        data   += b"\0" * (-len(data) % 4)
+
+    image = struct.pack(HEADER_FMT, MAGIC, len(assets)) + index + data
+
+    if max_size and len(image) > max_size:
+        sys.exit("mkassets: image is %i bytes, partition is only %i" % (len(image), max_size))
+
+    with open(image_file, "wb") as f:
+        f.write(image)
+
+    print("mkassets: %i assets, %i bytes" % (len(assets), len(image)))
+
+
+#==========================================================================================================
+# verify() - Compares every asset in an image with its source file
+#==========================================================================================================
+def verify(image_file, asset_dir):
+    with open(image_file, "rb") as f:
+        image = f.read()
+
+    magic, count = struct.unpack_from(HEADER_FMT, image, 0)
+    if magic != MAGIC:
+        sys.exit("mkassets: %s has a bad magic number" % image_file)
+
+    assets = collect(asset_dir)
+    if count != len(assets):
+        sys.exit("mkassets: image has %i assets, directory has %i" % (count, len(assets)))
+
+    for i, (resource, path) in enumerate(assets):
+        entry_offset = struct.calcsize(HEADER_FMT) + i * struct.calcsize(ENTRY_FMT)
+        name, content_type, offset, length, crc = struct.unpack_from(ENTRY_FMT, image, entry_offset)
+        with open(path, "rb") as f:
+            content = f.read()
+        if name.rstrip(b"\0").decode() != resource:
+            sys.exit("mkassets: entry %i is %s, expected %s" % (i, name, resource))
+        if image[offset:offset + length] != content or crc != zlib.crc32(content) & 0xFFFFFFFF:
+            sys.exit("mkassets: %s doesn't match its source file" % resource)
+
+    print("mkassets: verified %i assets" % count)
+
+
+#==========================================================================================================
+# Execution begins here
+#==========================================================================================================
+if __name__ == "__main__":
+    args = sys.argv[1:]
+
+    if len(args) == 3 and args[0] == "--verify":
+        verify(args[1], args[2])
+    elif len(args) == 2:
+        build(args[0], args[1], 0)
+    elif len(args) == 4 and args[2] == "--max-size":
+        build(args[0], args[1], int(args[3], 0))
+    else:
+        sys.exit("usage: mkassets.py <asset_dir> <image_file> [--max-size N]\n"
+                 "       mkassets.py --verify <image_file> <asset_dir>")